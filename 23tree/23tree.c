@@ -34,12 +34,14 @@
 #include <strings.h>
 #include "23tree.h"
 
-#define DEBUG_TREE23 1
+#ifndef DEBUG_TREE23
+#define DEBUG_TREE23 0
+#endif
 
 #if DEBUG_TREE23
 #define debug printf
 #else
-#define debug
+#define debug(...)
 #endif
 
 #define NODE_IS_STABLE(node) (!node->data[2].key)
@@ -102,20 +104,50 @@ static tree23_node_t *node_create(tree23_t *tree, int is_leaf)
 	return node;
 }
 
-/* free one node (recursively, with data) */
-void node_destroy(tree23_node_t *node)
+/* return the index of `child' in its parent's childs[] */
+static int node_child_index(tree23_node_t *child)
 {
-	tree23_data_handler_t destructor = node->tree->destructor;
+	tree23_node_t *parent = child->parent;
 	int i = 0;
-	debug("destoying node %p\n", node);
+
+	assert(parent);
 	for (i = 0; i < 4; i++)
-		if (node->childs[i])
-			node_destroy(node->childs[i]);
-	if (destructor)
-		for (i = 0; i < 3; i++)
-			if (node->data[i].key)
-				destructor(&node->data[i]);
-	__free(node);
+		if (parent->childs[i] == child)
+			return i;
+	assert(0);
+	return -1;
+}
+
+/* free one node and all its descendants (with data). This walks in post
+ * order with the parent pointers rather than recursion: a node is freed
+ * once it has no child left, and detached from its parent before that so
+ * the parent could be freed in the same way. */
+static void node_destroy(tree23_node_t *node)
+{
+	tree23_data_handler_t destructor = node->tree->destructor;
+	tree23_node_t *top = node->parent, *parent = NULL;
+	int i = 0;
+
+	while (node != top) {
+		for (i = 0; i < 4; i++)
+			if (node->childs[i])
+				break;
+		if (i < 4) {
+			node = node->childs[i];
+			continue;
+		}
+
+		debug("destoying node %p\n", node);
+		parent = node->parent;
+		if (parent != top)
+			parent->childs[node_child_index(node)] = NULL;
+		if (destructor)
+			for (i = 0; i < 3; i++)
+				if (node->data[i].key)
+					destructor(&node->data[i]);
+		__free(node);
+		node = parent;
+	}
 }
 
 void tree23_destroy(tree23_t *tree)
@@ -258,6 +290,11 @@ static int node_split(tree23_node_t *node)
 	new_node->childs[0] = node->childs[2];
 	new_node->childs[1] = node->childs[3];
 	node->childs[2] = node->childs[3] = NULL;
+	/* the moved childs have a new parent now */
+	if (new_node->childs[0])
+		new_node->childs[0]->parent = new_node;
+	if (new_node->childs[1])
+		new_node->childs[1]->parent = new_node;
 
 	/* we have finished the splitting of current node. Let us see whether
 	 * the split need to be spreaded upward. */
@@ -388,42 +425,56 @@ static void node_dump(tree23_node_t *node, int indent)
 		node_dump(node->childs[3], indent + 1);
 }
 
-static tree23_data_t *node_lookup(tree23_node_t *node, tree23_key_t key)
+/* find the node containing `key' under `node', and the index of key in it.
+ * Return NULL if nothing found. */
+static tree23_node_t *node_find(tree23_node_t *node, tree23_key_t key,
+				int *index)
 {
-	tree23_node_t *next = NULL;
-        tree23_key_cmp_func_t cmp = node->tree->cmp;
-	int result = cmp(node->data[0].key, key);
-	if (result > 0) {
-		next = node->childs[0];
-		goto lookup_next;
-	} else if (result == 0)
-		/* we found it! */
-		return &node->data[0];
-
-	/* so... bigger than 1st item */
-
-	if (node->data[1].key == NULL) {
-		/* no 2nd item */
-		next = node->childs[1];
-		goto lookup_next;
-	}
+	tree23_key_cmp_func_t cmp = node->tree->cmp;
+	int result = 0;
+
+	while (node) {
+		result = cmp(node->data[0].key, key);
+		if (result == 0) {
+			/* we found it! */
+			*index = 0;
+			return node;
+		}
+		if (result > 0) {
+			node = node->childs[0];
+			continue;
+		}
 
-	/* so... there are 2nd item... */
+		/* so... bigger than 1st item */
 
-	result = cmp(node->data[1].key, key);
-	if (result == 0)
-		return &node->data[1];
-	else if (result > 0)
-		next = node->childs[1];
-	else
-		next = node->childs[2];
+		if (node->data[1].key == NULL) {
+			/* no 2nd item */
+			node = node->childs[1];
+			continue;
+		}
 
-lookup_next:
-	if (!next)
-		/* possibly this is a leaf node. */
-		return NULL;
+		/* so... there are 2nd item... */
+
+		result = cmp(node->data[1].key, key);
+		if (result == 0) {
+			*index = 1;
+			return node;
+		} else if (result > 0)
+			node = node->childs[1];
+		else
+			node = node->childs[2];
+	}
+
+	/* we have walked past a leaf node. */
+	return NULL;
+}
 
-	return node_lookup(next, key);
+static tree23_data_t *node_lookup(tree23_node_t *node, tree23_key_t key)
+{
+	int index = 0;
+
+	node = node_find(node, key, &index);
+	return node ? &node->data[index] : NULL;
 }
 
 tree23_data_t *tree23_lookup(tree23_t *tree, tree23_key_t key)
@@ -444,3 +495,241 @@ void tree23_dump(tree23_t *tree)
 	else
 		node_dump(tree->root, 0);
 }
+
+/* number of data in one stable node */
+static inline int node_nkeys(tree23_node_t *node)
+{
+	return node->data[1].key ? 2 : (node->data[0].key ? 1 : 0);
+}
+
+/* remove data[index] of a node, together with childs[index + 1] */
+static void node_remove_data(tree23_node_t *node, int index)
+{
+	int i = 0;
+
+	for (i = index; i < 2; i++) {
+		node->data[i] = node->data[i + 1];
+		node->childs[i + 1] = node->childs[i + 2];
+	}
+	node_data_clear(&node->data[2]);
+	node->childs[3] = NULL;
+}
+
+/* move `child' under `parent' at childs[index] */
+static inline void node_set_child(tree23_node_t *parent, int index,
+				  tree23_node_t *child)
+{
+	parent->childs[index] = child;
+	if (child)
+		child->parent = parent;
+}
+
+/*
+ * Fix up one node which has just lost its only data. An empty internal node
+ * still has one child at childs[0]. If an adjacent sibling has two data,
+ * borrow one through the parent. Otherwise merge the node into a sibling
+ * together with the parent's data between them, and then the parent loses
+ * one data and may need fixing as well.
+ */
+static void node_fix_empty(tree23_node_t *node)
+{
+	tree23_t *tree = node->tree;
+	tree23_node_t *parent = NULL, *sibling = NULL;
+	int index = 0;
+
+	while (node_nkeys(node) == 0) {
+		parent = node->parent;
+		if (!parent) {
+			/* the root is empty: the tree shrinks by one level */
+			tree->root = node->childs[0];
+			if (tree->root)
+				tree->root->parent = NULL;
+			debug("root node %p removed\n", node);
+			__free(node);
+			return;
+		}
+
+		index = node_child_index(node);
+
+		if (index > 0 && node_nkeys(parent->childs[index - 1]) == 2) {
+			/* borrow from the left sibling */
+			sibling = parent->childs[index - 1];
+			node_set_child(node, 1, node->childs[0]);
+			node_set_child(node, 0, sibling->childs[2]);
+			node->data[0] = parent->data[index - 1];
+			parent->data[index - 1] = sibling->data[1];
+			node_data_clear(&sibling->data[1]);
+			sibling->childs[2] = NULL;
+			return;
+		}
+
+		if (index < node_nkeys(parent) &&
+		    node_nkeys(parent->childs[index + 1]) == 2) {
+			/* borrow from the right sibling */
+			sibling = parent->childs[index + 1];
+			node->data[0] = parent->data[index];
+			node_set_child(node, 1, sibling->childs[0]);
+			parent->data[index] = sibling->data[0];
+			sibling->data[0] = sibling->data[1];
+			node_data_clear(&sibling->data[1]);
+			sibling->childs[0] = sibling->childs[1];
+			sibling->childs[1] = sibling->childs[2];
+			sibling->childs[2] = NULL;
+			return;
+		}
+
+		if (index > 0) {
+			/* merge into the left sibling, which has one data */
+			sibling = parent->childs[index - 1];
+			sibling->data[1] = parent->data[index - 1];
+			node_set_child(sibling, 2, node->childs[0]);
+			node_remove_data(parent, index - 1);
+		} else {
+			/* merge into the right sibling, which has one data */
+			sibling = parent->childs[1];
+			sibling->data[1] = sibling->data[0];
+			sibling->data[0] = parent->data[0];
+			sibling->childs[2] = sibling->childs[1];
+			sibling->childs[1] = sibling->childs[0];
+			node_set_child(sibling, 0, node->childs[0]);
+			/* drop data[0] and childs[0] (the empty node) */
+			parent->childs[0] = parent->childs[1];
+			node_remove_data(parent, 0);
+		}
+		debug("node %p merged into %p\n", node, sibling);
+		__free(node);
+		node = parent;
+	}
+}
+
+int tree23_delete(tree23_t *tree, tree23_key_t key)
+{
+	tree23_node_t *node = NULL, *leaf = NULL;
+	tree23_data_t removed;
+	int index = 0;
+
+	assert(tree);
+	if (!key || !tree->root)
+		return -1;
+
+	node = node_find(tree->root, key, &index);
+	if (!node)
+		return -1;
+	removed = node->data[index];
+
+	if (!node->is_leaf) {
+		/* replace it with the successor, which is always in a leaf,
+		 * then remove the successor from the leaf instead. */
+		leaf = node->childs[index + 1];
+		while (!leaf->is_leaf)
+			leaf = leaf->childs[0];
+		node->data[index] = leaf->data[0];
+		node = leaf;
+		index = 0;
+	}
+
+	node_remove_data(node, index);
+	if (node_nkeys(node) == 0)
+		node_fix_empty(node);
+
+	if (tree->destructor)
+		tree->destructor(&removed);
+	return 0;
+}
+
+/* point cursor to the data following (node, index) in sorted order */
+static void cursor_forward(tree23_cursor_t *cursor)
+{
+	tree23_node_t *node = cursor->node;
+	int index = cursor->index;
+
+	if (!node->is_leaf) {
+		/* the leftmost data of the right subtree */
+		node = node->childs[index + 1];
+		while (!node->is_leaf)
+			node = node->childs[0];
+		cursor->node = node;
+		cursor->index = 0;
+		return;
+	}
+
+	if (index + 1 < node_nkeys(node)) {
+		cursor->index = index + 1;
+		return;
+	}
+
+	/* climb up until we come from a child that has data at its right */
+	while (node->parent) {
+		index = node_child_index(node);
+		node = node->parent;
+		if (index < node_nkeys(node)) {
+			cursor->node = node;
+			cursor->index = index;
+			return;
+		}
+	}
+	cursor->node = NULL;
+}
+
+void tree23_cursor_init(tree23_t *tree, tree23_cursor_t *cursor,
+			tree23_key_t from, tree23_key_t to)
+{
+	tree23_node_t *node = NULL;
+	int index = 0, nkeys = 0, result = 0;
+
+	assert(tree && cursor);
+	cursor->tree = tree;
+	cursor->to = to;
+	cursor->node = NULL;
+	cursor->index = 0;
+
+	/* find the first data not less than `from'. Every data bigger than
+	 * `from' met on the way down is a candidate, and the last one met is
+	 * the smallest of them. */
+	for (node = tree->root; node; node = node->childs[index]) {
+		nkeys = node_nkeys(node);
+		for (index = 0; index < nkeys; index++) {
+			result = from ? tree->cmp(node->data[index].key, from) : 1;
+			if (result >= 0)
+				break;
+		}
+		if (index < nkeys) {
+			cursor->node = node;
+			cursor->index = index;
+			if (result == 0)
+				return;
+		}
+	}
+}
+
+tree23_data_t *tree23_cursor_next(tree23_cursor_t *cursor)
+{
+	tree23_data_t *data = NULL;
+
+	if (!cursor->node)
+		return NULL;
+
+	data = &cursor->node->data[cursor->index];
+	if (cursor->to && cursor->tree->cmp(data->key, cursor->to) > 0) {
+		cursor->node = NULL;
+		return NULL;
+	}
+
+	cursor_forward(cursor);
+	return data;
+}
+
+int tree23_traverse(tree23_t *tree, tree23_data_handler_t handler)
+{
+	tree23_cursor_t cursor;
+	tree23_data_t *data = NULL;
+	int count = 0;
+
+	assert(tree && handler);
+	tree23_cursor_init(tree, &cursor, NULL, NULL);
+	while ((data = tree23_cursor_next(&cursor))) {
+		handler(data);
+		count++;
+	}
+	return count;
+}
@@ -3,8 +3,11 @@
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 #include "23tree.h"
 
+#define BENCH_SIZE (1000000)
+
 static char line_buffer[1024];
 
 void print_help(void)
@@ -14,7 +17,9 @@ void print_help(void)
 	puts("2. dump tree");
 	puts("3. destroy tree (create new empty one)");
 	puts("4. lookup key");
-	puts("5. exit");
+	puts("5. delete key");
+	puts("6. traverse tree");
+	puts("7. exit");
 	printf("Input: ");
 }
 
@@ -40,7 +45,107 @@ void data_destructor(tree23_data_t *data)
 	free(data->value);
 }
 
-int main(void)
+void data_print(tree23_data_t *data)
+{
+	printf("key: %d, value: %s\n", *(int *)data->key, (char *)data->value);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void data_count(tree23_data_t *data)
+{
+	/* nothing, only to measure the callback overhead */
+}
+
+static void bench_report(const char *name, long long ns, int count)
+{
+	printf("%-10s %7.1f ns/op\n", name, (double)ns / count);
+}
+
+/* insert `size' random keys, iterate them in different ways, then delete
+ * them all in another random order. */
+static int bench(int size)
+{
+	tree23_t *tree = tree23_create(NULL, NULL);
+	tree23_cursor_t cursor;
+	tree23_data_t *data = NULL;
+	long long start = 0;
+	int *keys = malloc(sizeof(int) * size);
+	int i = 0, j = 0, tmp = 0, from = 0, to = 0, count = 0;
+
+	assert(keys);
+	for (i = 0; i < size; i++)
+		keys[i] = i + 1;
+	srandom(size);
+	for (i = size - 1; i > 0; i--) {
+		j = random() % (i + 1);
+		tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+
+	printf("Benchmark with %d keys:\n", size);
+
+	start = now_ns();
+	for (i = 0; i < size; i++)
+		tree23_insert(tree, keys + i, NULL);
+	bench_report("insert", now_ns() - start, size);
+
+	start = now_ns();
+	for (i = 0; i < size; i++)
+		assert(tree23_lookup(tree, keys + i));
+	bench_report("lookup", now_ns() - start, size);
+
+	start = now_ns();
+	for (i = 0; i < size; i++)
+		assert(tree23_lookup_int(tree, keys[i]));
+	bench_report("lookup_int", now_ns() - start, size);
+
+	start = now_ns();
+	count = tree23_traverse(tree, data_count);
+	bench_report("traverse", now_ns() - start, count);
+	assert(count == size);
+
+	start = now_ns();
+	tree23_cursor_init(tree, &cursor, NULL, NULL);
+	for (count = 0; (data = tree23_cursor_next(&cursor)); count++)
+		assert(*(int *)data->key == count + 1);
+	bench_report("cursor", now_ns() - start, count);
+	assert(count == size);
+
+	/* 1000 scans over random ranges of 1/1000 of the keys each */
+	start = now_ns();
+	count = 0;
+	for (i = 0; i < 1000; i++) {
+		from = random() % size + 1;
+		to = from + size / 1000;
+		tree23_cursor_init(tree, &cursor, &from, &to);
+		while (tree23_cursor_next(&cursor))
+			count++;
+	}
+	bench_report("range", now_ns() - start, count ? count : 1);
+
+	/* delete in the reversed insertion order */
+	start = now_ns();
+	for (i = size - 1; i >= 0; i--)
+		if (tree23_delete(tree, keys + i)) {
+			printf("failed to delete key %d\n", keys[i]);
+			return -1;
+		}
+	bench_report("delete", now_ns() - start, size);
+	assert(tree23_empty(tree));
+
+	tree23_destroy(tree);
+	free(keys);
+	return 0;
+}
+
+int main(int argc, char *argv[])
 {
 	int ret = 0;
 	tree23_t *tree = NULL;
@@ -48,6 +153,14 @@ int main(void)
 	int *key_ptr = NULL;
 	tree23_data_t *data = NULL;
 
+	if (argc > 1) {
+		if (strcmp(argv[1], "bench")) {
+			printf("usage: %s [bench [size]]\n", argv[0]);
+			return -1;
+		}
+		return bench(argc > 2 ? atoi(argv[2]) : BENCH_SIZE);
+	}
+
 	tree = tree23_create(NULL, data_destructor);
 	assert(tree);
 
@@ -57,7 +170,7 @@ int main(void)
 
 		print_help();
 		selection = atoi(read_line());
-		if (selection > 5 || selection < 1) {
+		if (selection > 7 || selection < 1) {
 			puts("Invalid input.");
 			continue;
 		}
@@ -101,6 +214,20 @@ int main(void)
 				printf("Key %d not found.\n", key);
 			break;
 		case 5:
+			printf("Please input key: ");
+			key = atoi(read_line());
+			if (tree23_delete(tree, &key))
+				printf("Key %d not found.\n", key);
+			else
+				printf("Key %d deleted.\n", key);
+			break;
+		case 6:
+			puts("===================");
+			ret = tree23_traverse(tree, data_print);
+			puts("===================");
+			printf("%d items in total.\n", ret);
+			break;
+		case 7:
 			puts("Quitting.");
 			tree23_destroy(tree);
 			return 0;
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2015, Peter Xu <xzpeter@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "bptree.h"
+
+/* nodes are aligned to, and sized in, cache lines */
+#define BPTREE_CACHE_LINE  (64)
+/* enough for any tree that fits in memory, even with order 3 */
+#define BPTREE_MAX_DEPTH   (64)
+
+#define LEAF_DATA(node)		((tree23_data_t *)(node)->slots)
+#define NODE_KEYS(node)		((tree23_key_t *)(node)->slots)
+#define NODE_CHILDS(tree, node)	\
+	((bptree_node_t **)((node)->slots + (tree)->order + 1))
+
+bptree_t *bptree_create(tree23_key_cmp_func_t cmp,
+			tree23_data_handler_t destructor, int order)
+{
+	bptree_t *tree = NULL;
+
+	/* if no cmp function provided, using the default. */
+	if (!cmp)
+		cmp = tree23_key_cmp_func_int;
+	if (!order)
+		order = BPTREE_ORDER_DEFAULT;
+	if (order < BPTREE_ORDER_MIN)
+		return NULL;
+
+	tree = calloc(1, sizeof(*tree));
+	assert(tree);
+	tree->cmp = cmp;
+	tree->destructor = destructor;
+	tree->order = order;
+
+	return tree;
+}
+
+/* create one new empty node */
+static bptree_node_t *node_create(bptree_t *tree, int is_leaf)
+{
+	bptree_node_t *node = NULL;
+	size_t size = sizeof(*node);
+
+	if (is_leaf)
+		size += sizeof(tree23_data_t) * (tree->order + 1);
+	else
+		size += sizeof(tree23_key_t) * (tree->order + 1) +
+			sizeof(bptree_node_t *) * (tree->order + 2);
+	size = (size + BPTREE_CACHE_LINE - 1) & ~(BPTREE_CACHE_LINE - 1);
+
+	node = aligned_alloc(BPTREE_CACHE_LINE, size);
+	assert(node);
+	node->nkeys = 0;
+	node->is_leaf = is_leaf;
+	node->next = NULL;
+	return node;
+}
+
+/* free one node (recursively, with data) */
+static void node_destroy(bptree_t *tree, bptree_node_t *node)
+{
+	int i = 0;
+
+	if (node->is_leaf) {
+		if (tree->destructor)
+			for (i = 0; i < node->nkeys; i++)
+				tree->destructor(&LEAF_DATA(node)[i]);
+	} else {
+		for (i = 0; i <= node->nkeys; i++)
+			node_destroy(tree, NODE_CHILDS(tree, node)[i]);
+	}
+	free(node);
+}
+
+void bptree_destroy(bptree_t *tree)
+{
+	if (tree->root)
+		node_destroy(tree, tree->root);
+	free(tree);
+}
+
+int bptree_empty(bptree_t *tree)
+{
+	assert(tree);
+	return tree->root == NULL;
+}
+
+/* index of the child of internal node that may contain `key', which is the
+ * index of the first key bigger than `key'. */
+static int node_child_index(bptree_t *tree, bptree_node_t *node,
+			    tree23_key_t key)
+{
+	tree23_key_t *keys = NODE_KEYS(node);
+	int lo = 0, hi = node->nkeys, mid = 0;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (tree->cmp(keys[mid], key) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+/* index of the first data in leaf whose key is not less than `key'. */
+static int leaf_data_index(bptree_t *tree, bptree_node_t *node,
+			   tree23_key_t key)
+{
+	tree23_data_t *data = LEAF_DATA(node);
+	int lo = 0, hi = node->nkeys, mid = 0;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (tree->cmp(data[mid].key, key) >= 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+/* find the leaf that may contain `key' */
+static bptree_node_t *leaf_lookup(bptree_t *tree, tree23_key_t key)
+{
+	bptree_node_t *node = tree->root;
+
+	while (!node->is_leaf)
+		node = NODE_CHILDS(tree, node)[node_child_index(tree, node, key)];
+	return node;
+}
+
+/* split an overflowed leaf into two, return the new right one. The first
+ * key of the right one is the separator to be inserted into parent. */
+static bptree_node_t *leaf_split(bptree_t *tree, bptree_node_t *node)
+{
+	bptree_node_t *right = node_create(tree, 1);
+	int left_keys = node->nkeys / 2;
+
+	right->nkeys = node->nkeys - left_keys;
+	memcpy(LEAF_DATA(right), LEAF_DATA(node) + left_keys,
+	       sizeof(tree23_data_t) * right->nkeys);
+	node->nkeys = left_keys;
+
+	right->next = node->next;
+	node->next = right;
+	return right;
+}
+
+/* split an overflowed internal node into two, return the new right one.
+ * The middle key is moved up into `sep' rather than kept in any of them. */
+static bptree_node_t *node_split(bptree_t *tree, bptree_node_t *node,
+				 tree23_key_t *sep)
+{
+	bptree_node_t *right = node_create(tree, 0);
+	int mid = node->nkeys / 2;
+
+	*sep = NODE_KEYS(node)[mid];
+	right->nkeys = node->nkeys - mid - 1;
+	memcpy(NODE_KEYS(right), NODE_KEYS(node) + mid + 1,
+	       sizeof(tree23_key_t) * right->nkeys);
+	memcpy(NODE_CHILDS(tree, right), NODE_CHILDS(tree, node) + mid + 1,
+	       sizeof(bptree_node_t *) * (right->nkeys + 1));
+	node->nkeys = mid;
+	return right;
+}
+
+int bptree_insert(bptree_t *tree, tree23_key_t key, tree23_value_t value)
+{
+	/* internal nodes along the lookup path, and the child index taken */
+	bptree_node_t *path[BPTREE_MAX_DEPTH];
+	int index[BPTREE_MAX_DEPTH];
+	bptree_node_t *node = NULL, *right = NULL, *parent = NULL;
+	tree23_data_t *data = NULL;
+	tree23_key_t sep = NULL;
+	int depth = 0, i = 0;
+
+	assert(tree);
+	/* we could allow "value" be NULL, but not key. */
+	assert(key);
+
+	if (!tree->root) {
+		tree->root = node_create(tree, 1);
+		LEAF_DATA(tree->root)[0].key = key;
+		LEAF_DATA(tree->root)[0].value = value;
+		tree->root->nkeys = 1;
+		tree->count = 1;
+		return 0;
+	}
+
+	node = tree->root;
+	while (!node->is_leaf) {
+		assert(depth < BPTREE_MAX_DEPTH);
+		i = node_child_index(tree, node, key);
+		path[depth] = node;
+		index[depth] = i;
+		depth++;
+		node = NODE_CHILDS(tree, node)[i];
+	}
+
+	data = LEAF_DATA(node);
+	i = leaf_data_index(tree, node, key);
+	if (i < node->nkeys && tree->cmp(data[i].key, key) == 0)
+		/* duplicated key */
+		return -1;
+
+	/* there is always room for one more data before split */
+	memmove(data + i + 1, data + i, sizeof(*data) * (node->nkeys - i));
+	data[i].key = key;
+	data[i].value = value;
+	node->nkeys++;
+	tree->count++;
+
+	if (node->nkeys <= tree->order)
+		return 0;
+
+	right = leaf_split(tree, node);
+	sep = LEAF_DATA(right)[0].key;
+
+	/* spread the split upward until some node has enough room */
+	while (depth > 0) {
+		depth--;
+		parent = path[depth];
+		i = index[depth];
+		memmove(NODE_KEYS(parent) + i + 1, NODE_KEYS(parent) + i,
+			sizeof(tree23_key_t) * (parent->nkeys - i));
+		memmove(NODE_CHILDS(tree, parent) + i + 2,
+			NODE_CHILDS(tree, parent) + i + 1,
+			sizeof(bptree_node_t *) * (parent->nkeys - i));
+		NODE_KEYS(parent)[i] = sep;
+		NODE_CHILDS(tree, parent)[i + 1] = right;
+		parent->nkeys++;
+
+		if (parent->nkeys <= tree->order)
+			return 0;
+
+		right = node_split(tree, parent, &sep);
+		node = parent;
+	}
+
+	/* root node was split, grow the tree by one level */
+	parent = node_create(tree, 0);
+	parent->nkeys = 1;
+	NODE_KEYS(parent)[0] = sep;
+	NODE_CHILDS(tree, parent)[0] = node;
+	NODE_CHILDS(tree, parent)[1] = right;
+	tree->root = parent;
+
+	return 0;
+}
+
+tree23_data_t *bptree_lookup(bptree_t *tree, tree23_key_t key)
+{
+	bptree_node_t *node = NULL;
+	int i = 0;
+
+	assert(tree);
+	if (!key || !tree->root)
+		return NULL;
+
+	node = leaf_lookup(tree, key);
+	i = leaf_data_index(tree, node, key);
+	if (i < node->nkeys && tree->cmp(LEAF_DATA(node)[i].key, key) == 0)
+		return &LEAF_DATA(node)[i];
+	return NULL;
+}
+
+void bptree_cursor_seek(bptree_t *tree, bptree_cursor_t *cursor,
+			tree23_key_t key)
+{
+	bptree_node_t *node = tree->root;
+
+	assert(tree && cursor);
+	cursor->node = NULL;
+	cursor->index = 0;
+	if (!node)
+		return;
+
+	if (!key) {
+		while (!node->is_leaf)
+			node = NODE_CHILDS(tree, node)[0];
+		cursor->node = node;
+		return;
+	}
+
+	/* if all keys of this leaf are smaller, bptree_cursor_next() will
+	 * move on to the next leaf. */
+	node = leaf_lookup(tree, key);
+	cursor->node = node;
+	cursor->index = leaf_data_index(tree, node, key);
+}
+
+tree23_data_t *bptree_cursor_next(bptree_cursor_t *cursor)
+{
+	while (cursor->node && cursor->index >= cursor->node->nkeys) {
+		cursor->node = cursor->node->next;
+		cursor->index = 0;
+	}
+	if (!cursor->node)
+		return NULL;
+	return &LEAF_DATA(cursor->node)[cursor->index++];
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2015, Peter Xu <xzpeter@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ * may be used to endorse or promote products derived from this software without
+ * specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BPTREE_H__
+#define __BPTREE_H__
+
+/*
+ * one implementation of B+ tree:
+ * https://en.wikipedia.org/wiki/B%2B_tree
+ *
+ * Compared to the 2-3 tree, each node holds up to `order' keys (tens to
+ * hundreds), so the tree is much lower and each node is a few contiguous
+ * cache lines rather than a handful of scattered pointers. All the data
+ * lives in leaf nodes, which are linked in key order for range scans.
+ * Keys, values and comparison function are the same as the 2-3 tree.
+ */
+
+#include "23tree.h"
+
+/* default number of keys per node */
+#define BPTREE_ORDER_DEFAULT  (64)
+/* minimum number of keys per node, or nodes could not be split */
+#define BPTREE_ORDER_MIN      (3)
+
+/*
+ * Node of B+ tree. For leaf node, `slots' contains `order'+1 data (one extra
+ * for the temporary overflow before split). For internal node, `slots'
+ * contains `order'+1 keys, then `order'+2 child pointers. Child i contains
+ * keys in range [keys[i-1], keys[i]).
+ */
+struct bptree_node {
+	/* number of keys in this node */
+	int nkeys;
+	/* set this if this node is a leaf node. */
+	int is_leaf;
+	/* next leaf node in key order, only valid for leaf nodes. */
+	struct bptree_node *next;
+	void *slots[];
+};
+
+struct bptree {
+	/* root node, NULL if the tree is empty. */
+	struct bptree_node *root;
+	/* the comparison function between keys. */
+	tree23_key_cmp_func_t cmp;
+	/* data destructor for data */
+	tree23_data_handler_t destructor;
+	/* max number of keys in one node */
+	int order;
+	/* number of data in the tree */
+	unsigned long count;
+};
+
+/* position of one data in the tree, used to scan the leaves in order. */
+struct bptree_cursor {
+	struct bptree_node *node;
+	int index;
+};
+
+typedef struct bptree bptree_t;
+typedef struct bptree_node bptree_node_t;
+typedef struct bptree_cursor bptree_cursor_t;
+
+/* create one empty B+ tree with at most `order' keys per node. When order
+ * is zero, BPTREE_ORDER_DEFAULT is used. When cmp is NULL, keys are
+ * compared as integers. When destructor is NULL, data destruction will be
+ * omitted during tree destruction. */
+bptree_t *bptree_create(tree23_key_cmp_func_t cmp,
+			tree23_data_handler_t destructor, int order);
+
+/* destroy one B+ tree (including data) */
+void bptree_destroy(bptree_t *tree);
+
+/* whether the tree is empty or not */
+int bptree_empty(bptree_t *tree);
+
+/* insert a new item into the tree. Return non-zero if key duplicated. */
+int bptree_insert(bptree_t *tree, tree23_key_t key, tree23_value_t value);
+
+/* search a specific key. If nothing found, return NULL. */
+tree23_data_t *bptree_lookup(bptree_t *tree, tree23_key_t key);
+
+/* point cursor to the first item whose key is not less than `key', or the
+ * first item of the tree if key is NULL. */
+void bptree_cursor_seek(bptree_t *tree, bptree_cursor_t *cursor,
+			tree23_key_t key);
+
+/* return the item at cursor and move cursor to the next one. Return NULL
+ * when there are no more items. */
+tree23_data_t *bptree_cursor_next(bptree_cursor_t *cursor);
+
+#endif
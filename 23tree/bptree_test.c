@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include "23tree.h"
+#include "bptree.h"
+
+#define BENCH_SIZE (1000000)
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* generate `size' distinct keys in random order */
+static int *gen_keys(int size)
+{
+	int *keys = malloc(sizeof(int) * size);
+	int i = 0, j = 0, tmp = 0;
+
+	assert(keys);
+	for (i = 0; i < size; i++)
+		keys[i] = i + 1;
+	srandom(size);
+	for (i = size - 1; i > 0; i--) {
+		j = random() % (i + 1);
+		tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+	return keys;
+}
+
+static void report(const char *name, long long insert_ns,
+		   long long lookup_ns, int size)
+{
+	printf("%-12s insert %7.1f ns/op, lookup %7.1f ns/op\n", name,
+	       (double)insert_ns / size, (double)lookup_ns / size);
+}
+
+static void bench_tree23(int *keys, int size)
+{
+	tree23_t *tree = tree23_create(NULL, NULL);
+	long long start = 0, insert_ns = 0, lookup_ns = 0;
+	int i = 0;
+
+	start = now_ns();
+	for (i = 0; i < size; i++)
+		tree23_insert(tree, keys + i, NULL);
+	insert_ns = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < size; i++)
+		if (!tree23_lookup(tree, keys + i)) {
+			printf("tree23: key %d not found\n", keys[i]);
+			exit(1);
+		}
+	lookup_ns = now_ns() - start;
+
+	tree23_destroy(tree);
+	report("tree23", insert_ns, lookup_ns, size);
+}
+
+static void bench_bptree(int *keys, int size, int order)
+{
+	bptree_t *tree = bptree_create(NULL, NULL, order);
+	long long start = 0, insert_ns = 0, lookup_ns = 0, scan_ns = 0;
+	bptree_cursor_t cursor;
+	tree23_data_t *data = NULL;
+	char name[32];
+	int i = 0, from = size / 4 + 1;
+
+	assert(tree);
+	start = now_ns();
+	for (i = 0; i < size; i++)
+		bptree_insert(tree, keys + i, keys + i);
+	insert_ns = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < size; i++) {
+		data = bptree_lookup(tree, keys + i);
+		if (!data || data->value != keys + i) {
+			printf("bptree: key %d not found\n", keys[i]);
+			exit(1);
+		}
+	}
+	lookup_ns = now_ns() - start;
+
+	/* scan the upper 3/4 of the keys in order through the leaves */
+	start = now_ns();
+	bptree_cursor_seek(tree, &cursor, &from);
+	for (i = from; (data = bptree_cursor_next(&cursor)); i++)
+		if (*(int *)data->key != i) {
+			printf("bptree: key %d out of order\n", i);
+			exit(1);
+		}
+	scan_ns = now_ns() - start;
+	assert(i == size + 1 && tree->count == size);
+
+	bptree_destroy(tree);
+	snprintf(name, sizeof(name), "bptree/%d", order);
+	report(name, insert_ns, lookup_ns, size);
+	printf("%-12s scan   %7.1f ns/op\n", "",
+	       (double)scan_ns / (size + 1 - from));
+}
+
+int main(int argc, char *argv[])
+{
+	int size = argc > 1 ? atoi(argv[1]) : BENCH_SIZE;
+	int *keys = NULL;
+
+	if (size <= 0) {
+		printf("usage: %s [size]\n", argv[0]);
+		return -1;
+	}
+
+	keys = gen_keys(size);
+	printf("Benchmark with %d keys:\n", size);
+	bench_tree23(keys, size);
+	bench_bptree(keys, size, 16);
+	bench_bptree(keys, size, 64);
+	bench_bptree(keys, size, 256);
+	free(keys);
+
+	return 0;
+}
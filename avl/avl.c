@@ -33,12 +33,12 @@
 #include <stdlib.h>
 #include <assert.h>
 
-#define DEBUG_ENABLE
+/* #define DEBUG_ENABLE */
 
 #ifdef DEBUG_ENABLE
 #define debug printf
 #else
-#define debug
+#define debug(...)
 #endif
 
 static void *avl_alloc(size_t size)
@@ -55,16 +55,121 @@ static void avl_free(void *ptr)
     }
 }
 
+static int avl_pool_enabled(avl_tree_t *tree)
+{
+    return tree->at_pool.anp_chunk_nodes != 0;
+}
+
+/* Get one node from the pool, either from the free list or from the newest
+   chunk. A new chunk is allocated when the newest one is used up. */
+static avl_node_t *avl_pool_alloc(struct avl_node_pool *pool)
+{
+    struct avl_node_chunk *chunk = pool->anp_chunks;
+    avl_node_t *node = NULL;
+
+    if (pool->anp_free) {
+        node = pool->anp_free;
+        pool->anp_free = node->an_left;
+        return node;
+    }
+
+    if (!chunk || chunk->anc_used == pool->anp_chunk_nodes) {
+        /* nodes are initialized when handed out, no need to zero them */
+        chunk = malloc(sizeof(*chunk) +
+                       pool->anp_chunk_nodes * sizeof(avl_node_t));
+        assert(chunk);
+        chunk->anc_used = 0;
+        chunk->anc_next = pool->anp_chunks;
+        pool->anp_chunks = chunk;
+        debug("allocated new chunk %p\n", chunk);
+    }
+
+    return &chunk->anc_nodes[chunk->anc_used++];
+}
+
+/* Put one node back into the free list of the pool. Data pointer of free
+   nodes is always NULL, so that we can tell them from the used ones when
+   walking the chunks. */
+static void avl_pool_free(struct avl_node_pool *pool, avl_node_t *node)
+{
+    node->an_data = NULL;
+    node->an_left = pool->anp_free;
+    pool->anp_free = node;
+}
+
+/* Release all the chunks of the pool, calling `dtor' for each of the used
+   nodes if provided. No tree walk is needed. */
+static void avl_pool_destroy(struct avl_node_pool *pool,
+                             avl_node_data_collector dtor)
+{
+    struct avl_node_chunk *chunk = pool->anp_chunks, *next = NULL;
+    size_t i = 0;
+
+    while (chunk) {
+        next = chunk->anc_next;
+        if (dtor) {
+            for (i = 0; i < chunk->anc_used; i++) {
+                if (chunk->anc_nodes[i].an_data) {
+                    dtor(chunk->anc_nodes[i].an_data);
+                }
+            }
+        }
+        free(chunk);
+        chunk = next;
+    }
+    pool->anp_chunks = NULL;
+    pool->anp_free = NULL;
+}
+
+static int avl_intrusive(avl_tree_t *tree)
+{
+    return tree->at_intrusive;
+}
+
+/* Return the data bound with `node'. For intrusive trees this is only
+   pointer arithmetic, so it costs no memory access. */
+static inline void *avl_node_data(avl_tree_t *tree, avl_node_t *node)
+{
+    if (avl_intrusive(tree)) {
+        return (char *)node - tree->at_offset;
+    }
+    return node->an_data;
+}
+
 /* Create new AVL node and initialize */
-static avl_node_t *avl_node_new(avl_node_t *parent, void *data)
+static avl_node_t *avl_node_new(avl_tree_t *tree, avl_node_t *parent,
+                                void *data)
 {
-    avl_node_t *new = avl_alloc(sizeof(*new));
+    avl_node_t *new = NULL;
+
+    if (avl_intrusive(tree)) {
+        /* the node is embedded in the data */
+        new = (avl_node_t *)((char *)data + tree->at_offset);
+    } else if (avl_pool_enabled(tree)) {
+        new = avl_pool_alloc(&tree->at_pool);
+    } else {
+        new = avl_alloc(sizeof(*new));
+    }
     new->an_depth = 1;
     new->an_parent = parent;
+    new->an_left = new->an_right = NULL;
     new->an_data = data;
     return new;
 }
 
+/* Release one AVL node, without touching its data */
+static void avl_node_free(avl_tree_t *tree, avl_node_t *node)
+{
+    if (avl_intrusive(tree)) {
+        /* the node belongs to its data, nothing to free */
+        return;
+    } else if (avl_pool_enabled(tree)) {
+        avl_pool_free(&tree->at_pool, node);
+    } else {
+        avl_free(node);
+    }
+}
+
 avl_tree_t *avl_create(avl_node_compare_fn cmp,
                        avl_node_data_collector destructor)
 {
@@ -74,10 +179,40 @@ avl_tree_t *avl_create(avl_node_compare_fn cmp,
         return NULL;
     }
 
+    /* this also leaves the node pool disabled */
     tree = avl_alloc(sizeof(*tree));
     tree->at_cmp = cmp;
     tree->at_dtor = destructor;
     tree->at_root = NULL;
+    return tree;
+}
+
+avl_tree_t *avl_create_pooled(avl_node_compare_fn cmp,
+                              avl_node_data_collector destructor,
+                              size_t chunk_nodes)
+{
+    avl_tree_t *tree = avl_create(cmp, destructor);
+
+    if (tree) {
+        if (!chunk_nodes) {
+            chunk_nodes = AVL_POOL_CHUNK_NODES;
+        }
+        tree->at_pool.anp_chunk_nodes = chunk_nodes;
+    }
+    return tree;
+}
+
+avl_tree_t *avl_create_intrusive(avl_node_compare_fn cmp,
+                                 avl_node_data_collector destructor,
+                                 size_t offset)
+{
+    avl_tree_t *tree = avl_create(cmp, destructor);
+
+    if (tree) {
+        tree->at_intrusive = 1;
+        tree->at_offset = offset;
+    }
+    return tree;
 }
 
 int avl_empty(avl_tree_t *tree)
@@ -91,7 +226,8 @@ int avl_empty(avl_tree_t *tree)
 
 #define max2(x,y) ((x)>(y)?(x):(y))
 
-/* Replace the pointer in parent node of `node' to `new' */
+/* Replace the pointer in parent node of `node' to `new', which could be
+   NULL when `node' is removed without replacement */
 static void avl_node_parent_redirect(avl_tree_t *tree, avl_node_t *node,
                                      avl_node_t *new)
 {
@@ -108,7 +244,9 @@ static void avl_node_parent_redirect(avl_tree_t *tree, avl_node_t *node,
         debug("FATAL: parent of %p does not contain itself\n", node);
         assert(0);
     }
-    new->an_parent = parent;
+    if (new) {
+        new->an_parent = parent;
+    }
 }
 
 static void avl_node_set_left(avl_node_t *node, avl_node_t *left)
@@ -127,15 +265,16 @@ static void avl_node_set_right(avl_node_t *node, avl_node_t *right)
     }
 }
 
+/* Depth of subtree `node', which could be empty */
+static int avl_node_depth(avl_node_t *node)
+{
+    return node ? node->an_depth : 0;
+}
+
 static void avl_node_update_depth(avl_node_t *node)
 {
-    int left = 0, right = 0;
-    if (node->an_left) {
-        left = node->an_left->an_depth;
-    }
-    if (node->an_right) {
-        right = node->an_right->an_depth;
-    }
+    int left = avl_node_depth(node->an_left);
+    int right = avl_node_depth(node->an_right);
     node->an_depth = max2(left, right) + 1;
     debug("update node %p depth to %d\n", node, node->an_depth);
 }
@@ -147,26 +286,25 @@ static void avl_node_update_depth_recursive(avl_tree_t *tree,
     int scenario = 0;
     int left = 0, right = 0, diff = 0;
 
-    left = right = diff = 0;
-    if (node->an_left) {
-        left = node->an_left->an_depth;
-    }
-    if (node->an_right) {
-        right = node->an_right->an_depth;
-    }
+    left = avl_node_depth(node->an_left);
+    right = avl_node_depth(node->an_right);
 
     /*
      * Check whether we need to rebalance the tree. If rebalance is needed,
      * then there are four possible scenarios:
      *
-     * 1. new data inserted to node->an_left->an_left
-     * 2. new data inserted to node->an_left->an_right
-     * 3. new data inserted to node->an_right->an_left
-     * 4. new data inserted to node->an_right->an_right
+     * 1. node->an_left->an_left is the heaviest grandchild
+     * 2. node->an_left->an_right is the heaviest grandchild
+     * 3. node->an_right->an_left is the heaviest grandchild
+     * 4. node->an_right->an_right is the heaviest grandchild
      *
      * case (1) and (4) will require only single rotate, while
      * case (2) and (3) will required double rotates
      *
+     * After insertion the two grandchilds on the heavy side never have
+     * the same depth. After deletion they could, and then a single
+     * rotate is both enough and required.
+     *
      * In any case, we will set `scenario' to non-zero to show that we need
      * rebalance and rotate of tree, with corresponding scenario number.
      */
@@ -176,32 +314,19 @@ static void avl_node_update_depth_recursive(avl_tree_t *tree,
         /* left sub-tree is heavier */
         k2 = node->an_left;
         assert(k2);
-        if (!k2->an_left) {
-            scenario = 2;
-        } else if (!k2->an_right) {
+        if (avl_node_depth(k2->an_left) >= avl_node_depth(k2->an_right)) {
             scenario = 1;
         } else {
-            /* both childs of k2 is there */
-            if (k2->an_left->an_depth > k2->an_right->an_depth) {
-                scenario = 1;
-            } else {
-                scenario = 2;
-            }
+            scenario = 2;
         }
     } else if (diff == -2) {
         /* right sub-tree is heavier */
         k2 = node->an_right;
         assert(k2);
-        if (!k2->an_left) {
-            scenario = 4;
-        } else if (!k2->an_right) {
+        if (avl_node_depth(k2->an_left) > avl_node_depth(k2->an_right)) {
             scenario = 3;
         } else {
-            if (k2->an_left->an_depth > k2->an_right->an_depth) {
-                scenario = 3;
-            } else {
-                scenario = 4;
-            }
+            scenario = 4;
         }
     }
 
@@ -270,25 +395,25 @@ static void avl_node_update_depth_recursive(avl_tree_t *tree,
 static int avl_node_insert(avl_tree_t *tree, avl_node_t *node, void *data)
 {
     avl_node_compare_fn cmp = tree->at_cmp;
-    int result = cmp(node->an_data, data);
+    int result = cmp(avl_node_data(tree, node), data);
 
     if (result == 0) {
         debug("data %p existed, insertion failed\n", data);
         return AVL_ERR_EXIST;
     } else if (result > 0) {
         if (!node->an_left) {
-            avl_node_t *new = avl_node_new(node, data);
+            avl_node_t *new = avl_node_new(tree, node, data);
             node->an_left = new;
             debug("data %p inserted to left child of node %p\n",
                   data, node);
             avl_node_update_depth_recursive(tree, node);
             return 0;
         }
-        avl_node_insert(tree, node->an_left, data);
+        return avl_node_insert(tree, node->an_left, data);
     } else {
         /* data is bigger */
         if (!node->an_right) {
-            avl_node_t *new = avl_node_new(node, data);
+            avl_node_t *new = avl_node_new(tree, node, data);
             node->an_right = new;
             debug("data %p inserted to right child of node %p\n",
                   data, node);
@@ -296,9 +421,8 @@ static int avl_node_insert(avl_tree_t *tree, avl_node_t *node, void *data)
             avl_node_update_depth_recursive(tree, node);
             return 0;
         }
-        avl_node_insert(tree, node->an_right, data);
+        return avl_node_insert(tree, node->an_right, data);
     }
-    return 0;
 }
 
 int avl_insert(avl_tree_t *tree, void *data)
@@ -306,7 +430,7 @@ int avl_insert(avl_tree_t *tree, void *data)
     assert(tree);
     assert(data);
     if (avl_empty(tree)) {
-        avl_node_t *new = avl_node_new(NULL, data);
+        avl_node_t *new = avl_node_new(tree, NULL, data);
         new->an_depth = 1;
         tree->at_root = new;
     } else {
@@ -315,39 +439,65 @@ int avl_insert(avl_tree_t *tree, void *data)
     return 0;
 }
 
-void *avl_node_find(avl_tree_t *tree, avl_node_t *node, void *data)
+/* Look for the node containing `data', or NULL if not found */
+static avl_node_t *avl_node_lookup(avl_tree_t *tree, void *data)
 {
+    avl_node_t *node = tree->at_root;
     int result = 0;
-    avl_node_compare_fn cmp = NULL;
-    void *data_out = NULL;
 
-    if (!node) {
+    while (node) {
+        result = tree->at_cmp(avl_node_data(tree, node), data);
+        if (result == 0) {
+            break;
+        }
+        node = result > 0 ? node->an_left : node->an_right;
+    }
+    return node;
+}
+
+void *avl_find(avl_tree_t *tree, void *data)
+{
+    avl_node_t *node = NULL;
+
+    assert(tree);
+    if (!data) {
         return NULL;
     }
+    node = avl_node_lookup(tree, data);
+    return node ? avl_node_data(tree, node) : NULL;
+}
 
-    cmp = tree->at_cmp;
-    result = cmp(node->an_data, data);
-    if (result == 0) {
-        data_out = node->an_data;
-    } else if (result > 0) {
-        data_out = avl_node_find(tree, node->an_left, data);
-    } else {
-        data_out = avl_node_find(tree, node->an_right, data);
+/* Build a perfectly balanced subtree from `count' sorted items starting
+   at `data', with the middle item as root. Return root of the subtree. */
+static avl_node_t *avl_node_build(avl_tree_t *tree, avl_node_t *parent,
+                                  void **data, size_t count)
+{
+    avl_node_t *node = NULL;
+    size_t mid = count / 2;
+
+    if (!count) {
+        return NULL;
     }
 
-    return data_out;
+    node = avl_node_new(tree, parent, data[mid]);
+    node->an_left = avl_node_build(tree, node, data, mid);
+    node->an_right = avl_node_build(tree, node, data + mid + 1,
+                                    count - mid - 1);
+    avl_node_update_depth(node);
+    return node;
 }
 
-void *avl_find(avl_tree_t *tree, void *data)
+int avl_bulk_load(avl_tree_t *tree, void **data, size_t count)
 {
     assert(tree);
-    if (!data) {
-        return NULL;
+    if (!avl_empty(tree)) {
+        return AVL_ERR_NOT_EMPTY;
     }
-    return avl_node_find(tree, tree->at_root, data);
+    tree->at_root = avl_node_build(tree, NULL, data, count);
+    return 0;
 }
 
-void avl_node_dump(avl_node_t *node, int level)
+static void avl_node_dump(avl_tree_t *tree, avl_node_t *node, int level)
 {
     int i = 0;
 
@@ -359,13 +509,132 @@ void avl_node_dump(avl_node_t *node, int level)
         printf("  ");
     }
     /* assuming INT */
-    printf("%d\n", *(int *)node->an_data);
-    avl_node_dump(node->an_left, level + 1);
-    avl_node_dump(node->an_right, level + 1);
+    printf("%d\n", *(int *)avl_node_data(tree, node));
+    avl_node_dump(tree, node->an_left, level + 1);
+    avl_node_dump(tree, node->an_right, level + 1);
 }
 
 void avl_dump(avl_tree_t *tree)
 {
     assert(tree);
-    avl_node_dump(tree->at_root, 0);
+    avl_node_dump(tree, tree->at_root, 0);
+}
+
+/* Return the leftmost node of subtree `node' */
+static avl_node_t *avl_node_leftmost(avl_node_t *node)
+{
+    while (node->an_left) {
+        node = node->an_left;
+    }
+    return node;
+}
+
+/* Unlink `node' from the tree and rebalance. The node is not freed. */
+static void avl_node_unlink(avl_tree_t *tree, avl_node_t *node)
+{
+    avl_node_t *succ = NULL, *fix = NULL;
+
+    if (node->an_left && node->an_right) {
+        /*
+         * Replace the node with its successor, which is the leftmost node
+         * of the right subtree and has no left child. The nodes are moved
+         * rather than their data, so that nodes keep binding to their data.
+         * Rebalance should start from where the successor used to be.
+         */
+        succ = avl_node_leftmost(node->an_right);
+        if (succ->an_parent == node) {
+            fix = succ;
+        } else {
+            fix = succ->an_parent;
+            avl_node_set_left(fix, succ->an_right);
+            avl_node_set_right(succ, node->an_right);
+        }
+        avl_node_set_left(succ, node->an_left);
+        avl_node_parent_redirect(tree, node, succ);
+    } else {
+        /* at most one child, just lift it up */
+        fix = node->an_parent;
+        avl_node_parent_redirect(tree, node,
+                                 node->an_left ? node->an_left :
+                                 node->an_right);
+    }
+
+    if (fix) {
+        avl_node_update_depth_recursive(tree, fix);
+    }
+}
+
+int avl_delete(avl_tree_t *tree, void *data)
+{
+    avl_node_t *node = NULL;
+
+    assert(tree);
+    if (!data) {
+        return AVL_ERR_NOT_EXIST;
+    }
+
+    node = avl_node_lookup(tree, data);
+    if (!node) {
+        debug("data %p not found, deletion failed\n", data);
+        return AVL_ERR_NOT_EXIST;
+    }
+
+    avl_node_unlink(tree, node);
+    data = avl_node_data(tree, node);
+    /* free the node first, the destructor may free it for intrusive trees */
+    avl_node_free(tree, node);
+    if (tree->at_dtor) {
+        tree->at_dtor(data);
+    }
+    return 0;
+}
+
+/*
+ * Free all the nodes in post order, calling destructor for each data. This
+ * walks with the parent pointers rather than recursion, and each leaf is
+ * detached from its parent before being freed, so that the parent becomes a
+ * leaf when all its childs are gone.
+ */
+static void avl_node_destroy_all(avl_tree_t *tree)
+{
+    avl_node_t *node = tree->at_root, *parent = NULL;
+    void *data = NULL;
+
+    while (node) {
+        if (node->an_left) {
+            node = node->an_left;
+            continue;
+        }
+        if (node->an_right) {
+            node = node->an_right;
+            continue;
+        }
+        parent = node->an_parent;
+        if (parent) {
+            if (parent->an_left == node) {
+                parent->an_left = NULL;
+            } else {
+                parent->an_right = NULL;
+            }
+        }
+        data = avl_node_data(tree, node);
+        avl_node_free(tree, node);
+        if (tree->at_dtor) {
+            tree->at_dtor(data);
+        }
+        node = parent;
+    }
+    tree->at_root = NULL;
+}
+
+void avl_destroy(avl_tree_t *tree)
+{
+    assert(tree);
+    if (avl_pool_enabled(tree)) {
+        /* release the whole pool at once, no need to walk the tree */
+        avl_pool_destroy(&tree->at_pool, tree->at_dtor);
+    } else {
+        avl_node_destroy_all(tree);
+    }
+    avl_free(tree);
 }
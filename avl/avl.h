@@ -31,12 +31,17 @@
 #ifndef __AVL_H__
 #define __AVL_H__
 
+#include <stddef.h>
+
 enum avl_errno {
     AVL_OK = 0,                 /* no error */
     AVL_ERR_EXIST = 1,          /* node exist */
+    AVL_ERR_NOT_EXIST = 2,      /* node does not exist */
+    AVL_ERR_NOT_EMPTY = 3,      /* tree is not empty */
 };
 
-/* Node of AVL tree. It could be internal node, or leaf node. */
+/* Node of AVL tree. It could be internal node, or leaf node. For intrusive
+   trees the node is embedded in the data, and `an_data' is not used. */
 struct avl_node {
     void *an_data;
     int an_depth;
@@ -46,6 +51,33 @@ struct avl_node {
 };
 typedef struct avl_node avl_node_t;
 
+/*
+ * A chunk of AVL nodes allocated in one go by the node pool.  Nodes are
+ * carved from `anc_nodes' in order, `anc_used' tells how many of them have
+ * been handed out so far.
+ */
+struct avl_node_chunk {
+    struct avl_node_chunk *anc_next;
+    size_t anc_used;
+    avl_node_t anc_nodes[];
+};
+
+/*
+ * Slab-like node allocator.  Nodes are allocated from chunks of
+ * `anp_chunk_nodes' nodes, freed nodes are kept in a free list (linked by
+ * `an_left') for later allocations, and all the chunks are released at once
+ * when the tree is destroyed.
+ */
+struct avl_node_pool {
+    /* number of nodes per chunk, zero if the pool is not used */
+    size_t anp_chunk_nodes;
+    struct avl_node_chunk *anp_chunks;
+    avl_node_t *anp_free;
+};
+
+/* Default number of nodes in one chunk of the node pool. */
+#define AVL_POOL_CHUNK_NODES  (4096)
+
 /* Comparing function definition between two AVL node data. Return 1 if x>y, 0
    if x==y, or -1 if x<y. */
 typedef int (*avl_node_compare_fn) (void *x, void *y);
@@ -58,6 +90,11 @@ struct avl_tree {
     /* destructor of node data */
     avl_node_data_collector at_dtor;
     avl_node_t *at_root;
+    /* node allocator, nodes are malloc()ed one by one if not used */
+    struct avl_node_pool at_pool;
+    /* set if nodes are embedded in data at offset `at_offset' */
+    int at_intrusive;
+    size_t at_offset;
 };
 typedef struct avl_tree avl_tree_t;
 
@@ -65,22 +102,43 @@ typedef struct avl_tree avl_tree_t;
 avl_tree_t *avl_create(avl_node_compare_fn cmp,
                        avl_node_data_collector destructor);
 
+/* Same as avl_create(), but nodes of the tree are allocated from a node
+   pool with `chunk_nodes' nodes per chunk (AVL_POOL_CHUNK_NODES if zero).
+   This is much faster than malloc() when there are lots of nodes. */
+avl_tree_t *avl_create_pooled(avl_node_compare_fn cmp,
+                              avl_node_data_collector destructor,
+                              size_t chunk_nodes);
+
+/* Same as avl_create(), but each data embeds its own avl_node_t at `offset'
+   (e.g. offsetof(struct my_type, my_node)), so that the tree needs no node
+   allocation, and comparisons need no extra pointer chasing. The node must
+   not be touched by the user while the data is in the tree. */
+avl_tree_t *avl_create_intrusive(avl_node_compare_fn cmp,
+                                 avl_node_data_collector destructor,
+                                 size_t offset);
+
 /* Check whether the tree is empty. Return non-zero if empty, else 0. */
 int avl_empty(avl_tree_t *tree);
 
 /* Insert item into tree */
 int avl_insert(avl_tree_t *tree, void *data);
 
+/* Build an empty tree from `count' items sorted in ascending order without
+   duplicates, in O(n) time. This is much faster than inserting the items
+   one by one. Return AVL_ERR_NOT_EMPTY if the tree is not empty. */
+int avl_bulk_load(avl_tree_t *tree, void **data, size_t count);
+
 /* Find item in tree. Return the found item if exists, else return NULL. */
 void *avl_find(avl_tree_t *tree, void *data);
 
 /* DEBUG: Dump the tree with sorted order. */
 void avl_dump(avl_tree_t *tree);
 
-/* TODO: Delete existing item in the tree */
+/* Delete existing item in the tree, the destructor is called for the item
+   if provided. Return AVL_ERR_NOT_EXIST if not found. */
 int avl_delete(avl_tree_t *tree, void *data);
 
-/* TODO: destroy the tree */
+/* Destroy the tree, the destructor is called for each item if provided */
 void avl_destroy(avl_tree_t *tree);
 
 #endif
@@ -29,9 +29,16 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
 #include "avl.h"
 
 #define SIZE 1000
+#define BENCH_SIZE (1000000)
 
 int int_cmp(void *x, void *y)
 {
@@ -46,12 +53,259 @@ int int_cmp(void *x, void *y)
     }
 }
 
-int main(void)
+/* Return current time in nanoseconds */
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Return resident set size of current process, in KB */
+static long rss_kb(void)
+{
+    long pages = 0, rss = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (!fp) {
+        return 0;
+    }
+    if (fscanf(fp, "%ld %ld", &pages, &rss) != 2) {
+        rss = 0;
+    }
+    fclose(fp);
+    return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Generate `size' distinct keys in random order */
+static int *bench_keys(int size)
+{
+    int *keys = malloc(sizeof(int) * size);
+    int i = 0, j = 0, tmp = 0;
+
+    assert(keys);
+    for (i = 0; i < size; i++) {
+        keys[i] = i;
+    }
+    srandom(size);
+    for (i = size - 1; i > 0; i--) {
+        j = random() % (i + 1);
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+    return keys;
+}
+
+/* Insert all keys into `tree', then look them up, then destroy the tree */
+static void bench_tree(const char *name, avl_tree_t *tree, int *keys,
+                       int size)
+{
+    long long start = 0, insert_ns = 0, find_ns = 0, destroy_ns = 0;
+    long rss = rss_kb();
+    int i = 0;
+
+    start = now_ns();
+    for (i = 0; i < size; i++) {
+        avl_insert(tree, keys + i);
+    }
+    insert_ns = now_ns() - start;
+    rss = rss_kb() - rss;
+
+    start = now_ns();
+    for (i = 0; i < size; i++) {
+        if (avl_find(tree, keys + i) != keys + i) {
+            printf("%s: failed to find key %d\n", name, keys[i]);
+            exit(1);
+        }
+    }
+    find_ns = now_ns() - start;
+
+    start = now_ns();
+    avl_destroy(tree);
+    destroy_ns = now_ns() - start;
+
+    printf("%-9s insert %7.1f ns/op, find %7.1f ns/op, "
+           "destroy %7.1f ns/op, rss +%ld KB\n", name,
+           (double)insert_ns / size, (double)find_ns / size,
+           (double)destroy_ns / size, rss);
+}
+
+/* Data with embedded node for intrusive trees. The key comes first, so
+   int_cmp() works on it. */
+struct bench_item {
+    int key;
+    avl_node_t link;
+};
+
+/* Same as bench_tree(), but with nodes embedded in the data */
+static void bench_intrusive(int *keys, int size)
+{
+    avl_tree_t *tree = avl_create_intrusive(int_cmp, NULL,
+                                            offsetof(struct bench_item,
+                                                     link));
+    struct bench_item *items = NULL;
+    long long start = 0, insert_ns = 0, find_ns = 0, destroy_ns = 0;
+    long rss = rss_kb();
+    int i = 0;
+
+    /* items are allocated in the insertion order, same as the nodes of
+       the other trees */
+    items = malloc(sizeof(*items) * size);
+    assert(items);
+
+    start = now_ns();
+    for (i = 0; i < size; i++) {
+        items[i].key = keys[i];
+        avl_insert(tree, items + i);
+    }
+    insert_ns = now_ns() - start;
+    rss = rss_kb() - rss;
+
+    start = now_ns();
+    for (i = 0; i < size; i++) {
+        if (avl_find(tree, keys + i) != items + i) {
+            printf("intrusive: failed to find key %d\n", keys[i]);
+            exit(1);
+        }
+    }
+    find_ns = now_ns() - start;
+
+    start = now_ns();
+    avl_destroy(tree);
+    destroy_ns = now_ns() - start;
+    free(items);
+
+    printf("%-9s insert %7.1f ns/op, find %7.1f ns/op, "
+           "destroy %7.1f ns/op, rss +%ld KB\n", "intrusive",
+           (double)insert_ns / size, (double)find_ns / size,
+           (double)destroy_ns / size, rss);
+}
+
+/*
+ * Churn the tree at a steady size: fill it with `size' keys, then repeatedly
+ * delete a random key and insert a new one. RSS should stay flat during the
+ * churn if deleted nodes are reused.
+ */
+static void bench_churn(const char *name, avl_tree_t *tree, int *keys,
+                        int size, int rounds)
+{
+    long long start = 0, churn_ns = 0;
+    long rss_fill = 0, rss_churn = 0;
+    int i = 0, j = 0, next = size;
+
+    for (i = 0; i < size; i++) {
+        avl_insert(tree, keys + i);
+    }
+    rss_fill = rss_kb();
+
+    start = now_ns();
+    for (i = 0; i < rounds; i++) {
+        j = random() % size;
+        if (avl_delete(tree, keys + j)) {
+            printf("%s: failed to delete key %d\n", name, keys[j]);
+            exit(1);
+        }
+        keys[j] = next++;
+        if (avl_insert(tree, keys + j)) {
+            printf("%s: failed to insert key %d\n", name, keys[j]);
+            exit(1);
+        }
+    }
+    churn_ns = now_ns() - start;
+    rss_churn = rss_kb() - rss_fill;
+
+    avl_destroy(tree);
+
+    printf("%-9s churn %7.1f ns/op (delete+insert), rss %ld KB after "
+           "fill, %+ld KB during churn\n", name,
+           (double)churn_ns / rounds, rss_fill, rss_churn);
+}
+
+/* Build a tree from sorted keys, either by inserting them one by one or with
+   avl_bulk_load(), and check the result */
+static void bench_bulk(const char *name, int size, int bulk)
+{
+    avl_tree_t *tree = avl_create_pooled(int_cmp, NULL, 0);
+    int *keys = malloc(sizeof(int) * size);
+    void **data = malloc(sizeof(void *) * size);
+    long long start = 0, build_ns = 0;
+    int i = 0, depth = 0;
+
+    assert(keys && data);
+    for (i = 0; i < size; i++) {
+        keys[i] = i;
+        data[i] = keys + i;
+    }
+
+    start = now_ns();
+    if (bulk) {
+        avl_bulk_load(tree, data, size);
+    } else {
+        for (i = 0; i < size; i++) {
+            avl_insert(tree, data[i]);
+        }
+    }
+    build_ns = now_ns() - start;
+
+    for (i = 0; i < size; i++) {
+        if (avl_find(tree, keys + i) != keys + i) {
+            printf("%s: failed to find key %d\n", name, keys[i]);
+            exit(1);
+        }
+    }
+
+    depth = tree->at_root ? tree->at_root->an_depth : 0;
+    avl_destroy(tree);
+    free(data);
+    free(keys);
+
+    printf("%-9s build %7.1f ns/op, depth %d\n", name,
+           (double)build_ns / size, depth);
+}
+
+/* Compare the malloc() path with the node pool. The pool is measured first
+   since glibc may keep the freed malloc() memory in the heap and reuse it
+   for the chunks, which would hide the RSS growth of the pool. */
+static int bench(int size)
+{
+    int *keys = bench_keys(size);
+
+    printf("Benchmark with %d keys:\n", size);
+    bench_tree("pool", avl_create_pooled(int_cmp, NULL, 0), keys, size);
+    bench_tree("malloc", avl_create(int_cmp, NULL), keys, size);
+    bench_intrusive(keys, size);
+    free(keys);
+
+    printf("Build benchmark with %d sorted keys:\n", size);
+    bench_bulk("insert", size, 0);
+    bench_bulk("bulk", size, 1);
+
+    printf("Churn benchmark with %d keys:\n", size);
+    keys = bench_keys(size);
+    bench_churn("pool", avl_create_pooled(int_cmp, NULL, 0), keys, size,
+                size * 2);
+    free(keys);
+    keys = bench_keys(size);
+    bench_churn("malloc", avl_create(int_cmp, NULL), keys, size, size * 2);
+    free(keys);
+    return 0;
+}
+
+int main(int argc, char *argv[])
 {
     avl_tree_t *tree = NULL;
     int arr[SIZE] = {0};
     int i = 0;
 
+    if (argc > 1) {
+        if (strcmp(argv[1], "bench")) {
+            printf("usage: %s [bench [size]]\n", argv[0]);
+            return -1;
+        }
+        return bench(argc > 2 ? atoi(argv[2]) : BENCH_SIZE);
+    }
+
     tree = avl_create(int_cmp, NULL);
 
     for (i = 0; i < SIZE; i++) {
@@ -60,6 +314,7 @@ int main(void)
     }
 
     avl_dump(tree);
+    avl_destroy(tree);
 
     return 0;
 }
@@ -89,7 +89,7 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
-#include <sys/stdint.h>
+#include <stdint.h>
 #include <assert.h>
 #include "avl.h"
 
@@ -107,6 +107,25 @@
 static const int  avl_child2balance[2]	= {-1, 1};
 static const int  avl_balance2child[]	= {0, 0, 1};
 
+/*
+ * For trees created with avl_create_rank(), recompute the subtree size of
+ * "node" from its children, or add "delta" to the sizes of "node" and all
+ * its ancestors.
+ */
+static void
+avl_resize(avl_node_t *node)
+{
+	AVL_SETSIZE(node, AVL_SIZE(node->avl_child[0]) +
+	    AVL_SIZE(node->avl_child[1]) + 1);
+}
+
+static void
+avl_resize_path(avl_node_t *node, long delta)
+{
+	for (; node != NULL; node = AVL_XPARENT(node))
+		AVL_XSIZE(node) += delta;
+}
+
 
 /*
  * Walk from one node to the previous valued node (ie. an infix walk
@@ -369,6 +388,11 @@ avl_rotation(avl_tree_t *tree, avl_node_t *node, int balance)
 		else
 			tree->avl_root = child;
 
+		if (tree->avl_ranked) {
+			avl_resize(node);
+			avl_resize(child);
+		}
+
 		return (child_bal == 0);
 	}
 
@@ -452,6 +476,12 @@ avl_rotation(avl_tree_t *tree, avl_node_t *node, int balance)
 	else
 		tree->avl_root = gchild;
 
+	if (tree->avl_ranked) {
+		avl_resize(child);
+		avl_resize(node);
+		avl_resize(gchild);
+	}
+
 	return (1);	/* the new tree is always shorter */
 }
 
@@ -501,6 +531,10 @@ avl_insert(avl_tree_t *tree, void *new_data, avl_index_t where)
 		ASSERT(tree->avl_root == NULL);
 		tree->avl_root = node;
 	}
+	if (tree->avl_ranked) {
+		AVL_SETSIZE(node, 1);
+		avl_resize_path(parent, 1);
+	}
 	/*
 	 * Now, back up the tree modifying the balance of all nodes above the
 	 * insertion point. If we get to a highly unbalanced ancestor, we
@@ -660,12 +694,11 @@ avl_add(avl_tree_t *tree, void *new_node)
  * height due to a rotation.
  */
 void
-avl_remove(avl_tree_t *tree, void *data)
+avl_remove_tmp(avl_tree_t *tree, void *data, avl_node_t *tmp)
 {
 	avl_node_t *delete;
 	avl_node_t *parent;
 	avl_node_t *node;
-	avl_node_t tmp;
 	int old_balance;
 	int new_balance;
 	int left;
@@ -709,11 +742,13 @@ avl_remove(avl_tree_t *tree, void *data)
 		 * create a temp placeholder for 'node'
 		 * move 'node' to delete's spot in the tree
 		 */
-		tmp = *node;
+		*tmp = *node;
 
 		*node = *delete;
+		if (tree->avl_ranked)
+			AVL_SETSIZE(node, AVL_XSIZE(delete));
 		if (node->avl_child[left] == node)
-			node->avl_child[left] = &tmp;
+			node->avl_child[left] = tmp;
 
 		parent = AVL_XPARENT(node);
 		if (parent != NULL)
@@ -727,7 +762,7 @@ avl_remove(avl_tree_t *tree, void *data)
 		 * Put tmp where node used to be (just temporary).
 		 * It always has a parent and at most 1 child.
 		 */
-		delete = &tmp;
+		delete = tmp;
 		parent = AVL_XPARENT(delete);
 		parent->avl_child[AVL_XCHILD(delete)] = delete;
 		which_child = (delete->avl_child[1] != 0);
@@ -744,6 +779,8 @@ avl_remove(avl_tree_t *tree, void *data)
 	--tree->avl_numnodes;
 	parent = AVL_XPARENT(delete);
 	which_child = AVL_XCHILD(delete);
+	if (tree->avl_ranked)
+		avl_resize_path(parent, -1);
 	if (delete->avl_child[0] != NULL)
 		node = delete->avl_child[0];
 	else
@@ -805,6 +842,14 @@ avl_remove(avl_tree_t *tree, void *data)
 	} while (parent != NULL);
 }
 
+void
+avl_remove(avl_tree_t *tree, void *data)
+{
+	avl_node_t tmp;
+
+	avl_remove_tmp(tree, data, &tmp);
+}
+
 #define	AVL_REINSERT(tree, obj)		\
 	avl_remove((tree), (obj));	\
 	avl_add((tree), (obj))
@@ -863,6 +908,852 @@ avl_update(avl_tree_t *t, void *obj)
 	return (B_FALSE);
 }
 
+/*
+ * Height of a perfectly balanced subtree of "numnodes" nodes, which is the
+ * number of bits needed to represent "numnodes".
+ */
+static int
+avl_balanced_height(ulong_t numnodes)
+{
+	int height = 0;
+
+	while (numnodes != 0) {
+		numnodes >>= 1;
+		height++;
+	}
+	return (height);
+}
+
+/*
+ * Build a perfectly balanced tree from "numnodes" nodes already sorted in
+ * ascending order, in O(n) time and without any comparison or rotation.
+ *
+ * Each subtree takes the middle node as its root, with the left half
+ * being never larger than the right half. The sizes of the two halves
+ * differ by at most 1, and so do their heights, hence the balance of
+ * every node is either 0 or +1 and can be computed from the sizes alone.
+ *
+ * Subtrees still to be built are kept on a small explicit stack instead
+ * of recursing. Each pop pushes at most two entries, one level deeper,
+ * so the stack never holds more than tree height + 1 entries.
+ *
+ * The nodes are given either as an array of pointers ("nodes"), or as an
+ * array of the nodes themselves ("base") when "nodes" is NULL.
+ */
+#define	AVL_BULK_DATA(i)	\
+	(nodes != NULL ? nodes[i] : (void *)(base + (i) * tree->avl_size))
+
+static void
+avl_bulk_build(avl_tree_t *tree, void **nodes, char *base, ulong_t numnodes)
+{
+	struct {
+		ulong_t		first;		/* index of the lowest node */
+		ulong_t		count;		/* nodes in this subtree */
+		avl_node_t	*parent;
+		int		which_child;
+	} stack[sizeof (ulong_t) * NBBY + 1], *top;
+	size_t off = tree->avl_offset;
+	avl_node_t *node;
+	avl_node_t *parent;
+	ulong_t first;
+	ulong_t left;
+	ulong_t right;
+	int which_child;
+
+	ASSERT(tree);
+	ASSERT(tree->avl_root == NULL);
+	ASSERT(tree->avl_numnodes == 0);
+	ASSERT(numnodes == 0 || nodes != NULL || base != NULL);
+
+#ifdef DEBUG
+	for (first = 1; first < numnodes; first++)
+		ASSERT(tree->avl_compar(AVL_BULK_DATA(first - 1),
+		    AVL_BULK_DATA(first)) < 0);
+#endif
+
+	if (numnodes == 0)
+		return;
+
+	top = stack;
+	top->first = 0;
+	top->count = numnodes;
+	top->parent = NULL;
+	top->which_child = 0;
+
+	while (top >= stack) {
+		first = top->first;
+		left = (top->count - 1) / 2;
+		right = top->count - 1 - left;
+		parent = top->parent;
+		which_child = top->which_child;
+		top--;
+
+#ifdef _LP64
+		ASSERT(((uintptr_t)AVL_BULK_DATA(first + left) & 0x7) == 0);
+#endif
+		node = AVL_DATA2NODE(AVL_BULK_DATA(first + left), off);
+		node->avl_child[0] = NULL;
+		node->avl_child[1] = NULL;
+		AVL_SETPARENT(node, parent);
+		AVL_SETCHILD(node, which_child);
+		AVL_SETBALANCE(node, avl_balanced_height(right) -
+		    avl_balanced_height(left));
+		if (tree->avl_ranked)
+			AVL_SETSIZE(node, left + right + 1);
+		if (parent != NULL)
+			parent->avl_child[which_child] = node;
+		else
+			tree->avl_root = node;
+
+		if (right != 0) {
+			top++;
+			top->first = first + left + 1;
+			top->count = right;
+			top->parent = node;
+			top->which_child = 1;
+		}
+		if (left != 0) {
+			top++;
+			top->first = first;
+			top->count = left;
+			top->parent = node;
+			top->which_child = 0;
+		}
+	}
+
+	tree->avl_numnodes = numnodes;
+}
+#undef	AVL_BULK_DATA
+
+void
+avl_bulk_load(avl_tree_t *tree, void **nodes, ulong_t numnodes)
+{
+	avl_bulk_build(tree, nodes, NULL, numnodes);
+}
+
+/*
+ * Same as avl_bulk_load(), for nodes laid out one after another, avl_size
+ * bytes apart, so that no array of pointers needs to be built first.
+ */
+void
+avl_bulk_load_array(avl_tree_t *tree, void *base, ulong_t numnodes)
+{
+	avl_bulk_build(tree, NULL, base, numnodes);
+}
+
+/*
+ * Start a walk of the nodes from "lo" to "hi" included, in ascending order.
+ * Either bound may be NULL for no bound. The cursor keeps the path to the
+ * next node on a stack, instead of climbing back through the parent links
+ * as avl_walk() does. The last node of the range is also looked up here,
+ * so that the walk itself needs no comparison. The tree must not be changed
+ * while walking.
+ */
+void
+avl_cursor_init(avl_tree_t *tree, avl_cursor_t *cursor, const void *lo,
+    const void *hi)
+{
+	avl_node_t *node;
+	avl_node_t *last = NULL;
+	size_t off = tree->avl_offset;
+	int diff;
+
+	ASSERT(tree);
+	ASSERT(cursor);
+
+	cursor->avl_depth = 0;
+
+	/*
+	 * The last node is the greatest one not greater than "hi". If it
+	 * is less than "lo" the range is empty.
+	 */
+	for (node = tree->avl_root; node != NULL; ) {
+		diff = (hi == NULL ? 1 :
+		    tree->avl_compar(hi, AVL_NODE2DATA(node, off)));
+		ASSERT(-1 <= diff && diff <= 1);
+		if (diff >= 0)
+			last = node;
+		if (diff == 0)
+			break;
+		node = node->avl_child[diff > 0];
+	}
+	if (last == NULL || (lo != NULL &&
+	    tree->avl_compar(lo, AVL_NODE2DATA(last, off)) > 0))
+		return;
+	cursor->avl_last = last;
+	cursor->avl_offset = off;
+
+	/*
+	 * Keep every node where the search for "lo" goes left, they are
+	 * the ones not smaller than "lo" which are yet to be visited.
+	 */
+	node = tree->avl_root;
+	while (node != NULL) {
+		diff = (lo == NULL ? -1 :
+		    tree->avl_compar(lo, AVL_NODE2DATA(node, off)));
+		ASSERT(-1 <= diff && diff <= 1);
+		if (diff > 0) {
+			node = node->avl_child[1];
+			continue;
+		}
+		ASSERT(cursor->avl_depth < AVL_MAXDEPTH);
+		cursor->avl_stack[cursor->avl_depth++] = node;
+		if (diff == 0)
+			break;
+		node = node->avl_child[0];
+	}
+}
+
+/*
+ * Return the next node of the walk, or NULL when past the upper bound.
+ */
+void *
+avl_cursor_next(avl_cursor_t *cursor)
+{
+	avl_node_t *node;
+	avl_node_t *next;
+
+	if (cursor->avl_depth == 0)
+		return (NULL);
+
+	node = cursor->avl_stack[--cursor->avl_depth];
+	if (node == cursor->avl_last) {
+		cursor->avl_depth = 0;
+	} else {
+		/*
+		 * The nodes following this one start with the leftmost
+		 * descendant of its right child.
+		 */
+		for (next = node->avl_child[1]; next != NULL;
+		    next = next->avl_child[0]) {
+			ASSERT(cursor->avl_depth < AVL_MAXDEPTH);
+			cursor->avl_stack[cursor->avl_depth++] = next;
+		}
+	}
+
+	return (AVL_NODE2DATA(node, cursor->avl_offset));
+}
+
+/*
+ * Height of the subtree at "node", by following the taller child down.
+ */
+static int
+avl_height(avl_node_t *node)
+{
+	int height = 0;
+
+	for (; node != NULL; node = node->avl_child[AVL_XBALANCE(node) > 0])
+		height++;
+	return (height);
+}
+
+/*
+ * Height of a child of a node of the given height.
+ */
+#define	AVL_CHILD_HEIGHT(node, height, child)				\
+	((height) - 1 - (AVL_XBALANCE(node) == -avl_child2balance[child]))
+
+/*
+ * Link "left" and "right" as the children of "node", which becomes the
+ * root of a subtree with no parent.
+ */
+static void
+avl_link(avl_tree_t *tree, avl_node_t *node, avl_node_t *left,
+    avl_node_t *right, int balance)
+{
+	node->avl_child[0] = left;
+	node->avl_child[1] = right;
+	if (left != NULL) {
+		AVL_SETPARENT(left, node);
+		AVL_SETCHILD(left, 0);
+	}
+	if (right != NULL) {
+		AVL_SETPARENT(right, node);
+		AVL_SETCHILD(right, 1);
+	}
+	AVL_SETBALANCE(node, balance);
+	AVL_SETPARENT(node, NULL);
+	AVL_SETCHILD(node, 0);
+	if (tree->avl_ranked)
+		avl_resize(node);
+}
+
+/*
+ * Join the subtrees "left" and "right" of the given heights, with "node"
+ * in between, in O(|lheight - rheight|) time. All the nodes of "left"
+ * must be less than "node", and all the nodes of "right" greater.
+ *
+ * If the heights differ by 2 or more, the shorter subtree is hung below
+ * "node" at the place along the inner edge of the taller one where the
+ * heights match. This only makes that place 1 level higher, which is
+ * exactly what an insertion does, so the balances above are fixed up
+ * the same way avl_insert() does.
+ *
+ * Return value:
+ *	the root of the joined subtree, whose height is set in "*heightp"
+ */
+static avl_node_t *
+avl_join_nodes(avl_tree_t *tree, avl_node_t *left, int lheight,
+    avl_node_t *node, avl_node_t *right, int rheight, int *heightp)
+{
+	avl_tree_t tmp;
+	avl_node_t *parent;
+	avl_node_t *inner;
+	avl_node_t *outer;
+	int height;
+	int oheight;
+	int old_balance;
+	int new_balance;
+	int which_child;
+	int dir;
+
+	if (lheight - rheight <= 1 && rheight - lheight <= 1) {
+		avl_link(tree, node, left, right, rheight - lheight);
+		*heightp = MAX(lheight, rheight) + 1;
+		return (node);
+	}
+
+	/*
+	 * Go down the taller subtree in direction "dir" towards the shorter
+	 * one, until the height is no more than 1 above the shorter one.
+	 */
+	dir = (lheight > rheight);
+	tmp.avl_ranked = tree->avl_ranked;
+	tmp.avl_root = (dir ? left : right);
+	outer = (dir ? right : left);
+	height = *heightp = (dir ? lheight : rheight);
+	oheight = (dir ? rheight : lheight);
+	AVL_SETPARENT(tmp.avl_root, NULL);
+
+	parent = NULL;
+	for (inner = tmp.avl_root; height > oheight + 1;
+	    inner = inner->avl_child[dir]) {
+		height = AVL_CHILD_HEIGHT(inner, height, dir);
+		parent = inner;
+	}
+	ASSERT(parent != NULL);
+
+	node->avl_child[dir] = outer;
+	node->avl_child[1 - dir] = inner;
+	if (outer != NULL) {
+		AVL_SETPARENT(outer, node);
+		AVL_SETCHILD(outer, dir);
+	}
+	if (inner != NULL) {
+		AVL_SETPARENT(inner, node);
+		AVL_SETCHILD(inner, 1 - dir);
+	}
+	AVL_SETBALANCE(node, (oheight - height) * avl_child2balance[dir]);
+	AVL_SETPARENT(node, parent);
+	AVL_SETCHILD(node, dir);
+	parent->avl_child[dir] = node;
+	if (tree->avl_ranked) {
+		avl_resize(node);
+		avl_resize_path(parent, AVL_SIZE(outer) + 1);
+	}
+
+	/*
+	 * The subtree at "node" is now 1 level higher than "inner" was,
+	 * back up the tree as in avl_insert().
+	 */
+	which_child = dir;
+	for (;;) {
+		if (parent == NULL) {
+			++*heightp;
+			break;
+		}
+		old_balance = AVL_XBALANCE(parent);
+		new_balance = old_balance + avl_child2balance[which_child];
+		if (new_balance == 0) {
+			AVL_SETBALANCE(parent, 0);
+			break;
+		}
+		if (old_balance != 0) {
+			(void) avl_rotation(&tmp, parent, new_balance);
+			break;
+		}
+		AVL_SETBALANCE(parent, new_balance);
+		which_child = AVL_XCHILD(parent);
+		parent = AVL_XPARENT(parent);
+	}
+
+	return (tmp.avl_root);
+}
+
+/*
+ * Split the subtree at "root" of the given height into the nodes less than
+ * "value" and the nodes greater than it, which become the subtrees at
+ * "*leftp" and "*rightp". A node equal to "value" goes to the side given
+ * by "side" (0 for the left one, 1 for the right one), or if "side" is -1,
+ * to neither of them and is returned instead.
+ *
+ * The search path for "value" is cut at each node: a node where the path
+ * goes right belongs to the left part with its left subtree, and the other
+ * way round. Going back up, the pieces are joined with avl_join_nodes(),
+ * and since each join costs no more than the difference between the
+ * heights of the pieces, all of them add up to O(log(n)).
+ *
+ * Return value:
+ *	NULL: no node was taken out
+ *	the node equal to "value", if "side" is -1
+ */
+static avl_node_t *
+avl_split_nodes(avl_tree_t *tree, avl_node_t *root, int height,
+    const void *value, int side, avl_node_t **leftp, int *lheightp,
+    avl_node_t **rightp, int *rheightp)
+{
+	struct {
+		avl_node_t	*node;
+		int		height;
+		int		child;	/* which way the path went */
+	} path[AVL_MAXDEPTH];
+	size_t off = tree->avl_offset;
+	avl_node_t *node;
+	avl_node_t *equal = NULL;
+	avl_node_t *left = NULL;
+	avl_node_t *right = NULL;
+	int lheight = 0;
+	int rheight = 0;
+	int depth = 0;
+	int child;
+	int diff;
+
+	for (node = root; node != NULL; node = node->avl_child[child]) {
+		diff = tree->avl_compar(value, AVL_NODE2DATA(node, off));
+		ASSERT(-1 <= diff && diff <= 1);
+		if (diff == 0 && side < 0) {
+			equal = node;
+			left = node->avl_child[0];
+			lheight = AVL_CHILD_HEIGHT(node, height, 0);
+			right = node->avl_child[1];
+			rheight = AVL_CHILD_HEIGHT(node, height, 1);
+			break;
+		}
+		child = (diff > 0 || (diff == 0 && side == 0));
+		ASSERT(depth < AVL_MAXDEPTH);
+		path[depth].node = node;
+		path[depth].height = height;
+		path[depth].child = child;
+		depth++;
+		height = AVL_CHILD_HEIGHT(node, height, child);
+	}
+
+	while (--depth >= 0) {
+		node = path[depth].node;
+		child = path[depth].child;
+		height = AVL_CHILD_HEIGHT(node, path[depth].height, 1 - child);
+		if (child == 1)
+			left = avl_join_nodes(tree, node->avl_child[0],
+			    height, node, left, lheight, &lheight);
+		else
+			right = avl_join_nodes(tree, right, rheight, node,
+			    node->avl_child[1], height, &rheight);
+	}
+
+	if (left != NULL)
+		AVL_SETPARENT(left, NULL);
+	if (right != NULL)
+		AVL_SETPARENT(right, NULL);
+	*leftp = left;
+	*lheightp = lheight;
+	*rightp = right;
+	*rheightp = rheight;
+
+	return (equal);
+}
+
+/*
+ * Join the subtrees "left" and "right" of the given heights, all the nodes
+ * of "left" being less than those of "right", using the lowest node of
+ * "right" to put in between. The height of the result is set in
+ * "*heightp".
+ */
+static avl_node_t *
+avl_join_subtrees(avl_tree_t *tree, avl_node_t *left, int lheight,
+    avl_node_t *right, int rheight, int *heightp)
+{
+	avl_tree_t tmp;
+	avl_node_t *node;
+
+	if (left == NULL || right == NULL) {
+		node = (left != NULL ? left : right);
+		*heightp = (left != NULL ? lheight : rheight);
+		if (node != NULL)
+			AVL_SETPARENT(node, NULL);
+		return (node);
+	}
+
+	for (node = right; node->avl_child[0] != NULL;
+	    node = node->avl_child[0])
+		;
+
+	/*
+	 * The node count of this temporary tree is only there to please
+	 * avl_remove().
+	 */
+	AVL_SETPARENT(right, NULL);
+	tmp.avl_root = right;
+	tmp.avl_offset = tree->avl_offset;
+	tmp.avl_numnodes = 1;
+	tmp.avl_ranked = tree->avl_ranked;
+	avl_remove(&tmp, AVL_NODE2DATA(node, tree->avl_offset));
+	rheight = avl_height(tmp.avl_root);
+
+	return (avl_join_nodes(tree, left, lheight, node, tmp.avl_root,
+	    rheight, heightp));
+}
+
+/*
+ * Count the nodes of two subtrees walking both at the same pace, and stop
+ * at the end of the smaller one. The total of both must be "numnodes".
+ * With avl_create_rank() this is simply the size of the first one.
+ *
+ * Return value:
+ *	the number of nodes in the tree "first"
+ */
+static ulong_t
+avl_count_pair(avl_tree_t *first, avl_tree_t *second, ulong_t numnodes)
+{
+	ulong_t count;
+	void *fdata;
+	void *sdata;
+
+	if (first->avl_ranked)
+		return (AVL_SIZE(first->avl_root));
+
+	fdata = avl_first(first);
+	sdata = avl_first(second);
+	for (count = 0; fdata != NULL && sdata != NULL; count++) {
+		fdata = AVL_NEXT(first, fdata);
+		sdata = AVL_NEXT(second, sdata);
+	}
+	if (fdata != NULL)
+		count = numnodes - count;
+
+	ASSERT(count <= numnodes);
+	return (count);
+}
+
+/*
+ * Remove all the nodes from "lo" to "hi" included, in O(log(n)) time plus
+ * the time needed to count them. The tree is split twice around the range,
+ * and the parts at both ends joined back. The nodes removed are moved to
+ * the tree "removed", which must be empty, and the number of them returned.
+ */
+ulong_t
+avl_remove_range(avl_tree_t *tree, const void *lo, const void *hi,
+    avl_tree_t *removed)
+{
+	avl_node_t *left;
+	avl_node_t *middle;
+	avl_node_t *right;
+	int lheight;
+	int mheight;
+	int rheight;
+	int height;
+	ulong_t numnodes;
+
+	ASSERT(tree);
+	ASSERT(removed);
+	ASSERT(removed->avl_root == NULL);
+	ASSERT(removed->avl_offset == tree->avl_offset);
+	ASSERT(removed->avl_ranked == tree->avl_ranked);
+	ASSERT(tree->avl_compar(lo, hi) <= 0);
+
+	(void) avl_split_nodes(tree, tree->avl_root,
+	    avl_height(tree->avl_root), lo, 1, &left, &lheight, &right,
+	    &rheight);
+	(void) avl_split_nodes(tree, right, rheight, hi, 0, &middle, &mheight,
+	    &right, &rheight);
+
+	tree->avl_root = avl_join_subtrees(tree, left, lheight, right,
+	    rheight, &height);
+	removed->avl_root = middle;
+
+	numnodes = avl_count_pair(removed, tree, tree->avl_numnodes);
+	tree->avl_numnodes -= numnodes;
+	removed->avl_numnodes = numnodes;
+
+	return (numnodes);
+}
+
+/*
+ * Split "tree" into the nodes less than "value", moved to "left", and the
+ * nodes greater than it, moved to "right". See avl.h.
+ */
+void *
+avl_split(avl_tree_t *tree, const void *value, avl_tree_t *left,
+    avl_tree_t *right)
+{
+	avl_node_t *equal;
+	avl_node_t *lroot;
+	avl_node_t *rroot;
+	int lheight;
+	int rheight;
+	ulong_t numnodes = tree->avl_numnodes;
+	ulong_t lnumnodes;
+
+	ASSERT(tree);
+	ASSERT(left != right);
+	ASSERT(left == tree || left->avl_root == NULL);
+	ASSERT(right == tree || right->avl_root == NULL);
+	ASSERT(left->avl_offset == tree->avl_offset);
+	ASSERT(right->avl_offset == tree->avl_offset);
+	ASSERT(left->avl_ranked == tree->avl_ranked);
+	ASSERT(right->avl_ranked == tree->avl_ranked);
+
+	equal = avl_split_nodes(tree, tree->avl_root,
+	    avl_height(tree->avl_root), value, -1, &lroot, &lheight, &rroot,
+	    &rheight);
+	if (equal != NULL)
+		numnodes--;
+
+	tree->avl_root = NULL;
+	tree->avl_numnodes = 0;
+	left->avl_root = lroot;
+	right->avl_root = rroot;
+
+	lnumnodes = avl_count_pair(left, right, numnodes);
+	left->avl_numnodes = lnumnodes;
+	right->avl_numnodes = numnodes - lnumnodes;
+
+	if (equal == NULL)
+		return (NULL);
+	return (AVL_NODE2DATA(equal, tree->avl_offset));
+}
+
+/*
+ * Move all the nodes of "right" to "left". See avl.h.
+ */
+void
+avl_join(avl_tree_t *left, avl_tree_t *right)
+{
+	int height;
+
+	ASSERT(left);
+	ASSERT(right);
+	ASSERT(left != right);
+	ASSERT(left->avl_offset == right->avl_offset);
+	ASSERT(left->avl_ranked == right->avl_ranked);
+#ifdef DEBUG
+	if (left->avl_root != NULL && right->avl_root != NULL)
+		ASSERT(left->avl_compar(avl_last(left), avl_first(right)) < 0);
+#endif
+
+	left->avl_root = avl_join_subtrees(left, left->avl_root,
+	    avl_height(left->avl_root), right->avl_root,
+	    avl_height(right->avl_root), &height);
+	left->avl_numnodes += right->avl_numnodes;
+	right->avl_root = NULL;
+	right->avl_numnodes = 0;
+}
+
+/*
+ * Join with or without a node in between, see avl_join_nodes() and
+ * avl_join_subtrees().
+ */
+static avl_node_t *
+avl_join_parts(avl_tree_t *tree, avl_node_t *left, int lheight,
+    avl_node_t *node, avl_node_t *right, int rheight, int *heightp)
+{
+	if (node != NULL)
+		return (avl_join_nodes(tree, left, lheight, node, right,
+		    rheight, heightp));
+	return (avl_join_subtrees(tree, left, lheight, right, rheight,
+	    heightp));
+}
+
+#define	AVL_UNION	(0)
+#define	AVL_INTERSECT	(1)
+#define	AVL_DIFFERENCE	(2)
+
+/*
+ * Common code of avl_union(), avl_intersect() and avl_difference().
+ *
+ * This is the divide and conquer over the nodes of "other": for the root
+ * node of a subtree of "other", split the matching part of "tree" around
+ * it, apply the operation on the parts at its left and at its right, and
+ * join the results with the root node in between if it belongs to them.
+ * Since the splits and joins are cheap when the parts are small, this
+ * takes O(m * log(n / m + 1)) time for m nodes in the smaller tree, which
+ * is also what a merge of a few nodes into a large tree would cost.
+ *
+ * Each half produces two subtrees: the nodes of the result ("res") and
+ * the nodes dropped from it ("rest"). The recursion goes down "other",
+ * whose height bounds the depth of the explicit stack.
+ */
+static void
+avl_setop(avl_tree_t *tree, avl_tree_t *other, avl_tree_t *rest, int op)
+{
+	struct {
+		avl_node_t	*a;		/* part of "tree" */
+		avl_node_t	*b;		/* subtree of "other" */
+		avl_node_t	*aright;	/* part of "a" right of "b" */
+		avl_node_t	*aequal;	/* node of "a" equal to "b" */
+		avl_node_t	*res;		/* results of the left half */
+		avl_node_t	*rest;
+		int		aheight;
+		int		bheight;
+		int		arheight;
+		int		resheight;
+		int		restheight;
+		int		state;
+	} stack[AVL_MAXDEPTH + 1], *top;
+	avl_node_t *res = NULL;
+	avl_node_t *drop = NULL;
+	avl_node_t *aleft;
+	avl_node_t *b;
+	int resheight = 0;
+	int dropheight = 0;
+	int alheight;
+	ulong_t hits = 0;
+
+	ASSERT(tree);
+	ASSERT(other);
+	ASSERT(rest);
+	ASSERT(tree != other && tree != rest && other != rest);
+	ASSERT(rest->avl_root == NULL);
+	ASSERT(tree->avl_offset == other->avl_offset);
+	ASSERT(tree->avl_offset == rest->avl_offset);
+	ASSERT(tree->avl_ranked == other->avl_ranked);
+	ASSERT(tree->avl_ranked == rest->avl_ranked);
+
+	top = stack;
+	top->a = tree->avl_root;
+	top->aheight = avl_height(tree->avl_root);
+	top->b = other->avl_root;
+	top->bheight = avl_height(other->avl_root);
+	top->state = 0;
+
+	while (top >= stack) {
+		b = top->b;
+		switch (top->state) {
+		case 0:
+			if (top->a == NULL || b == NULL) {
+				/*
+				 * Nothing to compare with: "a" is entirely in
+				 * or out of the result, and "b" too for a
+				 * union.
+				 */
+				res = drop = NULL;
+				resheight = dropheight = 0;
+				if (op == AVL_INTERSECT) {
+					drop = top->a;
+					dropheight = top->aheight;
+				} else if (top->a != NULL) {
+					res = top->a;
+					resheight = top->aheight;
+				} else if (op == AVL_UNION) {
+					res = b;
+					resheight = top->bheight;
+				}
+				top--;
+				break;
+			}
+
+			top->aequal = avl_split_nodes(tree, top->a,
+			    top->aheight, AVL_NODE2DATA(b, other->avl_offset),
+			    -1, &aleft, &alheight, &top->aright,
+			    &top->arheight);
+			top->state = 1;
+			top++;
+			ASSERT(top <= stack + AVL_MAXDEPTH);
+			top->a = aleft;
+			top->aheight = alheight;
+			top->b = b->avl_child[0];
+			top->bheight = AVL_CHILD_HEIGHT(b, top[-1].bheight, 0);
+			top->state = 0;
+			break;
+
+		case 1:
+			top->res = res;
+			top->resheight = resheight;
+			top->rest = drop;
+			top->restheight = dropheight;
+			top->state = 2;
+			top++;
+			ASSERT(top <= stack + AVL_MAXDEPTH);
+			top->a = top[-1].aright;
+			top->aheight = top[-1].arheight;
+			top->b = b->avl_child[1];
+			top->bheight = AVL_CHILD_HEIGHT(b, top[-1].bheight, 1);
+			top->state = 0;
+			break;
+
+		case 2:
+			/*
+			 * Join both halves, with the node in between going
+			 * to the result or to the rest.
+			 */
+			if (top->aequal != NULL)
+				hits++;
+			if (op == AVL_UNION) {
+				drop = avl_join_parts(tree, top->rest,
+				    top->restheight,
+				    (top->aequal != NULL ? b : NULL),
+				    drop, dropheight, &dropheight);
+				res = avl_join_nodes(tree, top->res,
+				    top->resheight,
+				    (top->aequal != NULL ? top->aequal : b),
+				    res, resheight, &resheight);
+			} else {
+				drop = avl_join_parts(tree, top->rest,
+				    top->restheight,
+				    (op == AVL_DIFFERENCE ? top->aequal : NULL),
+				    drop, dropheight, &dropheight);
+				res = avl_join_parts(tree, top->res,
+				    top->resheight,
+				    (op == AVL_INTERSECT ? top->aequal : NULL),
+				    res, resheight, &resheight);
+			}
+			top--;
+			break;
+		}
+	}
+
+	if (res != NULL)
+		AVL_SETPARENT(res, NULL);
+	if (drop != NULL)
+		AVL_SETPARENT(drop, NULL);
+	tree->avl_root = res;
+	rest->avl_root = drop;
+
+	switch (op) {
+	case AVL_UNION:
+		tree->avl_numnodes += other->avl_numnodes - hits;
+		rest->avl_numnodes = hits;
+		other->avl_root = NULL;
+		other->avl_numnodes = 0;
+		break;
+	case AVL_INTERSECT:
+		rest->avl_numnodes = tree->avl_numnodes - hits;
+		tree->avl_numnodes = hits;
+		break;
+	case AVL_DIFFERENCE:
+		rest->avl_numnodes = hits;
+		tree->avl_numnodes -= hits;
+		break;
+	}
+}
+
+void
+avl_union(avl_tree_t *tree, avl_tree_t *other, avl_tree_t *rest)
+{
+	avl_setop(tree, other, rest, AVL_UNION);
+}
+
+void
+avl_intersect(avl_tree_t *tree, avl_tree_t *other, avl_tree_t *rest)
+{
+	avl_setop(tree, other, rest, AVL_INTERSECT);
+}
+
+void
+avl_difference(avl_tree_t *tree, avl_tree_t *other, avl_tree_t *rest)
+{
+	avl_setop(tree, other, rest, AVL_DIFFERENCE);
+}
+
 /*
  * initialize a new AVL tree
  */
@@ -883,6 +1774,77 @@ avl_create(avl_tree_t *tree, int (*compar) (const void *, const void *),
 	tree->avl_numnodes = 0;
 	tree->avl_size = size;
 	tree->avl_offset = offset;
+	tree->avl_ranked = B_FALSE;
+}
+
+/*
+ * initialize a new AVL tree which keeps the size of every subtree
+ */
+void
+avl_create_rank(avl_tree_t *tree, int (*compar) (const void *, const void *),
+    size_t size, size_t offset)
+{
+	ASSERT(size >= offset + sizeof (avl_rank_node_t));
+
+	avl_create(tree, compar, size, offset);
+	tree->avl_ranked = B_TRUE;
+}
+
+/*
+ * Return the number of nodes less than "value", which is also the index
+ * of the node with that value if there is one. The subtree sizes tell how
+ * many nodes are skipped each time the search goes right.
+ */
+ulong_t
+avl_rank(avl_tree_t *tree, const void *value)
+{
+	avl_node_t *node;
+	size_t off = tree->avl_offset;
+	ulong_t rank = 0;
+	int diff;
+
+	ASSERT(tree);
+	ASSERT(tree->avl_ranked);
+
+	for (node = tree->avl_root; node != NULL; ) {
+		diff = tree->avl_compar(value, AVL_NODE2DATA(node, off));
+		ASSERT(-1 <= diff && diff <= 1);
+		if (diff > 0)
+			rank += AVL_SIZE(node->avl_child[0]) + 1;
+		else if (diff == 0)
+			return (rank + AVL_SIZE(node->avl_child[0]));
+		node = node->avl_child[avl_balance2child[1 + diff]];
+	}
+
+	return (rank);
+}
+
+/*
+ * Return the node at "index" in ascending order, starting from 0, or NULL
+ * if there are not that many nodes.
+ */
+void *
+avl_select(avl_tree_t *tree, ulong_t index)
+{
+	avl_node_t *node;
+	ulong_t lsize;
+
+	ASSERT(tree);
+	ASSERT(tree->avl_ranked);
+
+	for (node = tree->avl_root; node != NULL; ) {
+		lsize = AVL_SIZE(node->avl_child[0]);
+		if (index == lsize)
+			return (AVL_NODE2DATA(node, tree->avl_offset));
+		if (index < lsize) {
+			node = node->avl_child[0];
+		} else {
+			index -= lsize + 1;
+			node = node->avl_child[1];
+		}
+	}
+
+	return (NULL);
 }
 
 /*
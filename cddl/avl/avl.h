@@ -112,6 +112,12 @@ typedef struct avl_tree avl_tree_t;
  */
 typedef struct avl_node avl_node_t;
 
+/*
+ * The data nodes of a tree created with avl_create_rank() must have a field
+ * of this type instead.
+ */
+typedef struct avl_rank_node avl_rank_node_t;
+
 /*
  * An opaque type used to locate a position in the tree where a node
  * would be inserted.
@@ -119,6 +125,12 @@ typedef struct avl_node avl_node_t;
 typedef uintptr_t avl_index_t;
 
 
+/*
+ * State of a walk over a range of the tree, see avl_cursor_init().
+ */
+typedef struct avl_cursor avl_cursor_t;
+
+
 /*
  * Direction constants used for avl_nearest().
  */
@@ -152,6 +164,15 @@ typedef uintptr_t avl_index_t;
 extern void avl_create(avl_tree_t *tree,
 	int (*compar) (const void *, const void *), size_t size, size_t offset);
 
+/*
+ * Same as avl_create(), but the tree also keeps the number of nodes below
+ * each node, for avl_rank() and avl_select(). The field at "offset" must be
+ * an avl_rank_node_t. This costs another word per node, and a walk up to
+ * the root on every insertion and removal.
+ */
+extern void avl_create_rank(avl_tree_t *tree,
+	int (*compar) (const void *, const void *), size_t size, size_t offset);
+
 
 /*
  * Find a node with a matching value in the tree. Returns the matching node
@@ -231,6 +252,28 @@ extern void *avl_last(avl_tree_t *tree);
 extern void *avl_nearest(avl_tree_t *tree, avl_index_t where, int direction);
 
 
+/*
+ * Walk the nodes with values from "lo" to "hi" included, in ascending order.
+ * Either bound may be NULL to walk from the first node or to the last one.
+ * avl_cursor_next() returns the next node, or NULL at the end of the range.
+ * This is faster than avl_find() and AVL_NEXT(), since the cursor keeps the
+ * path to the next node instead of going back up through the parents. The
+ * tree must not be changed during the walk.
+ *
+ * EXAMPLE visit the nodes from "lo" to "hi":
+ *
+ *	avl_cursor_t cursor;
+ *	struct my_data *node;
+ *
+ *	avl_cursor_init(tree, &cursor, &lo, &hi);
+ *	while ((node = avl_cursor_next(&cursor)) != NULL)
+ *		...
+ */
+extern void avl_cursor_init(avl_tree_t *tree, avl_cursor_t *cursor,
+    const void *lo, const void *hi);
+extern void *avl_cursor_next(avl_cursor_t *cursor);
+
+
 /*
  * Add a single node to the tree.
  * The node must not be in the tree, and it must not
@@ -241,6 +284,29 @@ extern void *avl_nearest(avl_tree_t *tree, avl_index_t where, int direction);
 extern void avl_add(avl_tree_t *tree, void *node);
 
 
+/*
+ * Build the tree from an array of nodes in O(n) time, which is faster than
+ * adding them one by one. The tree must be empty, and the nodes must be
+ * sorted in ascending order without duplicates. The result is a perfectly
+ * balanced tree.
+ *
+ * nodes    - array of pointers to the nodes, sorted
+ * numnodes - number of nodes in the array
+ */
+extern void avl_bulk_load(avl_tree_t *tree, void **nodes, ulong_t numnodes);
+
+/*
+ * Same as avl_bulk_load(), but for nodes stored one after another in a
+ * single array, such as one allocation of numnodes * size bytes, where size
+ * is the one given to avl_create().
+ *
+ * base     - the first node of the array
+ * numnodes - number of nodes in the array
+ */
+extern void avl_bulk_load_array(avl_tree_t *tree, void *base,
+    ulong_t numnodes);
+
+
 /*
  * Remove a single node from the tree.  The node must be in the tree.
  *
@@ -248,6 +314,73 @@ extern void avl_add(avl_tree_t *tree, void *node);
  */
 extern void avl_remove(avl_tree_t *tree, void *node);
 
+/*
+ * Remove all the nodes with values from "lo" to "hi" included, and move
+ * them to the tree "removed", which must be empty and created with the same
+ * offset. Returns the number of nodes removed. The tree is cut around the
+ * range in O(log(n)) instead of removing the nodes one by one, so the cost
+ * beyond that is only counting the nodes removed, or the nodes left if
+ * there are less of them. Trees created with avl_create_rank() need no
+ * counting.
+ *
+ * The nodes can be freed afterwards with avl_destroy_nodes() on "removed".
+ */
+extern ulong_t avl_remove_range(avl_tree_t *tree, const void *lo,
+    const void *hi, avl_tree_t *removed);
+
+/*
+ * Split a tree in two around a value, in O(log(n)) time plus the time needed
+ * to count the nodes of the smaller part, unless the tree was created with
+ * avl_create_rank(). The nodes less than "value" are
+ * moved to "left", and the nodes greater than it to "right". Both must be
+ * empty and created with the same compare function and offset, but either
+ * of them may be "tree" itself. Otherwise "tree" is left empty.
+ *
+ * Returns the node equal to "value", which is not in any tree any more, or
+ * NULL if there is none.
+ *
+ * EXAMPLE move the nodes from "value" up to another tree:
+ *
+ *	node = avl_split(tree, &value, tree, &upper);
+ *	if (node != NULL)
+ *		avl_add(&upper, node);
+ */
+extern void *avl_split(avl_tree_t *tree, const void *value, avl_tree_t *left,
+    avl_tree_t *right);
+
+/*
+ * Move all the nodes of "right" to "left" in O(log(n)) time, which leaves
+ * "right" empty. All the nodes of "left" must be less than the nodes of
+ * "right".
+ */
+extern void avl_join(avl_tree_t *left, avl_tree_t *right);
+
+/*
+ * Set operations between two trees created with the same compare function
+ * and offset, in O(m * log(n / m + 1)) time for m nodes in the smaller tree
+ * and n in the larger one, made of splits and joins. The result is left in
+ * "tree", and the nodes dropped from it are moved to "rest", which must be
+ * empty:
+ *
+ * avl_union()      - moves the nodes of "other" to "tree", except those
+ *                    equal to a node of "tree", which go to "rest". "other"
+ *                    is left empty.
+ * avl_intersect()  - moves the nodes of "tree" not equal to any node of
+ *                    "other" to "rest".
+ * avl_difference() - moves the nodes of "tree" equal to a node of "other"
+ *                    to "rest".
+ *
+ * "other" is not changed by avl_intersect() and avl_difference(). As the
+ * trees are split by value, large operations can be run in parallel by
+ * splitting both trees at the same values, running the operation on each
+ * pair of parts, and joining the results back.
+ */
+extern void avl_union(avl_tree_t *tree, avl_tree_t *other, avl_tree_t *rest);
+extern void avl_intersect(avl_tree_t *tree, avl_tree_t *other,
+    avl_tree_t *rest);
+extern void avl_difference(avl_tree_t *tree, avl_tree_t *other,
+    avl_tree_t *rest);
+
 /*
  * Reinsert a node only if its order has changed relative to its nearest
  * neighbors. To optimize performance avl_update_lt() checks only the previous
@@ -259,6 +392,22 @@ extern boolean_t avl_update(avl_tree_t *, void *);
 extern boolean_t avl_update_lt(avl_tree_t *, void *);
 extern boolean_t avl_update_gt(avl_tree_t *, void *);
 
+/*
+ * Order statistics in O(log(n)) time, for trees created with
+ * avl_create_rank() only.
+ *
+ * avl_rank()   - returns the number of nodes less than "value", which is
+ *                also the index of the node equal to it if there is one
+ * avl_select() - returns the node at "index" (starting from 0) in ascending
+ *                order, or NULL if there are not more than "index" nodes
+ *
+ * EXAMPLE get the 99th percentile:
+ *
+ *	p99 = avl_select(tree, avl_numnodes(tree) * 99 / 100);
+ */
+extern ulong_t avl_rank(avl_tree_t *tree, const void *value);
+extern void *avl_select(avl_tree_t *tree, ulong_t index);
+
 /*
  * Return the number of nodes in the tree
  */
@@ -121,6 +121,21 @@ struct avl_node {
 
 
 
+/*
+ * The node of a tree created with avl_create_rank(), which also keeps the
+ * number of nodes in the subtree rooted at each node.
+ */
+struct avl_rank_node {
+	struct avl_node avl_rank_link;
+	ulong_t avl_rank_size;		/* nodes in this subtree */
+};
+
+#define	AVL_XSIZE(n)		(((struct avl_rank_node *)(n))->avl_rank_size)
+#define	AVL_SETSIZE(n, s)	(AVL_XSIZE(n) = (s))
+#define	AVL_SIZE(n)		((n) == NULL ? 0 : AVL_XSIZE(n))
+
+
+
 /*
  * switch between a node and data pointer for a given tree
  * the value of "o" is tree->avl_offset
@@ -149,6 +164,26 @@ struct avl_tree {
 	size_t avl_offset;		/* offsetof(type, avl_link_t field) */
 	ulong_t avl_numnodes;		/* number of nodes in the tree */
 	size_t avl_size;		/* sizeof user type struct */
+	boolean_t avl_ranked;		/* nodes are avl_rank_node_t */
+};
+
+
+/*
+ * An AVL tree of height h has at least fib(h + 2) - 1 nodes, so no tree
+ * with less than 2^64 nodes is higher than 91 levels.
+ */
+#define	AVL_MAXDEPTH	(96)
+
+/*
+ * State of a range walk, see avl_cursor_init(). The stack holds the nodes
+ * still to be visited whose right subtrees have not been entered yet, the
+ * next one on top, so no parent link has to be followed.
+ */
+struct avl_cursor {
+	struct avl_node *avl_last;	/* last node of the range */
+	size_t avl_offset;		/* offsetof(type, avl_link_t field) */
+	int avl_depth;			/* entries in avl_stack[] */
+	struct avl_node *avl_stack[AVL_MAXDEPTH];
 };
 
 
@@ -157,6 +192,12 @@ struct avl_tree {
  */
 extern void *avl_walk(struct avl_tree *, void *, int);
 
+/*
+ * avl_remove() with the placeholder for the swapped node supplied by the
+ * caller, instead of being on the stack. Only used by avl_mt.c.
+ */
+extern void avl_remove_tmp(struct avl_tree *, void *, struct avl_node *);
+
 #ifdef	__cplusplus
 }
 #endif
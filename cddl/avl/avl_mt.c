@@ -0,0 +1,357 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVL_MT - concurrent ordered map made of range sharded AVL trees
+ *
+ * Writers of a shard are serialized by the shard lock, and run the plain
+ * AVL routines on the shard tree. Around each modification they bump the
+ * shard sequence count, which is odd while the tree is being changed:
+ *
+ *	writer				reader
+ *	------				------
+ *	lock				s = seq (acquire)
+ *	seq++ (odd)			search the tree, copy the node
+ *	<fence>				<fence>
+ *	avl_insert()/avl_remove()	retry if s is odd or s != seq
+ *	seq++ (even, release)
+ *	unlock
+ *
+ * A reader which raced with a writer may have seen the tree in any state
+ * in between, and thrown its result away afterwards. Two things keep it
+ * from doing any harm meanwhile:
+ *
+ *	- Every pointer it follows is either NULL, or points to a node which
+ *	  is, or has been, in the tree, since nodes are not freed while the
+ *	  map is in use. The only exception is the placeholder which stands
+ *	  in for a node being swapped by avl_remove(). avl_remove() keeps it
+ *	  on its stack, which a reader could still follow once the stack is
+ *	  reused, so writers use avl_remove_tmp() with a spare node of the
+ *	  shard instead, which lives as long as the map and is as large as
+ *	  a user node, for the compare function to read.
+ *
+ *	- A rotation may link nodes in a loop for an instant, so the search
+ *	  gives up after going deeper than any AVL tree can be.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include "avl_mt.h"
+
+/*
+ * Search depth beyond which the tree must be in the middle of a change.
+ * The height of an AVL tree is less than 1.45 * log2(n + 2).
+ */
+#define	AVL_MT_MAXDEPTH	(2 * sizeof (ulong_t) * NBBY)
+
+/*
+ * Direction for an exact match only, see avl_mt_search().
+ */
+#define	AVL_MT_EXACT	(-1)
+
+#define	AVL_MT_LOAD(p)	__atomic_load_n(&(p), __ATOMIC_RELAXED)
+
+static int
+avl_mt_shard(avl_mt_tree_t *mt, const void *value)
+{
+	int shard;
+
+	if (mt->avl_mt_nshards == 1)
+		return (0);
+
+	shard = mt->avl_mt_shardfn(value);
+	ASSERT(0 <= shard && shard < mt->avl_mt_nshards);
+	return (shard);
+}
+
+/*
+ * Search for the node which contains "value", or if there is none, for the
+ * nearest one in the given direction (AVL_BEFORE or AVL_AFTER, unless
+ * AVL_MT_EXACT). This is the same as avl_find() followed by avl_nearest(),
+ * but without walking back up the tree through the parent links: the
+ * nearest node is simply the last one where the search went the other way.
+ *
+ * Works without the shard lock, in which case B_TRUE is returned in
+ * "*torn" when the search could not have been done on a consistent tree.
+ */
+static void *
+avl_mt_search(avl_tree_t *tree, const void *value, int direction,
+    boolean_t *torn)
+{
+	avl_node_t *node;
+	avl_node_t *nearest = NULL;
+	size_t off = tree->avl_offset;
+	int depth = 0;
+	int child;
+	int diff;
+
+	for (node = AVL_MT_LOAD(tree->avl_root); node != NULL;
+	    node = AVL_MT_LOAD(node->avl_child[child])) {
+
+		if (++depth > AVL_MT_MAXDEPTH) {
+			*torn = B_TRUE;
+			return (NULL);
+		}
+
+		diff = tree->avl_compar(value, AVL_NODE2DATA(node, off));
+		if (diff == 0)
+			return (AVL_NODE2DATA(node, off));
+		child = (diff > 0);
+		if (child != direction)
+			nearest = node;
+	}
+
+	if (direction == AVL_MT_EXACT || nearest == NULL)
+		return (NULL);
+	return (AVL_NODE2DATA(nearest, off));
+}
+
+/*
+ * Search one shard, see avl_mt_search(), and copy the node found. Try
+ * without any lock first, and take the shard lock only if writers kept
+ * changing the tree under us.
+ */
+static boolean_t
+avl_mt_read(avl_mt_tree_t *mt, avl_mt_shard_t *shard, const void *value,
+    int direction, void *copy)
+{
+	avl_tree_t *tree = &shard->avl_mt_tree;
+	boolean_t torn;
+	ulong_t seq;
+	void *data;
+	int retry;
+
+	for (retry = 0; retry < AVL_MT_RETRIES; retry++) {
+		seq = __atomic_load_n(&shard->avl_mt_seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		torn = B_FALSE;
+		data = avl_mt_search(tree, value, direction, &torn);
+		if (data != NULL && copy != NULL)
+			(void) memcpy(copy, data, mt->avl_mt_size);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (!torn && AVL_MT_LOAD(shard->avl_mt_seq) == seq)
+			return (data != NULL);
+	}
+
+	(void) pthread_mutex_lock(&shard->avl_mt_lock);
+	data = avl_mt_search(tree, value, direction, &torn);
+	if (data != NULL && copy != NULL)
+		(void) memcpy(copy, data, mt->avl_mt_size);
+	(void) pthread_mutex_unlock(&shard->avl_mt_lock);
+
+	return (data != NULL);
+}
+
+static void
+avl_mt_write_begin(avl_mt_shard_t *shard)
+{
+	ASSERT((shard->avl_mt_seq & 1) == 0);
+	__atomic_store_n(&shard->avl_mt_seq, shard->avl_mt_seq + 1,
+	    __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+avl_mt_write_end(avl_mt_shard_t *shard)
+{
+	ASSERT((shard->avl_mt_seq & 1) == 1);
+	__atomic_store_n(&shard->avl_mt_seq, shard->avl_mt_seq + 1,
+	    __ATOMIC_RELEASE);
+}
+
+int
+avl_mt_create(avl_mt_tree_t *mt, int (*compar) (const void *, const void *),
+    size_t size, size_t offset, int nshards, int (*shardfn) (const void *))
+{
+	avl_mt_shard_t *shard;
+	int i;
+
+	ASSERT(mt);
+	ASSERT(nshards >= 1);
+	ASSERT(nshards == 1 || shardfn != NULL);
+
+	if ((size_t)nshards > SIZE_MAX / sizeof (avl_mt_shard_t) ||
+	    posix_memalign((void **)&mt->avl_mt_shards,
+	    __alignof__(avl_mt_shard_t),
+	    nshards * sizeof (avl_mt_shard_t)) != 0)
+		return (ENOMEM);
+
+	for (i = 0; i < nshards; i++) {
+		shard = &mt->avl_mt_shards[i];
+		shard->avl_mt_spare = calloc(1, size);
+		if (shard->avl_mt_spare == NULL) {
+			while (--i >= 0) {
+				shard = &mt->avl_mt_shards[i];
+				avl_destroy(&shard->avl_mt_tree);
+				(void) pthread_mutex_destroy(
+				    &shard->avl_mt_lock);
+				free(shard->avl_mt_spare);
+			}
+			free(mt->avl_mt_shards);
+			mt->avl_mt_shards = NULL;
+			return (ENOMEM);
+		}
+		(void) pthread_mutex_init(&shard->avl_mt_lock, NULL);
+		shard->avl_mt_seq = 0;
+		avl_create(&shard->avl_mt_tree, compar, size, offset);
+	}
+	mt->avl_mt_nshards = nshards;
+	mt->avl_mt_shardfn = shardfn;
+	mt->avl_mt_size = size;
+
+	return (0);
+}
+
+boolean_t
+avl_mt_find(avl_mt_tree_t *mt, const void *value, void *copy)
+{
+	avl_mt_shard_t *shard = &mt->avl_mt_shards[avl_mt_shard(mt, value)];
+
+	return (avl_mt_read(mt, shard, value, AVL_MT_EXACT, copy));
+}
+
+/*
+ * Each shard is searched on its own, so if writers are moving the nearest
+ * node around, the result is the nearest node of one of the shards at the
+ * time it was searched, but not necessarily of the whole map at any time.
+ */
+boolean_t
+avl_mt_nearest(avl_mt_tree_t *mt, const void *value, int direction,
+    void *copy)
+{
+	int step = (direction == AVL_AFTER ? 1 : -1);
+	int i;
+
+	ASSERT(direction == AVL_BEFORE || direction == AVL_AFTER);
+
+	for (i = avl_mt_shard(mt, value); i >= 0 && i < mt->avl_mt_nshards;
+	    i += step) {
+		if (avl_mt_read(mt, &mt->avl_mt_shards[i], value, direction,
+		    copy))
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+boolean_t
+avl_mt_add(avl_mt_tree_t *mt, void *node)
+{
+	avl_mt_shard_t *shard = &mt->avl_mt_shards[avl_mt_shard(mt, node)];
+	avl_index_t where;
+	boolean_t added = B_FALSE;
+
+	(void) pthread_mutex_lock(&shard->avl_mt_lock);
+	if (avl_find(&shard->avl_mt_tree, node, &where) == NULL) {
+		avl_mt_write_begin(shard);
+		avl_insert(&shard->avl_mt_tree, node, where);
+		avl_mt_write_end(shard);
+		added = B_TRUE;
+	}
+	(void) pthread_mutex_unlock(&shard->avl_mt_lock);
+
+	return (added);
+}
+
+void *
+avl_mt_remove(avl_mt_tree_t *mt, const void *value)
+{
+	avl_mt_shard_t *shard = &mt->avl_mt_shards[avl_mt_shard(mt, value)];
+	void *data;
+
+	(void) pthread_mutex_lock(&shard->avl_mt_lock);
+	data = avl_find(&shard->avl_mt_tree, value, NULL);
+	if (data != NULL) {
+		avl_mt_write_begin(shard);
+		avl_remove_tmp(&shard->avl_mt_tree, data, AVL_DATA2NODE(
+		    shard->avl_mt_spare, shard->avl_mt_tree.avl_offset));
+		avl_mt_write_end(shard);
+	}
+	(void) pthread_mutex_unlock(&shard->avl_mt_lock);
+
+	return (data);
+}
+
+ulong_t
+avl_mt_numnodes(avl_mt_tree_t *mt)
+{
+	ulong_t numnodes = 0;
+	int i;
+
+	for (i = 0; i < mt->avl_mt_nshards; i++)
+		numnodes += AVL_MT_LOAD(
+		    mt->avl_mt_shards[i].avl_mt_tree.avl_numnodes);
+
+	return (numnodes);
+}
+
+/*
+ * avl_destroy_nodes() leaves the root of a tree set until it has returned
+ * all of its nodes, so the shard being destroyed is always the first one
+ * with a root.
+ */
+void *
+avl_mt_destroy_nodes(avl_mt_tree_t *mt, void **cookie)
+{
+	avl_tree_t *tree;
+	void *data;
+	int i;
+
+	for (i = 0; i < mt->avl_mt_nshards; i++) {
+		tree = &mt->avl_mt_shards[i].avl_mt_tree;
+		if (tree->avl_root == NULL)
+			continue;
+
+		data = avl_destroy_nodes(tree, cookie);
+		if (data != NULL)
+			return (data);
+		*cookie = NULL;
+	}
+
+	return (NULL);
+}
+
+void
+avl_mt_destroy(avl_mt_tree_t *mt)
+{
+	avl_mt_shard_t *shard;
+	int i;
+
+	ASSERT(mt);
+
+	for (i = 0; i < mt->avl_mt_nshards; i++) {
+		shard = &mt->avl_mt_shards[i];
+		avl_destroy(&shard->avl_mt_tree);
+		(void) pthread_mutex_destroy(&shard->avl_mt_lock);
+		free(shard->avl_mt_spare);
+	}
+	free(mt->avl_mt_shards);
+	mt->avl_mt_shards = NULL;
+	mt->avl_mt_nshards = 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_AVL_MT_H
+#define	_AVL_MT_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include "avl.h"
+
+/*
+ * A concurrent ordered map built on top of the AVL trees.
+ *
+ * The key space is split into a fixed number of ranges ("shards"), each of
+ * them kept in its own AVL tree protected by its own lock, so that writers
+ * to different ranges never contend. Readers take no lock at all: every
+ * shard carries a sequence count that writers bump before and after
+ * touching the tree, and a reader simply searches the tree and then checks
+ * that the count did not move meanwhile, retrying otherwise. Only after a
+ * few failed attempts does a reader fall back to taking the shard lock.
+ *
+ * Since a lockless reader may be looking at a node while it is being
+ * removed, the following rules apply to the users of this interface:
+ *
+ *	- Readers never get a pointer to a node, but a copy of it, taken
+ *	  while the shard was known to be stable.
+ *
+ *	- Nodes removed from the map must not be freed (or reused as
+ *	  anything else than a node of this map) until avl_mt_destroy_nodes()
+ *	  time, or until the caller otherwise knows no reader is running.
+ *
+ *	- The compare function may be called on a node which is being
+ *	  modified, so it must only look at values within the node itself
+ *	  (not follow pointers), and must not fail on any value it reads.
+ *	  The result of such a call is always thrown away.
+ *
+ * The shard function maps a node to its shard, in [0, nshards). It must be
+ * monotonic with the compare function, that is a node less than another
+ * one can never be in a higher shard. This is what keeps the map ordered
+ * as a whole, and lets avl_mt_nearest() cross shard boundaries.
+ */
+
+/*
+ * Number of lockless attempts before a reader takes the shard lock.
+ */
+#define	AVL_MT_RETRIES	(4)
+
+/*
+ * One shard of the map, aligned so that shards never share a cache line.
+ */
+typedef struct avl_mt_shard {
+	pthread_mutex_t	avl_mt_lock;	/* serializes writers */
+	ulong_t		avl_mt_seq;	/* odd while a writer is active */
+	avl_tree_t	avl_mt_tree;
+	void		*avl_mt_spare;	/* placeholder for avl_remove_tmp() */
+} __attribute__((aligned(64))) avl_mt_shard_t;
+
+typedef struct avl_mt_tree {
+	avl_mt_shard_t	*avl_mt_shards;
+	int		avl_mt_nshards;
+	int		(*avl_mt_shardfn)(const void *);
+	size_t		avl_mt_size;	/* sizeof user type struct */
+} avl_mt_tree_t;
+
+/*
+ * Initialize a concurrent map. Arguments are the same as avl_create(),
+ * plus:
+ *
+ * nshards - the number of shards, at least 1
+ * shardfn - function to map a node to its shard, may be NULL if nshards is 1
+ *
+ * Returns 0, or ENOMEM if the shards can't be allocated.
+ */
+extern int avl_mt_create(avl_mt_tree_t *mt,
+	int (*compar) (const void *, const void *), size_t size, size_t offset,
+	int nshards, int (*shardfn) (const void *));
+
+/*
+ * Find the node with a matching value. Returns B_TRUE and copies the node
+ * to "copy" (unless NULL) if found, B_FALSE otherwise, in which case the
+ * content of "copy" is undefined. Never blocks on other readers, and
+ * rarely on writers.
+ *
+ * value - node that has the value being looked for
+ * copy  - buffer of the user type size to receive the node, may be NULL
+ */
+extern boolean_t avl_mt_find(avl_mt_tree_t *mt, const void *value,
+	void *copy);
+
+/*
+ * Same as avl_mt_find(), but if there is no matching node, copy the one
+ * with the nearest value either less than (AVL_BEFORE) or greater than
+ * (AVL_AFTER) the given value, from whichever shard it is in. Returns
+ * B_FALSE only if there isn't such a node.
+ *
+ * value     - node that has the value being looked for
+ * direction - either AVL_BEFORE or AVL_AFTER
+ * copy      - buffer of the user type size to receive the node, may be NULL
+ */
+extern boolean_t avl_mt_nearest(avl_mt_tree_t *mt, const void *value,
+	int direction, void *copy);
+
+/*
+ * Add a node to the map. Unlike avl_add(), it is fine for a node of the
+ * same value to be present already, as another thread may have added it:
+ * B_FALSE is returned and the map is left alone. Returns B_TRUE otherwise.
+ *
+ * node - the node to add
+ */
+extern boolean_t avl_mt_add(avl_mt_tree_t *mt, void *node);
+
+/*
+ * Remove the node with a matching value from the map, and return it, or
+ * NULL if there is no such node. See above for when it may be freed.
+ *
+ * value - node that has the value being looked for
+ */
+extern void *avl_mt_remove(avl_mt_tree_t *mt, const void *value);
+
+/*
+ * Return the number of nodes in the map. Only a snapshot if there are
+ * concurrent writers.
+ */
+extern ulong_t avl_mt_numnodes(avl_mt_tree_t *mt);
+
+/*
+ * Same as avl_destroy_nodes(), for all the shards in turn. The cookie
+ * should be initialized to NULL before the first call. Must not run
+ * concurrently with any other call on the map.
+ */
+extern void *avl_mt_destroy_nodes(avl_mt_tree_t *mt, void **cookie);
+
+/*
+ * Final destroy of a concurrent map, which must be empty.
+ */
+extern void avl_mt_destroy(avl_mt_tree_t *mt);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _AVL_MT_H */
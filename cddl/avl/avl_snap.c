@@ -0,0 +1,291 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+/*
+ * AVL_SNAP - save AVL trees to files, and load them back
+ *
+ * A snapshot file looks like this, all in the native byte order:
+ *
+ *	+--------+--------+--------+-----+--------+
+ *	| header | node 0 | node 1 | ... | node n |
+ *	+--------+--------+--------+-----+--------+
+ *
+ * where each node is the user structure with its AVL field cut out, that is
+ * the "offset" bytes before the field, then the bytes after it. Nodes are
+ * packed without any padding, in ascending order, which is what
+ * avl_bulk_load_array() needs once they are copied back around the field.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include "avl_snap.h"
+
+#define	AVL_SNAP_MAGIC		"AVLSNAP"
+#define	AVL_SNAP_VERSION	(1)
+
+/*
+ * Nodes are written out in chunks of this size.
+ */
+#define	AVL_SNAP_BUFSIZE	(1 << 20)
+
+typedef struct avl_snap_header {
+	char		avl_snap_magic[8];
+	uint32_t	avl_snap_version;
+	uint32_t	avl_snap_recsize;	/* bytes per node in the file */
+	uint64_t	avl_snap_numnodes;
+	uint64_t	avl_snap_size;		/* sizeof user type struct */
+	uint64_t	avl_snap_offset;	/* offset of the AVL field */
+} avl_snap_header_t;
+
+/*
+ * Size of the AVL field of the nodes, which is not saved.
+ */
+static size_t
+avl_snap_linksize(avl_tree_t *tree)
+{
+	return (tree->avl_ranked ? sizeof (struct avl_rank_node) :
+	    sizeof (avl_node_t));
+}
+
+static int
+avl_snap_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno);
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	return (0);
+}
+
+/*
+ * Write the header and the nodes to "fd", walking the tree in order with a
+ * cursor, which needs no comparison.
+ */
+static int
+avl_snap_write_nodes(avl_tree_t *tree, int fd)
+{
+	avl_snap_header_t header;
+	avl_cursor_t cursor;
+	size_t head = tree->avl_offset;
+	size_t tail = tree->avl_size - head - avl_snap_linksize(tree);
+	size_t recsize = head + tail;
+	size_t len = 0;
+	char *buf;
+	char *data;
+	int err;
+
+	(void) memset(&header, 0, sizeof (header));
+	(void) memcpy(header.avl_snap_magic, AVL_SNAP_MAGIC,
+	    sizeof (AVL_SNAP_MAGIC));
+	header.avl_snap_version = AVL_SNAP_VERSION;
+	header.avl_snap_recsize = recsize;
+	header.avl_snap_numnodes = tree->avl_numnodes;
+	header.avl_snap_size = tree->avl_size;
+	header.avl_snap_offset = tree->avl_offset;
+
+	err = avl_snap_write(fd, &header, sizeof (header));
+	if (err != 0)
+		return (err);
+
+	buf = malloc(AVL_SNAP_BUFSIZE);
+	if (buf == NULL)
+		return (ENOMEM);
+
+	avl_cursor_init(tree, &cursor, NULL, NULL);
+	while ((data = avl_cursor_next(&cursor)) != NULL) {
+		if (len + recsize > AVL_SNAP_BUFSIZE) {
+			err = avl_snap_write(fd, buf, len);
+			if (err != 0)
+				break;
+			len = 0;
+		}
+		(void) memcpy(buf + len, data, head);
+		(void) memcpy(buf + len + head, data + tree->avl_size - tail,
+		    tail);
+		len += recsize;
+	}
+	if (err == 0)
+		err = avl_snap_write(fd, buf, len);
+
+	free(buf);
+	return (err);
+}
+
+int
+avl_snap_save(avl_tree_t *tree, const char *path)
+{
+	char *tmp;
+	int fd;
+	int err;
+
+	ASSERT(tree);
+	ASSERT(path);
+	ASSERT(avl_snap_linksize(tree) + tree->avl_offset <= tree->avl_size);
+
+	tmp = malloc(strlen(path) + sizeof (".tmp"));
+	if (tmp == NULL)
+		return (ENOMEM);
+	(void) sprintf(tmp, "%s.tmp", path);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		err = errno;
+		free(tmp);
+		return (err);
+	}
+
+	err = avl_snap_write_nodes(tree, fd);
+	if (err == 0 && fsync(fd) != 0)
+		err = errno;
+	if (close(fd) != 0 && err == 0)
+		err = errno;
+	if (err == 0 && rename(tmp, path) != 0)
+		err = errno;
+	if (err != 0)
+		(void) unlink(tmp);
+
+	free(tmp);
+	return (err);
+}
+
+/*
+ * Check that the header describes a file of "filesize" bytes, holding nodes
+ * of this tree.
+ */
+static boolean_t
+avl_snap_check(avl_tree_t *tree, const avl_snap_header_t *header,
+    size_t filesize)
+{
+	size_t recsize = tree->avl_size - avl_snap_linksize(tree);
+
+	if (memcmp(header->avl_snap_magic, AVL_SNAP_MAGIC,
+	    sizeof (AVL_SNAP_MAGIC)) != 0 ||
+	    header->avl_snap_version != AVL_SNAP_VERSION ||
+	    header->avl_snap_recsize != recsize ||
+	    header->avl_snap_size != tree->avl_size ||
+	    header->avl_snap_offset != tree->avl_offset)
+		return (B_FALSE);
+
+	/*
+	 * The file size bounds the number of nodes, unless they are empty,
+	 * in which case the allocation size must not overflow.
+	 */
+	if (header->avl_snap_numnodes > SIZE_MAX / tree->avl_size)
+		return (B_FALSE);
+
+	return (filesize - sizeof (*header) ==
+	    header->avl_snap_numnodes * recsize);
+}
+
+int
+avl_snap_load(avl_tree_t *tree, const char *path, void **storage)
+{
+	const avl_snap_header_t *header;
+	struct stat st;
+	size_t head = tree->avl_offset;
+	size_t tail = tree->avl_size - head - avl_snap_linksize(tree);
+	size_t recsize = head + tail;
+	const char *map;
+	const char *rec;
+	char *nodes = NULL;
+	char *node;
+	ulong_t numnodes;
+	ulong_t i;
+	int fd;
+	int err = 0;
+
+	ASSERT(tree);
+	ASSERT(path);
+	ASSERT(storage);
+	ASSERT(tree->avl_numnodes == 0);
+
+	*storage = NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return (errno);
+	if (fstat(fd, &st) != 0) {
+		err = errno;
+		(void) close(fd);
+		return (err);
+	}
+	if (st.st_size < (off_t)sizeof (*header)) {
+		(void) close(fd);
+		return (EINVAL);
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	err = (map == MAP_FAILED ? errno : 0);
+	(void) close(fd);
+	if (err != 0)
+		return (err);
+	(void) madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+	header = (const avl_snap_header_t *)map;
+	if (!avl_snap_check(tree, header, st.st_size)) {
+		err = EINVAL;
+		goto out;
+	}
+	numnodes = header->avl_snap_numnodes;
+
+	if (numnodes != 0) {
+		nodes = malloc(numnodes * tree->avl_size);
+		if (nodes == NULL) {
+			err = ENOMEM;
+			goto out;
+		}
+	}
+
+	rec = map + sizeof (*header);
+	node = nodes;
+	for (i = 0; i < numnodes; i++) {
+		(void) memcpy(node, rec, head);
+		(void) memcpy(node + tree->avl_size - tail, rec + head, tail);
+		rec += recsize;
+		node += tree->avl_size;
+	}
+
+	avl_bulk_load_array(tree, nodes, numnodes);
+	*storage = nodes;
+out:
+	(void) munmap((void *)map, st.st_size);
+	return (err);
+}
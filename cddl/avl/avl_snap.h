@@ -0,0 +1,96 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#ifndef	_AVL_SNAP_H
+#define	_AVL_SNAP_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include "avl.h"
+
+/*
+ * Snapshots of AVL trees, to save a tree to a file and get it back later,
+ * typically across a restart of the program, without paying for all the
+ * comparisons of adding the nodes one by one.
+ *
+ * The file holds a small header, followed by the content of every node in
+ * ascending order, minus the avl_node_t (or avl_rank_node_t) field, which
+ * is rebuilt on load. Loading maps the file, copies the nodes into a single
+ * allocation and builds the tree with avl_bulk_load_array(), so it costs
+ * about as much as reading the file.
+ *
+ * The nodes are saved byte for byte, so:
+ *
+ *	- They must not contain pointers, or anything else which does not
+ *	  survive a restart (file descriptors, ...).
+ *
+ *	- A snapshot can only be loaded by a program using the same node type,
+ *	  built for the same platform. The node size and the offset of the
+ *	  AVL field are checked on load, nothing more.
+ */
+
+/*
+ * Save all the nodes of a tree to a file, replacing it if it exists. The
+ * file is written aside and renamed in place only once complete and synced,
+ * so that a crash never leaves a partial snapshot behind. The tree is left
+ * alone.
+ *
+ * Returns 0, or an errno value if the file can't be written.
+ *
+ * path - name of the snapshot file
+ */
+extern int avl_snap_save(avl_tree_t *tree, const char *path);
+
+/*
+ * Load a tree saved with avl_snap_save(). The tree must be empty, and have
+ * been created the same way as the saved one. The nodes all live in one
+ * allocation returned in "storage", to be released with free() once the
+ * tree is destroyed (with avl_destroy_nodes() then avl_destroy(), without
+ * freeing the nodes themselves). "storage" is set to NULL for an empty tree.
+ *
+ * The nodes are not compared on load, the order of the file is trusted.
+ *
+ * Returns 0, EINVAL if the file is not a snapshot of this kind of tree, or
+ * another errno value if it can't be read or the nodes can't be allocated,
+ * in which case the tree is left empty.
+ *
+ * path    - name of the snapshot file
+ * storage - receives the allocation holding the nodes
+ *
+ * EXAMPLE:
+ *	if (avl_snap_load(&tree, path, &storage) != 0)
+ *		rebuild the tree from scratch
+ *	...
+ *	while (avl_destroy_nodes(&tree, &cookie) != NULL)
+ *		;
+ *	avl_destroy(&tree);
+ *	free(storage);
+ */
+extern int avl_snap_load(avl_tree_t *tree, const char *path, void **storage);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _AVL_SNAP_H */
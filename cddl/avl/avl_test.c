@@ -1,7 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "avl.h"
+#include "avl_mt.h"
+#include "avl_snap.h"
+
+#define	BENCH_SIZE	(1000000)
+#define	BENCH_RANGES		(1000)
+#define	BENCH_RANGE_LEN		(1000)
+#define	BENCH_RANK_WALKS	(100)
+#define	BENCH_SET_THREADS	(4)
+#define	BENCH_MT_THREADS	(4)
+#define	BENCH_MT_SHARDS		(64)
+#define	BENCH_MT_OPS		(4000000)
+#define	BENCH_SNAP_FILE		"/tmp/avl_test.snap"
+#define	BENCH_SNAP_BUFSIZE	(1 << 20)
 
 typedef struct queue {
 	avl_tree_t q_tree;
@@ -34,6 +52,19 @@ queue_compare_fn (const void *item1, const void *item2)
 	return 0;
 }
 
+/*
+ * Compare items by value only, for trees where items are looked up with a
+ * probe item of the same value.
+ */
+int
+value_compare_fn (const void *item1, const void *item2)
+{
+	int v1 = ((const queue_item_t *)item1)->q_item_value;
+	int v2 = ((const queue_item_t *)item2)->q_item_value;
+
+	return (v1 > v2) - (v1 < v2);
+}
+
 void *
 alloc (size_t size)
 {
@@ -44,9 +75,898 @@ void
 usage (void)
 {
 	puts("usage: avl_test [int1 [int2...]]");
+	puts("       avl_test bench [size]");
+	puts("       avl_test bench_range [size]");
+	puts("       avl_test bench_rank [size]");
+	puts("       avl_test bench_set [threads [size]]");
+	puts("       avl_test bench_mt [threads [size]]");
+	puts("       avl_test bench_snap [size [file]]");
 	exit(0);
 }
 
+static long long
+now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Build a tree of "size" sorted items, by either avl_add() of each item or
+ * avl_bulk_load() of all of them, and walk it to check the result.
+ */
+static void
+bench_build (const char *name, int size, int bulk)
+{
+	queue_item_t *items = alloc(sizeof(*items) * size);
+	void **nodes = alloc(sizeof(void *) * size);
+	queue_item_t *item;
+	avl_tree_t tree;
+	long long start, build_ns;
+	void *cookie = NULL;
+	int i;
+
+	assert(items && nodes);
+	for (i = 0; i < size; i++) {
+		items[i].q_item_value = i;
+		nodes[i] = &items[i];
+	}
+
+	avl_create(&tree, &queue_compare_fn, sizeof(queue_item_t),
+		   offsetof(queue_item_t, q_item_link));
+
+	start = now_ns();
+	if (bulk) {
+		avl_bulk_load(&tree, nodes, size);
+	} else {
+		for (i = 0; i < size; i++)
+			avl_add(&tree, nodes[i]);
+	}
+	build_ns = now_ns() - start;
+
+	i = 0;
+	for (item = avl_first(&tree); item; item = AVL_NEXT(&tree, item)) {
+		if (item != nodes[i++]) {
+			printf("%s: wrong order at index %d\n", name, i - 1);
+			exit(1);
+		}
+	}
+	assert(i == size && avl_numnodes(&tree) == size);
+
+	while (avl_destroy_nodes(&tree, &cookie) != NULL)
+		;
+	avl_destroy(&tree);
+	free(nodes);
+	free(items);
+
+	printf("%-8s build %7.1f ns/op\n", name, (double)build_ns / size);
+}
+
+static int
+bench (int size)
+{
+	printf("Build benchmark with %d sorted items:\n", size);
+	bench_build("add", size, 0);
+	bench_build("bulk", size, 1);
+	return 0;
+}
+
+/*
+ * Build a tree of the items with values [0, size), for bench_range.
+ */
+static void
+bench_range_tree (avl_tree_t *tree, queue_item_t *items, void **nodes,
+		  int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++) {
+		items[i].q_item_value = i;
+		nodes[i] = &items[i];
+	}
+	avl_create(tree, &value_compare_fn, sizeof(queue_item_t),
+		   offsetof(queue_item_t, q_item_link));
+	avl_bulk_load(tree, nodes, size);
+}
+
+static void
+bench_range_clear (avl_tree_t *tree)
+{
+	void *cookie = NULL;
+
+	while (avl_destroy_nodes(tree, &cookie) != NULL)
+		;
+	avl_destroy(tree);
+}
+
+/*
+ * Remove the items in [lo, hi] from "tree", either one by one walking from
+ * the first of them, or with avl_remove_range(). Returns the count, and
+ * adds the time taken to "*ns", leaving out freeing the removed tree.
+ */
+static long long
+bench_range_remove (avl_tree_t *tree, int lo, int hi, int range,
+		    long long *ns)
+{
+	queue_item_t lo_item, hi_item, *item, *next;
+	avl_tree_t removed;
+	avl_index_t where;
+	long long start, count = 0;
+
+	lo_item.q_item_value = lo;
+	hi_item.q_item_value = hi;
+	avl_create(&removed, &value_compare_fn, sizeof(queue_item_t),
+		   offsetof(queue_item_t, q_item_link));
+
+	start = now_ns();
+	if (range) {
+		count = avl_remove_range(tree, &lo_item, &hi_item, &removed);
+	} else {
+		item = avl_find(tree, &lo_item, &where);
+		if (!item)
+			item = avl_nearest(tree, where, AVL_AFTER);
+		for (; item && item->q_item_value <= hi; item = next) {
+			next = AVL_NEXT(tree, item);
+			avl_remove(tree, item);
+			count++;
+		}
+	}
+	*ns += now_ns() - start;
+
+	bench_range_clear(&removed);
+	return count;
+}
+
+/*
+ * Walk and remove random ranges of BENCH_RANGE_LEN items, the usual way
+ * with avl_find() and AVL_NEXT(), and with the cursor and range removal.
+ */
+static int
+bench_range (int size)
+{
+	queue_item_t *items = alloc(sizeof(*items) * size);
+	void **nodes = alloc(sizeof(void *) * size);
+	int *starts = alloc(sizeof(int) * BENCH_RANGES);
+	queue_item_t lo, hi, *item;
+	avl_tree_t tree;
+	avl_cursor_t cursor;
+	avl_index_t where;
+	long long start, walk_ns, cursor_ns, count, removed, sum, sum2;
+	int i, range;
+
+	assert(items && nodes && starts && size > BENCH_RANGE_LEN);
+	srand(1);
+	for (i = 0; i < BENCH_RANGES; i++)
+		starts[i] = rand() % (size - BENCH_RANGE_LEN);
+
+	printf("Range benchmark with %d items, %d ranges of %d:\n", size,
+	       BENCH_RANGES, BENCH_RANGE_LEN);
+	bench_range_tree(&tree, items, nodes, size);
+
+	sum = count = 0;
+	start = now_ns();
+	for (i = 0; i < BENCH_RANGES; i++) {
+		lo.q_item_value = starts[i];
+		item = avl_find(&tree, &lo, &where);
+		if (!item)
+			item = avl_nearest(&tree, where, AVL_AFTER);
+		for (; item && item->q_item_value < starts[i] + BENCH_RANGE_LEN;
+		     item = AVL_NEXT(&tree, item)) {
+			sum += item->q_item_value;
+			count++;
+		}
+	}
+	walk_ns = now_ns() - start;
+
+	sum2 = 0;
+	start = now_ns();
+	for (i = 0; i < BENCH_RANGES; i++) {
+		lo.q_item_value = starts[i];
+		hi.q_item_value = starts[i] + BENCH_RANGE_LEN - 1;
+		avl_cursor_init(&tree, &cursor, &lo, &hi);
+		while ((item = avl_cursor_next(&cursor)))
+			sum2 += item->q_item_value;
+	}
+	cursor_ns = now_ns() - start;
+	assert(sum == sum2);
+
+	printf("%-8s walk   %7.1f ns/item\n", "next", (double)walk_ns / count);
+	printf("%-8s walk   %7.1f ns/item\n", "cursor",
+	       (double)cursor_ns / count);
+	bench_range_clear(&tree);
+
+	/*
+	 * Then remove the same ranges, which overlap from time to time, and
+	 * the whole upper half of a fresh tree at once.
+	 */
+	for (range = 0; range <= 1; range++) {
+		bench_range_tree(&tree, items, nodes, size);
+		removed = walk_ns = 0;
+		for (i = 0; i < BENCH_RANGES; i++)
+			removed += bench_range_remove(&tree, starts[i],
+			    starts[i] + BENCH_RANGE_LEN - 1, range, &walk_ns);
+		assert(avl_numnodes(&tree) == size - removed);
+		bench_range_clear(&tree);
+
+		bench_range_tree(&tree, items, nodes, size);
+		cursor_ns = 0;
+		count = bench_range_remove(&tree, size / 2, size, range,
+					   &cursor_ns);
+		bench_range_clear(&tree);
+
+		printf("%-8s remove %7.1f ns/item, half of the tree %.3f ms "
+		       "(%lld items)\n", range ? "range" : "one",
+		       (double)walk_ns / removed, cursor_ns / 1000000.0,
+		       count);
+	}
+
+	free(starts);
+	free(nodes);
+	free(items);
+	return 0;
+}
+
+/*
+ * For bench_rank, the items of a tree created with avl_create_rank().
+ */
+typedef struct rank_item {
+	avl_rank_node_t r_item_link;
+	int r_item_value;
+} rank_item_t;
+
+static int
+rank_compare_fn (const void *item1, const void *item2)
+{
+	int v1 = ((const rank_item_t *)item1)->r_item_value;
+	int v2 = ((const rank_item_t *)item2)->r_item_value;
+
+	return (v1 > v2) - (v1 < v2);
+}
+
+/*
+ * Insert and remove "size" items in random order, in a plain tree and in
+ * a tree keeping subtree sizes. Then look up random ranks and indexes,
+ * with avl_rank() and avl_select(), and the O(n) way by walking the tree.
+ */
+static int
+bench_rank (int size)
+{
+	queue_item_t *qitems = alloc(sizeof(*qitems) * size);
+	rank_item_t *ritems = alloc(sizeof(*ritems) * size);
+	int *order = alloc(sizeof(int) * size);
+	avl_tree_t qtree, rtree, upper;
+	rank_item_t probe, *item;
+	long long start, qns, rns, sum, sum2;
+	int i, j, tmp, pass;
+
+	assert(qitems && ritems && order);
+	for (i = 0; i < size; i++) {
+		qitems[i].q_item_value = ritems[i].r_item_value = i;
+		order[i] = i;
+	}
+	srand(1);
+
+	avl_create(&qtree, &value_compare_fn, sizeof(queue_item_t),
+		   offsetof(queue_item_t, q_item_link));
+	avl_create_rank(&rtree, &rank_compare_fn, sizeof(rank_item_t),
+			offsetof(rank_item_t, r_item_link));
+	printf("Rank benchmark with %d items:\n", size);
+
+	/* Pass 0 inserts all the items, pass 1 removes them */
+	for (pass = 0; pass <= 1; pass++) {
+		for (i = size - 1; i > 0; i--) {
+			j = rand() % (i + 1);
+			tmp = order[i];
+			order[i] = order[j];
+			order[j] = tmp;
+		}
+
+		start = now_ns();
+		for (i = 0; i < size; i++) {
+			if (pass)
+				avl_remove(&qtree, &qitems[order[i]]);
+			else
+				avl_add(&qtree, &qitems[order[i]]);
+		}
+		qns = now_ns() - start;
+
+		start = now_ns();
+		for (i = 0; i < size; i++) {
+			if (pass)
+				avl_remove(&rtree, &ritems[order[i]]);
+			else
+				avl_add(&rtree, &ritems[order[i]]);
+		}
+		rns = now_ns() - start;
+
+		printf("%-8s plain %7.1f ns/op, rank %7.1f ns/op\n",
+		       pass ? "remove" : "insert", (double)qns / size,
+		       (double)rns / size);
+		if (pass)
+			break;
+
+		sum = 0;
+		start = now_ns();
+		for (i = 0; i < size; i++) {
+			probe.r_item_value = order[i];
+			sum += avl_rank(&rtree, &probe);
+		}
+		qns = now_ns() - start;
+
+		sum2 = 0;
+		start = now_ns();
+		for (i = 0; i < size; i++) {
+			item = avl_select(&rtree, order[i]);
+			sum2 += item->r_item_value;
+		}
+		rns = now_ns() - start;
+		assert(sum == sum2);
+		printf("%-8s rank  %7.1f ns/op, select %7.1f ns/op\n", "query",
+		       (double)qns / size, (double)rns / size);
+
+		start = now_ns();
+		for (i = 0; i < BENCH_RANK_WALKS; i++) {
+			item = avl_first(&rtree);
+			for (j = 0; j < order[i]; j++)
+				item = AVL_NEXT(&rtree, item);
+			assert(item == avl_select(&rtree, order[i]));
+		}
+		qns = now_ns() - start;
+		printf("%-8s walk  %7.1f us/op\n", "select",
+		       qns / 1000.0 / BENCH_RANK_WALKS);
+
+		/* The sizes also spare avl_split() from counting */
+		avl_create_rank(&upper, &rank_compare_fn, sizeof(rank_item_t),
+				offsetof(rank_item_t, r_item_link));
+		probe.r_item_value = size / 2;
+		start = now_ns();
+		for (i = 0; i < BENCH_RANK_WALKS; i++) {
+			if ((item = avl_split(&rtree, &probe, &rtree, &upper)))
+				avl_add(&upper, item);
+			avl_join(&rtree, &upper);
+		}
+		qns = now_ns() - start;
+		avl_destroy(&upper);
+		printf("%-8s half  %7.1f us/op\n", "split",
+		       qns / 1000.0 / BENCH_RANK_WALKS);
+	}
+
+	avl_destroy(&qtree);
+	avl_destroy(&rtree);
+	free(order);
+	free(ritems);
+	free(qitems);
+	return 0;
+}
+
+/*
+ * For bench_set, the set operations, and how they are done one item at a
+ * time: walk one tree and look each item up in the other.
+ */
+typedef void (*set_op_t)(avl_tree_t *, avl_tree_t *, avl_tree_t *);
+
+static const char *set_names[] = { "union", "intersect", "difference" };
+static const set_op_t set_ops[] = { avl_union, avl_intersect, avl_difference };
+
+typedef struct bench_set_worker {
+	pthread_t	thread;
+	avl_tree_t	tree, other, rest;
+	int		op;
+} bench_set_worker_t;
+
+static void
+bench_set_create (avl_tree_t *tree)
+{
+	avl_create(tree, &value_compare_fn, sizeof(queue_item_t),
+		   offsetof(queue_item_t, q_item_link));
+}
+
+static void
+bench_set_each (avl_tree_t *tree, avl_tree_t *other, avl_tree_t *rest,
+		int op)
+{
+	queue_item_t *item, *next;
+	avl_index_t where;
+	int found;
+
+	if (op == 0) {
+		for (item = avl_first(other); item; item = next) {
+			next = AVL_NEXT(other, item);
+			avl_remove(other, item);
+			if (avl_find(tree, item, &where))
+				avl_add(rest, item);
+			else
+				avl_insert(tree, item, where);
+		}
+		return;
+	}
+
+	for (item = avl_first(tree); item; item = next) {
+		next = AVL_NEXT(tree, item);
+		found = avl_find(other, item, NULL) != NULL;
+		if (found == (op == 2)) {
+			avl_remove(tree, item);
+			avl_add(rest, item);
+		}
+	}
+}
+
+static void *
+bench_set_worker (void *arg)
+{
+	bench_set_worker_t *worker = arg;
+
+	set_ops[worker->op](&worker->tree, &worker->other, &worker->rest);
+	return NULL;
+}
+
+/*
+ * Split both trees in "threads" parts of the key space with avl_split(),
+ * run the operation on each pair of parts in its own thread, and join the
+ * parts of the result back with avl_join().
+ */
+static void
+bench_set_parallel (avl_tree_t *tree, avl_tree_t *other, avl_tree_t *rest,
+		    int op, int threads, int keys)
+{
+	bench_set_worker_t *workers = alloc(sizeof(*workers) * threads);
+	bench_set_worker_t *worker;
+	queue_item_t pivot, *item;
+	int i;
+
+	assert(workers);
+	for (i = 0; i < threads; i++) {
+		worker = &workers[i];
+		worker->op = op;
+		bench_set_create(&worker->tree);
+		bench_set_create(&worker->other);
+		bench_set_create(&worker->rest);
+		if (i == threads - 1) {
+			avl_join(&worker->tree, tree);
+			avl_join(&worker->other, other);
+			break;
+		}
+		pivot.q_item_value = (long long)keys * (i + 1) / threads;
+		if ((item = avl_split(tree, &pivot, &worker->tree, tree)))
+			avl_add(tree, item);
+		if ((item = avl_split(other, &pivot, &worker->other, other)))
+			avl_add(other, item);
+	}
+
+	for (i = 1; i < threads; i++)
+		pthread_create(&workers[i].thread, NULL, bench_set_worker,
+			       &workers[i]);
+	bench_set_worker(&workers[0]);
+	for (i = 1; i < threads; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	for (i = 0; i < threads; i++) {
+		worker = &workers[i];
+		avl_join(tree, &worker->tree);
+		avl_join(other, &worker->other);
+		avl_join(rest, &worker->rest);
+		avl_destroy(&worker->tree);
+		avl_destroy(&worker->other);
+		avl_destroy(&worker->rest);
+	}
+	free(workers);
+}
+
+/*
+ * Fill two trees with about half of the keys each, picked at random the
+ * same way on each call.
+ */
+static void
+bench_set_fill (avl_tree_t *tree, avl_tree_t *other, queue_item_t *items,
+		void **nodes, int keys)
+{
+	int i, n, m, bits;
+
+	srand(1);
+	for (i = n = 0, m = keys; i < keys; i++) {
+		bits = rand();
+		items[i].q_item_value = i;
+		items[keys + i].q_item_value = i;
+		if (bits & 1)
+			nodes[n++] = &items[i];
+		if (bits & 2)
+			nodes[m++] = &items[keys + i];
+	}
+	bench_set_create(tree);
+	bench_set_create(other);
+	avl_bulk_load(tree, nodes, n);
+	avl_bulk_load(other, nodes + keys, m - keys);
+}
+
+/*
+ * Run each set operation on two trees of about "size" items each, one item
+ * at a time, with the join based operation, and with it in parallel. Then
+ * time moving away and back either the upper 1% or the upper half of the
+ * keys with avl_split() and avl_join().
+ */
+static int
+bench_set (int threads, int size)
+{
+	static const char *modes[] = { "each", "join", "parallel" };
+	int keys = size * 2;
+	queue_item_t *items = alloc(sizeof(*items) * keys * 2);
+	void **nodes = alloc(sizeof(void *) * keys * 2);
+	avl_tree_t tree, other, rest, upper;
+	queue_item_t pivot, *item;
+	long long start, ns;
+	ulong_t numnodes[3] = { 0 };
+	int op, mode, i, pct;
+
+	assert(items && nodes);
+	printf("Set benchmark with 2 trees of about %d items, %d threads:\n",
+	       size, threads);
+
+	for (op = 0; op < 3; op++) {
+		for (mode = 0; mode < 3; mode++) {
+			bench_set_fill(&tree, &other, items, nodes, keys);
+			bench_set_create(&rest);
+
+			start = now_ns();
+			if (mode == 0)
+				bench_set_each(&tree, &other, &rest, op);
+			else if (mode == 1)
+				set_ops[op](&tree, &other, &rest);
+			else
+				bench_set_parallel(&tree, &other, &rest, op,
+						   threads, keys);
+			ns = now_ns() - start;
+
+			if (mode == 0) {
+				numnodes[0] = avl_numnodes(&tree);
+				numnodes[1] = avl_numnodes(&other);
+				numnodes[2] = avl_numnodes(&rest);
+			}
+			assert(numnodes[0] == avl_numnodes(&tree) &&
+			       numnodes[1] == avl_numnodes(&other) &&
+			       numnodes[2] == avl_numnodes(&rest));
+
+			printf("%-10s %-8s %7.1f ns/item (%lu items)\n",
+			       set_names[op], modes[mode], (double)ns / keys,
+			       numnodes[0]);
+			bench_range_clear(&tree);
+			bench_range_clear(&other);
+			bench_range_clear(&rest);
+		}
+	}
+
+	for (pct = 1; pct <= 50; pct += 49) {
+		bench_set_fill(&tree, &other, items, nodes, keys);
+		bench_set_create(&upper);
+		pivot.q_item_value = keys - (long long)keys * pct / 100;
+		start = now_ns();
+		for (i = 0; i < 100; i++) {
+			if ((item = avl_split(&tree, &pivot, &tree, &upper)))
+				avl_add(&upper, item);
+			avl_join(&tree, &upper);
+		}
+		ns = now_ns() - start;
+		printf("split+join %2d%%     %7.1f us\n", pct, ns / 100 / 1000.0);
+		bench_range_clear(&tree);
+		bench_range_clear(&other);
+		avl_destroy(&upper);
+	}
+
+	free(nodes);
+	free(items);
+	return 0;
+}
+
+/*
+ * For bench_mt, keys are in [0, bench_mt_keys).
+ */
+static int bench_mt_keys;
+
+static int
+bench_mt_shard (const void *item)
+{
+	int value = ((const queue_item_t *)item)->q_item_value;
+
+	return (long long)value * BENCH_MT_SHARDS / bench_mt_keys;
+}
+
+/*
+ * The map is either an avl_mt_tree_t, or, as what it replaces, a single
+ * tree behind a global mutex.
+ */
+typedef struct bench_mt_map {
+	int		use_mt;
+	avl_mt_tree_t	mt;
+	pthread_mutex_t	lock;
+	avl_tree_t	tree;
+} bench_mt_map_t;
+
+typedef struct bench_mt_worker {
+	pthread_t	thread;
+	bench_mt_map_t	*map;
+	queue_item_t	*items;
+	int		write_pct;
+	int		ops;
+	unsigned int	seed;
+	long long	found;
+} bench_mt_worker_t;
+
+static int
+bench_mt_find (bench_mt_map_t *map, queue_item_t *probe, queue_item_t *copy)
+{
+	queue_item_t *item;
+
+	if (map->use_mt)
+		return avl_mt_find(&map->mt, probe, copy);
+
+	pthread_mutex_lock(&map->lock);
+	item = avl_find(&map->tree, probe, NULL);
+	if (item)
+		*copy = *item;
+	pthread_mutex_unlock(&map->lock);
+	return item != NULL;
+}
+
+static void
+bench_mt_add (bench_mt_map_t *map, queue_item_t *item)
+{
+	avl_index_t where;
+
+	if (map->use_mt) {
+		avl_mt_add(&map->mt, item);
+		return;
+	}
+
+	pthread_mutex_lock(&map->lock);
+	if (!avl_find(&map->tree, item, &where))
+		avl_insert(&map->tree, item, where);
+	pthread_mutex_unlock(&map->lock);
+}
+
+static void
+bench_mt_remove (bench_mt_map_t *map, queue_item_t *probe)
+{
+	queue_item_t *item;
+
+	if (map->use_mt) {
+		avl_mt_remove(&map->mt, probe);
+		return;
+	}
+
+	pthread_mutex_lock(&map->lock);
+	item = avl_find(&map->tree, probe, NULL);
+	if (item)
+		avl_remove(&map->tree, item);
+	pthread_mutex_unlock(&map->lock);
+}
+
+/*
+ * Random lookups, with "write_pct" percent of them replaced by adding or
+ * removing the item of a random key, half each.
+ */
+static void *
+bench_mt_worker (void *arg)
+{
+	bench_mt_worker_t *worker = arg;
+	unsigned int x = worker->seed;
+	queue_item_t probe, copy;
+	int i, key, pct;
+
+	for (i = 0; i < worker->ops; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		key = x % bench_mt_keys;
+		pct = (x >> 8) % 200;
+		probe.q_item_value = key;
+
+		if (pct < worker->write_pct) {
+			bench_mt_add(worker->map, &worker->items[key]);
+		} else if (pct < 2 * worker->write_pct) {
+			bench_mt_remove(worker->map, &probe);
+		} else if (bench_mt_find(worker->map, &probe, &copy)) {
+			if (copy.q_item_value != key) {
+				printf("bench_mt: found %d for key %d\n",
+				       copy.q_item_value, key);
+				exit(1);
+			}
+			worker->found++;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+bench_mt_run (const char *name, int use_mt, int write_pct, int threads,
+	      queue_item_t *items)
+{
+	bench_mt_worker_t *workers = alloc(sizeof(*workers) * threads);
+	bench_mt_map_t map;
+	queue_item_t *item;
+	long long start, run_ns, found = 0;
+	ulong_t numnodes;
+	void *cookie = NULL;
+	int i;
+
+	assert(workers);
+	map.use_mt = use_mt;
+	if (use_mt) {
+		i = avl_mt_create(&map.mt, &value_compare_fn,
+				  sizeof(queue_item_t),
+				  offsetof(queue_item_t, q_item_link),
+				  BENCH_MT_SHARDS, &bench_mt_shard);
+		assert(i == 0);
+	} else {
+		pthread_mutex_init(&map.lock, NULL);
+		avl_create(&map.tree, &value_compare_fn, sizeof(queue_item_t),
+			   offsetof(queue_item_t, q_item_link));
+	}
+
+	/* Start with every other key */
+	for (i = 0; i < bench_mt_keys; i += 2)
+		bench_mt_add(&map, &items[i]);
+
+	for (i = 0; i < threads; i++) {
+		workers[i].map = &map;
+		workers[i].items = items;
+		workers[i].write_pct = write_pct;
+		workers[i].ops = BENCH_MT_OPS / threads;
+		workers[i].seed = 2463534242u + i * 7919;
+	}
+
+	start = now_ns();
+	for (i = 1; i < threads; i++)
+		pthread_create(&workers[i].thread, NULL, bench_mt_worker,
+			       &workers[i]);
+	bench_mt_worker(&workers[0]);
+	for (i = 1; i < threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	run_ns = now_ns() - start;
+
+	for (i = 0; i < threads; i++)
+		found += workers[i].found;
+
+	if (use_mt) {
+		numnodes = avl_mt_numnodes(&map.mt);
+		while ((item = avl_mt_destroy_nodes(&map.mt, &cookie)))
+			numnodes--;
+		avl_mt_destroy(&map.mt);
+	} else {
+		numnodes = avl_numnodes(&map.tree);
+		while ((item = avl_destroy_nodes(&map.tree, &cookie)))
+			numnodes--;
+		avl_destroy(&map.tree);
+		pthread_mutex_destroy(&map.lock);
+	}
+	assert(numnodes == 0);
+	free(workers);
+
+	printf("%-6s %-11s %7.2f Mops/s (%lld found)\n", name,
+	       write_pct < 25 ? "read-heavy" : "write-heavy",
+	       BENCH_MT_OPS / threads * threads * 1000.0 / run_ns, found);
+}
+
+/*
+ * Compare the concurrent map with a tree behind a global mutex, with 5%
+ * and 50% of writes.
+ */
+static int
+bench_mt (int threads, int size)
+{
+	queue_item_t *items;
+	int i;
+
+	bench_mt_keys = size * 2;
+	items = alloc(sizeof(*items) * bench_mt_keys);
+	assert(items);
+	for (i = 0; i < bench_mt_keys; i++)
+		items[i].q_item_value = i;
+
+	printf("Concurrent map benchmark with %d threads, %d keys, "
+	       "%d shards:\n", threads, bench_mt_keys, BENCH_MT_SHARDS);
+	bench_mt_run("mutex", 0, 5, threads, items);
+	bench_mt_run("avl_mt", 1, 5, threads, items);
+	bench_mt_run("mutex", 0, 50, threads, items);
+	bench_mt_run("avl_mt", 1, 50, threads, items);
+
+	free(items);
+	return 0;
+}
+
+/*
+ * Time a restart: the tree of "size" items is rebuilt from scratch by
+ * adding them in random order, then saved to a snapshot and loaded back.
+ * Reading the file alone is timed too, as what loading should come close
+ * to. The file is likely in the page cache, so this is the warm case.
+ */
+static int
+bench_snap (int size, const char *path)
+{
+	int *order = alloc(sizeof(int) * size);
+	queue_item_t *item, *prev;
+	avl_tree_t tree;
+	void *storage, *cookie;
+	long long start, ns;
+	char *buf;
+	ssize_t len;
+	off_t total;
+	int i, j, tmp, fd;
+
+	assert(order);
+	for (i = 0; i < size; i++)
+		order[i] = i;
+	srand(1);
+	for (i = size - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	avl_create(&tree, &value_compare_fn, sizeof(queue_item_t),
+		   offsetof(queue_item_t, q_item_link));
+	printf("Snapshot benchmark with %d items, in %s:\n", size, path);
+
+	start = now_ns();
+	for (i = 0; i < size; i++) {
+		item = alloc(sizeof(*item));
+		assert(item);
+		item->q_item_value = order[i];
+		avl_add(&tree, item);
+	}
+	ns = now_ns() - start;
+	printf("%-8s %8.1f ms\n", "rebuild", ns / 1e6);
+
+	start = now_ns();
+	assert(avl_snap_save(&tree, path) == 0);
+	ns = now_ns() - start;
+	printf("%-8s %8.1f ms\n", "save", ns / 1e6);
+
+	cookie = NULL;
+	while ((item = avl_destroy_nodes(&tree, &cookie)))
+		free(item);
+	avl_destroy(&tree);
+
+	buf = malloc(BENCH_SNAP_BUFSIZE);
+	assert(buf);
+	total = 0;
+	start = now_ns();
+	fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	while ((len = read(fd, buf, BENCH_SNAP_BUFSIZE)) > 0)
+		total += len;
+	close(fd);
+	ns = now_ns() - start;
+	free(buf);
+	printf("%-8s %8.1f ms (%lld bytes)\n", "read", ns / 1e6,
+	       (long long)total);
+
+	avl_create(&tree, &value_compare_fn, sizeof(queue_item_t),
+		   offsetof(queue_item_t, q_item_link));
+	start = now_ns();
+	assert(avl_snap_load(&tree, path, &storage) == 0);
+	ns = now_ns() - start;
+	printf("%-8s %8.1f ms\n", "load", ns / 1e6);
+
+	assert(avl_numnodes(&tree) == size);
+	prev = NULL;
+	for (item = avl_first(&tree); item; item = AVL_NEXT(&tree, item)) {
+		assert(!prev || prev->q_item_value < item->q_item_value);
+		prev = item;
+	}
+
+	cookie = NULL;
+	while (avl_destroy_nodes(&tree, &cookie))
+		;
+	avl_destroy(&tree);
+	free(storage);
+	unlink(path);
+	free(order);
+	return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -62,6 +982,27 @@ main(int argc, char *argv[])
 	if (argc == 1)
 		usage();
 
+	if (!strcmp(argv[1], "bench"))
+		return bench(argc > 2 ? atoi(argv[2]) : BENCH_SIZE);
+
+	if (!strcmp(argv[1], "bench_range"))
+		return bench_range(argc > 2 ? atoi(argv[2]) : BENCH_SIZE);
+
+	if (!strcmp(argv[1], "bench_rank"))
+		return bench_rank(argc > 2 ? atoi(argv[2]) : BENCH_SIZE);
+
+	if (!strcmp(argv[1], "bench_set"))
+		return bench_set(argc > 2 ? atoi(argv[2]) : BENCH_SET_THREADS,
+				 argc > 3 ? atoi(argv[3]) : BENCH_SIZE);
+
+	if (!strcmp(argv[1], "bench_mt"))
+		return bench_mt(argc > 2 ? atoi(argv[2]) : BENCH_MT_THREADS,
+				argc > 3 ? atoi(argv[3]) : BENCH_SIZE);
+
+	if (!strcmp(argv[1], "bench_snap"))
+		return bench_snap(argc > 2 ? atoi(argv[2]) : BENCH_SIZE,
+				  argc > 3 ? argv[3] : BENCH_SNAP_FILE);
+
 	index = 1;
 	printf("Constructing the tree...\n");
 	while (index < argc) {
@@ -1,6 +1,8 @@
 #ifndef __TYPES_H__
 #define __TYPES_H__
 
+#include <stdint.h>
+
 #define    ASSERT          assert
 #define    B_TRUE          (1)
 #define    B_FALSE         (0)
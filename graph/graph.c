@@ -7,7 +7,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <string.h>
+#include <pthread.h>
 #include "graph.h"
 
 /*********************************
@@ -63,7 +65,7 @@ void adj_link_add(AdjList *list, Element e1, Element e2)
 }
 
 /* Create an adjacency list with size */
-static AdjList *adj_list_new(uint64_t size)
+AdjList *adj_list_new(uint64_t size)
 {
     AdjList *list = calloc(1, sizeof(AdjList));
 
@@ -96,7 +98,7 @@ void adj_list_dump(AdjList *list)
     }
 }
 
-static int file_size(const char *file_name)
+static off_t file_size(const char *file_name)
 {
     struct stat st;
 
@@ -106,40 +108,159 @@ static int file_size(const char *file_name)
         return -1;
 }
 
+/*
+ * Map the whole input file read-only, and put its size into *size.
+ * Return NULL if failed.
+ */
+static const char *map_input(const char *input, size_t *size)
+{
+    off_t len = file_size(input);
+    int fd;
+    void *buf;
+
+    if (len <= 0)
+        return NULL;
+
+    fd = open(input, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED)
+        return NULL;
+
+    madvise(buf, len, MADV_SEQUENTIAL);
+    *size = len;
+
+    return buf;
+}
+
+/*
+ * Both the text parser and the binary CSR files below assume little
+ * endian words.  CSR_BIN_NATIVE tells whether that's the host order.
+ */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CSR_BIN_NATIVE  (true)
+#define cpu_to_le64(x)  (x)
+#define cpu_to_le32(x)  (x)
+#else
+#define CSR_BIN_NATIVE  (false)
+#define cpu_to_le64(x)  __builtin_bswap64(x)
+#define cpu_to_le32(x)  __builtin_bswap32(x)
+#endif
+#define le64_to_cpu(x)  cpu_to_le64(x)
+#define le32_to_cpu(x)  cpu_to_le32(x)
+
+static const uint64_t pow10_table[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+};
+
+/*
+ * Convert 8 decimal digits at once.  Each byte of `val' holds one
+ * digit (0-9), with the most significant digit in the lowest byte.
+ */
+static inline uint64_t decode_8digits(uint64_t val)
+{
+    /* Combine adjacent digits into 2, 4, then 8 digit numbers */
+    val = (val * 10 + (val >> 8)) & 0x00ff00ff00ff00ffULL;
+    val = (val * 100 + (val >> 16)) & 0x0000ffff0000ffffULL;
+    val = (val * 10000 + (val >> 32)) & 0x00000000ffffffffULL;
+
+    return val;
+}
+
+/*
+ * Decode the decimal number at *buf and move *buf forward over it.
+ * Digits are taken 8 bytes a time as long as there are 8 bytes before
+ * `end', then one by one.
+ */
+static inline uint64_t decode_uint64(const char **buf, const char *end)
+{
+    const char *p = *buf;
+    uint64_t val = 0, chunk, mask;
+    int len = 8;
+
+    while (len == 8 && end - p >= 8) {
+        memcpy(&chunk, p, 8);
+        /* The first character must be in the lowest byte */
+        chunk = le64_to_cpu(chunk);
+        chunk ^= 0x3030303030303030ULL;
+        /* High bit is set for the bytes that are not a digit */
+        mask = ((chunk + 0x7676767676767676ULL) | chunk) &
+            0x8080808080808080ULL;
+        len = mask ? __builtin_ctzll(mask) / 8 : 8;
+        if (len) {
+            /* Drop the bytes after the digits, as leading zeros */
+            val = val * pow10_table[len] +
+                decode_8digits(chunk << (64 - len * 8));
+            p += len;
+        }
+    }
+
+    if (len == 8) {
+        while (p < end && (unsigned char)(*p - '0') < 10) {
+            val = val * 10 + (*p++ - '0');
+        }
+    }
+
+    *buf = p;
+
+    return val;
+}
+
 /*
  * Return the uint64 value pointed by *buf and move *buf forward.  This
  * will move the *buf pointer!
  */
-static void read_uint64(char **buf, uint64_t *val)
+static void read_uint64(const char **buf, const char *end, uint64_t *val)
 {
-    char *old = *buf;
+    const char *old = *buf;
 
-    *val = strtoul(*buf, buf, 10);
+    *val = decode_uint64(buf, end);
     /* Make sure buf moved */
     assert(old != *buf);
     /* Move over "\n" */
-    assert(**buf == '\n');
+    assert(*buf < end && **buf == '\n');
     *buf += 1;
 }
 
-static void read_uint64_pair(char **buf, uint64_t *val1, uint64_t *val2)
+/*
+ * Read one link as "e1,e2" or "e1,e2,weight".  The weight is 1 if not
+ * specified.  Return true if the weight is specified.
+ */
+static bool read_link(const char **buf, const char *end,
+                      uint64_t *val1, uint64_t *val2, uint64_t *weight)
 {
-    char *old = *buf;
+    const char *old = *buf;
+    bool weighted = false;
 
-    *val1 = strtoul(*buf, buf, 10);
+    *val1 = decode_uint64(buf, end);
     /* Make sure buf moved */
     assert(old != *buf);
-    /* Move over "\n" */
-    assert(**buf == ',');
+    /* Move over "," */
+    assert(*buf < end && **buf == ',');
     *buf += 1;
 
     old = *buf;
-    *val2 = strtoul(*buf, buf, 10);
+    *val2 = decode_uint64(buf, end);
     /* Make sure buf moved */
     assert(old != *buf);
+
+    *weight = 1;
+    if (*buf < end && **buf == ',') {
+        *buf += 1;
+        old = *buf;
+        *weight = decode_uint64(buf, end);
+        assert(old != *buf);
+        weighted = true;
+    }
+
     /* Move over "\n" */
-    assert(**buf == '\n');
+    assert(*buf < end && **buf == '\n');
     *buf += 1;
+
+    return weighted;
 }
 
 typedef void *(*InitOp)(uint64_t size);
@@ -148,35 +269,27 @@ typedef void (*AddPairOp)(void *data, Element e1, Element e2);
 static void *parse_from_input(const char *input, InitOp init_op,
                               AddPairOp add_op)
 {
-    int fd = open(input, O_RDONLY);
-    int ret, size;
-    char *buf, *p;
-    uint64_t val, val2;
+    const char *buf, *p, *end;
+    uint64_t val, val2, weight;
+    size_t size;
     void *list;
 
-    if (fd < 0)
+    buf = map_input(input, &size);
+    if (!buf)
         return NULL;
 
-    size = file_size(input);
-    p = buf = calloc(1, size + 1);
-
-    do {
-        ret = read(fd, p, size);
-        assert(ret > 0);
-        p += ret;
-        size -= ret;
-    } while (size);
-
     p = buf;
-    read_uint64(&p, &val);
+    end = buf + size;
+    read_uint64(&p, end, &val);
     list = init_op(val);
 
-    while (*p) {
-        read_uint64_pair(&p, &val, &val2);
+    while (p < end) {
+        /* Weights are not used */
+        read_link(&p, end, &val, &val2, &weight);
         add_op(list, val, val2);
     }
 
-    free(buf);
+    munmap((void *)buf, size);
 
     return list;
 }
@@ -207,350 +320,2230 @@ AdjList *adj_dir_list_from_input(const char *path)
     return parse_from_input(path, adj_list_init_op, adj_list_add_single_op);
 }
 
-/*****************************
- * Union Find Implementation *
- *****************************/
+/****************************************
+ * Compressed Sparse Row Implementation *
+ ****************************************/
 
-void uf_free(UnionFind *uf)
-{
-    uint64_t i, j, size = uf->size;
-    Link *head, *next;
+/*
+ * The input is parsed twice.  The first pass counts the links of each
+ * element, the second one puts the links.  When parsing in threads, the
+ * input is split into one chunk of lines for each thread, and each
+ * thread counts into its own array.  The counts are then turned into
+ * the positions where each thread puts its links, so that no thread
+ * shares any counter with another, and the result is the same no
+ * matter how many threads are used.
+ */
+typedef struct {
+    CsrGraph *graph;
+    /*
+     * Number of links of each element in the 1st pass, then position
+     * where to put the next link of each element, backward
+     */
+    uint64_t *counts;
+    const char *start, *end;
+    bool dir, fill;
+    /* Whether any weight is found in the 1st pass */
+    bool weighted;
+    /* Number of links parsed */
+    uint64_t count;
+    pthread_t thread;
+} CsrParser;
 
-    /* This is only to free up the link_array[] */
-    for (i = 0; i < size; i++) {
-        head = uf->link_array[i];
-        /*
-         * Loop over each of the element, reset the uf link_array pointer
-         * and also release each of the Link structure.  If head==NULL, it
-         * means we've freed it before, so continue
-         */
-        while (head) {
-            uf->link_array[head->e] = NULL;
-            next = head->next;
-            free(head);
-            head = next;
+/*
+ * Links are parsed into a small batch (of e1, e2 and weight for each)
+ * before being applied: updating
+ * the counters are mostly cache misses, and doing them in a tight loop
+ * lets the CPU overlap them, instead of waiting for each of them in
+ * the middle of parsing.
+ */
+#define CSR_PARSER_BATCH  (1024)
+#define CSR_PREFETCH      (16)
+/*
+ * Default number of parsing threads at most.  Each thread has its own
+ * counter per element, and they are all summed up serially, so both
+ * memory and the prefix pass grow as O(threads * V).  Parsing is bound
+ * by memory bandwidth well before this many threads anyway.
+ */
+#define CSR_PARSER_MAX_THREADS  (8)
+
+static void csr_parser_apply(CsrParser *parser, Element *batch, int n)
+{
+    Element *edges = parser->graph->edges;
+    Weight *weights = parser->graph->weights;
+    uint64_t *counts = parser->counts, pos;
+    Element e1, e2;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (i + CSR_PREFETCH < n) {
+            __builtin_prefetch(&counts[batch[(i + CSR_PREFETCH) * 3]], 1);
+            if (!parser->dir)
+                __builtin_prefetch(&counts[batch[(i + CSR_PREFETCH) * 3 + 1]],
+                                   1);
+        }
+        e1 = batch[i * 3];
+        e2 = batch[i * 3 + 1];
+        if (parser->fill) {
+            pos = --counts[e1];
+            edges[pos] = e2;
+            if (weights)
+                weights[pos] = batch[i * 3 + 2];
+            if (parser->dir)
+                continue;
+            pos = --counts[e2];
+            edges[pos] = e1;
+            if (weights)
+                weights[pos] = batch[i * 3 + 2];
+        } else {
+            counts[e1]++;
+            if (!parser->dir)
+                counts[e2]++;
         }
     }
-
-    free(uf->link_array);
-    free(uf);
 }
 
-/* Whether the two elements are connected? */
-bool uf_connected(UnionFind *uf, Element e1, Element e2)
+static void *csr_parser_fn(void *opaque)
 {
-    return uf->link_array[e1] == uf->link_array[e2];
+    CsrParser *parser = opaque;
+    CsrGraph *graph = parser->graph;
+    const char *p = parser->start;
+    Element batch[CSR_PARSER_BATCH * 3], e1, e2;
+    Weight weight;
+    int n = 0;
+
+    parser->count = 0;
+    while (p < parser->end) {
+        parser->weighted |= read_link(&p, parser->end, &e1, &e2, &weight);
+        assert(e1 < graph->size);
+        assert(e2 < graph->size);
+        assert(parser->dir || e1 != e2);
+        batch[n * 3] = e1;
+        batch[n * 3 + 1] = e2;
+        batch[n * 3 + 2] = weight;
+        if (++n == CSR_PARSER_BATCH) {
+            csr_parser_apply(parser, batch, n);
+            parser->count += n;
+            n = 0;
+        }
+    }
+    csr_parser_apply(parser, batch, n);
+    parser->count += n;
+
+    return NULL;
 }
 
-static void *uf_init_op(uint64_t size)
+/* Run one pass of all the parsers, the current thread runs the 1st */
+static void csr_parsers_run(CsrParser *parsers, int threads, bool fill)
 {
-    UnionFind *uf = calloc(1, sizeof(UnionFind));
-    uint64_t i;
-    Link *link;
-
-    uf->size = size;
-    uf->unions = size;
-    uf->link_array = calloc(size, sizeof(Link *));
+    int i;
 
-    for (i = 0; i < size; i++) {
-        link = calloc(1, sizeof(Link));
-        link->e = i;
-        link->next = NULL;
-        uf->link_array[i] = link;
+    for (i = 0; i < threads; i++) {
+        parsers[i].fill = fill;
+        if (i)
+            pthread_create(&parsers[i].thread, NULL, csr_parser_fn,
+                           &parsers[i]);
+    }
+    csr_parser_fn(&parsers[0]);
+    for (i = 1; i < threads; i++) {
+        pthread_join(parsers[i].thread, NULL);
     }
-
-    return uf;
 }
 
-static void uf_add_op(void *data, Element e1, Element e2)
+static CsrGraph *csr_parse_mt(const char *input, bool dir, int threads)
 {
-    UnionFind *uf = data;
-    Link *head, *tail, *link;
-
-    /* If the two elements are already connected?  Nothing else to do! */
-    if (uf_connected(uf, e1, e2))
-        return;
+    CsrParser *parsers;
+    CsrGraph *graph;
+    const char *buf, *p, *end;
+    uint64_t i, size, n, count = 0;
+    bool weighted = false;
+    size_t len;
+    int t;
+
+    buf = map_input(input, &len);
+    if (!buf)
+        return NULL;
 
-    head = uf->link_array[e1];
-    link = uf->link_array[e2];
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads > CSR_PARSER_MAX_THREADS)
+            threads = CSR_PARSER_MAX_THREADS;
+    }
 
-    /* Find the tail of e1 link */
-    tail = head;
-    while (tail->next)
-        tail = tail->next;
+    p = buf;
+    end = buf + len;
+    read_uint64(&p, end, &size);
+
+    graph = calloc(1, sizeof(CsrGraph));
+    graph->size = size;
+    graph->offsets = malloc((size + 1) * sizeof(uint64_t));
+
+    /* Split the lines evenly, each chunk ends right after a "\n" */
+    parsers = calloc(threads, sizeof(CsrParser));
+    for (t = 0; t < threads; t++) {
+        parsers[t].graph = graph;
+        parsers[t].dir = dir;
+        parsers[t].counts = calloc(size, sizeof(uint64_t));
+        parsers[t].start = p;
+        p = p + (end - p) / (threads - t);
+        while (p < end && p[-1] != '\n')
+            p++;
+        parsers[t].end = p;
+    }
 
-    /* Connect the two links for e1 and e2 */
-    tail->next = link;
+    csr_parsers_run(parsers, threads, false);
 
-    /* Update each element in old e2's union to point to e1's head link */
-    do {
-        uf->link_array[link->e] = head;
-        link = link->next;
-    } while (link);
+    for (t = 0; t < threads; t++) {
+        count += parsers[t].count;
+        weighted |= parsers[t].weighted;
+    }
+    graph->nr_edges = dir ? count : count * 2;
+    graph->edges = malloc((graph->nr_edges + 1) * sizeof(Element));
+    if (weighted)
+        graph->weights = malloc((graph->nr_edges + 1) * sizeof(Weight));
 
     /*
-     * Accounting for the total unions count.  Since we just merged two,
-     * total unions will decrease by 1
+     * Links are filled in backward, so that the latest link comes
+     * first, which is the same as AdjList.  So the 1st thread, which
+     * has the earliest lines, puts its links at the end of each
+     * element.
      */
-    uf->unions--;
+    graph->offsets[0] = 0;
+    for (i = 0; i < size; i++) {
+        n = graph->offsets[i];
+        for (t = 0; t < threads; t++) {
+            n += parsers[t].counts[i];
+        }
+        graph->offsets[i + 1] = n;
+        for (t = 0; t < threads; t++) {
+            n -= parsers[t].counts[i];
+            parsers[t].counts[i] += n;
+        }
+    }
 
-    /* Now they must be connected, or what? */
-    assert(uf_connected(uf, e1, e2));
+    csr_parsers_run(parsers, threads, true);
+
+    for (t = 0; t < threads; t++) {
+        free(parsers[t].counts);
+    }
+    free(parsers);
+    munmap((void *)buf, len);
+
+    return graph;
 }
 
-/* Create a UF with data specified in file `path' */
-UnionFind *uf_from_input(const char *path)
+CsrGraph *csr_from_input(const char *path)
 {
-    return parse_from_input(path, uf_init_op, uf_add_op);
+    return csr_parse_mt(path, false, 1);
 }
 
-/* How many unions are there? */
-uint64_t uf_count(UnionFind *uf)
+CsrGraph *csr_dir_from_input(const char *path)
 {
-    return uf->unions;
+    return csr_parse_mt(path, true, 1);
 }
 
-/* Loop over the union elements that owns `e' */
-void uf_union_foreach(UnionFind *uf, Element e, ElementOp op)
+CsrGraph *csr_from_input_mt(const char *path, int threads)
 {
-    Link *link = uf->link_array[e];
-
-    do {
-        op(link->e);
-        link = link->next;
-    } while (link);
+    return csr_parse_mt(path, false, threads);
 }
 
-/**********************
- * Depth First Search *
- **********************/
-
-static void dfs_iter(AdjList *list, bool *marked, Element e)
+CsrGraph *csr_dir_from_input_mt(const char *path, int threads)
 {
-    Link *link;
+    return csr_parse_mt(path, true, threads);
+}
 
-    /* If detected, stop here */
-    if (marked[e]) {
-        return;
+/* When returned, the `graph' pointer will be invalid */
+void csr_free(CsrGraph *graph)
+{
+    if (graph->map) {
+        munmap(graph->map, graph->map_size);
+    } else {
+        free(graph->offsets);
+        free(graph->edges);
+        free(graph->weights);
     }
+    free(graph);
+}
 
-    marked[e] = true;
-    link = list->link_array[e];
-    while (link) {
-        dfs_iter(list, marked, link->e);
-        link = link->next;
+void csr_dump(CsrGraph *graph)
+{
+    uint64_t i, j;
+
+    for (i = 0; i < graph->size; i++) {
+        printf("%"PRIu64": ", i);
+        for (j = graph->offsets[i]; j < graph->offsets[i + 1]; j++) {
+            printf("%"PRIu64, graph->edges[j]);
+            if (graph->weights)
+                printf(" (%"PRIu64")", graph->weights[j]);
+            printf(", ");
+        }
+        if (graph->offsets[i] != graph->offsets[i + 1])
+            /* Erase the last ", " */
+            printf("\b\b  \b\b");
+        printf("\n");
     }
 }
 
-void dfs_foreach(AdjList *list, Element e, ElementOp op)
+CsrGraph *csr_reverse(CsrGraph *graph)
 {
-    bool *marked = calloc(list->size, sizeof(bool));
-    Element i;
+    CsrGraph *reverse = calloc(1, sizeof(CsrGraph));
+    uint64_t *pos, i, j;
+    Element e;
 
-    /* Generate the marked array using depth-first search */
-    dfs_iter(list, marked, e);
+    reverse->size = graph->size;
+    reverse->nr_edges = graph->nr_edges;
+    reverse->offsets = calloc(graph->size + 1, sizeof(uint64_t));
+    reverse->edges = malloc((graph->nr_edges + 1) * sizeof(Element));
+    if (graph->weights)
+        reverse->weights = malloc((graph->nr_edges + 1) * sizeof(Weight));
 
-    for (i = 0; i < list->size; i++) {
-        if (marked[i])
-            op(i);
+    for (i = 0; i < graph->nr_edges; i++) {
+        reverse->offsets[graph->edges[i] + 1]++;
+    }
+    for (i = 0; i < graph->size; i++) {
+        reverse->offsets[i + 1] += reverse->offsets[i];
     }
 
-    free(marked);
+    /*
+     * Keep the links of each element sorted by where they come from.
+     * Both pos[] and the place to put the link are mostly cache misses,
+     * so they are prefetched in two steps ahead.
+     */
+    pos = malloc(graph->size * sizeof(uint64_t));
+    memcpy(pos, reverse->offsets, graph->size * sizeof(uint64_t));
+    for (i = 0, j = 0; j < graph->nr_edges; j++) {
+        if (j + CSR_PREFETCH * 2 < graph->nr_edges)
+            __builtin_prefetch(&pos[graph->edges[j + CSR_PREFETCH * 2]], 1);
+        if (j + CSR_PREFETCH < graph->nr_edges) {
+            e = graph->edges[j + CSR_PREFETCH];
+            __builtin_prefetch(&reverse->edges[pos[e]], 1);
+        }
+        while (graph->offsets[i + 1] == j)
+            i++;
+        if (graph->weights)
+            reverse->weights[pos[graph->edges[j]]] = graph->weights[j];
+        reverse->edges[pos[graph->edges[j]]++] = i;
+    }
+    free(pos);
+
+    return reverse;
 }
 
-typedef struct {
-    /* Used by both DFS and BFS */
-    AdjList *list;
-    bool *marked;
-    Element target;
+/**************************
+ * CSR Binary File Format *
+ **************************/
 
-    /* Only used by DFS */
-    ElementOp op;
+/*
+ * The file is the header, then the offsets array (size + 1 entries),
+ * then the edges array (nr_edges entries), then the weights array
+ * (nr_edges entries) if CSR_BIN_WEIGHTED is set.  All fields are
+ * 64-bit little endian, so the arrays can be used from the mapped file
+ * directly on little endian hosts.
+ */
+#define CSR_BIN_MAGIC    "CSRGRAPH"
+#define CSR_BIN_VERSION  (1)
 
-    /* Only used in BFS */
-    bool *to_search;
-    bool *next_search;
-    Element *edge_to;
-} PathCtx;
+/* The graph has weights */
+#define CSR_BIN_WEIGHTED  (1U << 0)
 
-static bool dfs_path_iter(PathCtx *ctx, Element cur)
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    /* CSR_BIN_* flags */
+    uint32_t flags;
+    uint64_t size;
+    uint64_t nr_edges;
+} CsrBinHeader;
+
+static bool csr_bin_write(FILE *out, const uint64_t *array, uint64_t n)
 {
-    Link *link;
-    bool result;
-
-    /* This node is walked already */
-    if (ctx->marked[cur])
-        return false;
+    uint64_t buf[1024];
+    uint64_t i, len;
 
-    /* We've found it! */
-    if (cur == ctx->target) {
-        ctx->op(cur);
-        return true;
-    }
+    if (CSR_BIN_NATIVE)
+        return fwrite(array, sizeof(uint64_t), n, out) == n;
 
-    ctx->marked[cur] = true;
-    link = ctx->list->link_array[cur];
-    while (link) {
-        result = dfs_path_iter(ctx, link->e);
-        if (result) {
-            ctx->op(cur);
-            return true;
+    while (n) {
+        len = n < 1024 ? n : 1024;
+        for (i = 0; i < len; i++) {
+            buf[i] = cpu_to_le64(array[i]);
         }
-        link = link->next;
+        if (fwrite(buf, sizeof(uint64_t), len, out) != len)
+            return false;
+        array += len;
+        n -= len;
     }
 
-    return false;
+    return true;
 }
 
-bool dfs_path(AdjList *list, Element from, Element to, ElementOp op)
+int csr_save(CsrGraph *graph, const char *path)
 {
-    bool *marked = calloc(list->size, sizeof(bool));
-    PathCtx ctx = {
-        .list = list,
-        .marked = marked,
-        .target = from,
-        .op = op,
+    CsrBinHeader header = {
+        .magic = CSR_BIN_MAGIC,
+        .version = cpu_to_le32(CSR_BIN_VERSION),
+        .flags = cpu_to_le32(graph->weights ? CSR_BIN_WEIGHTED : 0),
+        .size = cpu_to_le64(graph->size),
+        .nr_edges = cpu_to_le64(graph->nr_edges),
     };
-    bool result;
+    FILE *out = fopen(path, "w");
+    bool ok;
 
-    /*
-     * Start searching from "to", so that the Op will be called in reversed
-     * order to form a path in the right order
-     */
-    result = dfs_path_iter(&ctx, to);
-    free(marked);
+    if (!out)
+        return -1;
 
-    return result;
+    ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+        csr_bin_write(out, graph->offsets, graph->size + 1) &&
+        csr_bin_write(out, graph->edges, graph->nr_edges) &&
+        (!graph->weights ||
+         csr_bin_write(out, graph->weights, graph->nr_edges));
+
+    if (fclose(out) || !ok) {
+        unlink(path);
+        return -1;
+    }
+
+    return 0;
 }
 
-static void dfs_order_iter(PathCtx *ctx, Element cur)
+/* Copy an array out of the file, for big endian hosts */
+static uint64_t *csr_bin_copy(const uint64_t *array, uint64_t n)
 {
-    Link *link;
+    uint64_t *copy = malloc((n + 1) * sizeof(uint64_t));
+    uint64_t i;
 
-    if (ctx->marked[cur])
-        return;
-    ctx->marked[cur] = true;
+    for (i = 0; i < n; i++) {
+        copy[i] = le64_to_cpu(array[i]);
+    }
 
-    link = ctx->list->link_array[cur];
+    return copy;
+}
 
-    while (link) {
-        dfs_order_iter(ctx, link->e);
-        link = link->next;
+/*
+ * Check that the offsets never decrease and that all the edges are
+ * valid elements, since nothing indexing the arrays checks them later.
+ */
+static bool csr_bin_check(const uint64_t *offsets, const uint64_t *edges,
+                          uint64_t size, uint64_t nr_edges)
+{
+    uint64_t i;
+
+    for (i = 0; i < size; i++) {
+        if (le64_to_cpu(offsets[i]) > le64_to_cpu(offsets[i + 1]))
+            return false;
+    }
+    for (i = 0; i < nr_edges; i++) {
+        if (le64_to_cpu(edges[i]) >= size)
+            return false;
     }
 
-    ctx->op(cur);
+    return true;
 }
 
-void dfs_order(AdjList *list, ElementOp op)
+CsrGraph *csr_load(const char *path)
 {
-    bool *marked = calloc(list->size, sizeof(bool));
-    PathCtx ctx = {
-        .list = list,
-        .marked = marked,
-        .op = op,
-    };
-    Element e;
+    const CsrBinHeader *header;
+    const uint64_t *offsets;
+    CsrGraph *graph;
+    uint64_t size, nr_edges, nr_weights;
+    uint32_t flags;
+    size_t len;
+    char *buf;
+
+    buf = (char *)map_input(path, &len);
+    if (!buf)
+        return NULL;
 
-    for (e = 0; e < list->size; e++) {
-        dfs_order_iter(&ctx, e);
+    header = (const CsrBinHeader *)buf;
+    if (len < sizeof(*header) ||
+        memcmp(header->magic, CSR_BIN_MAGIC, sizeof(header->magic)) ||
+        le32_to_cpu(header->version) != CSR_BIN_VERSION)
+        goto fail;
+
+    flags = le32_to_cpu(header->flags);
+    if (flags & ~CSR_BIN_WEIGHTED)
+        goto fail;
+
+    /* Make sure the arrays are all inside the file */
+    size = le64_to_cpu(header->size);
+    nr_edges = le64_to_cpu(header->nr_edges);
+    nr_weights = (flags & CSR_BIN_WEIGHTED) ? nr_edges : 0;
+    if (size >= len / sizeof(uint64_t) ||
+        nr_edges >= len / sizeof(uint64_t) ||
+        len != sizeof(*header) +
+        (size + 1 + nr_edges + nr_weights) * sizeof(uint64_t))
+        goto fail;
+
+    offsets = (const uint64_t *)(header + 1);
+    if (le64_to_cpu(offsets[0]) || le64_to_cpu(offsets[size]) != nr_edges ||
+        !csr_bin_check(offsets, offsets + size + 1, size, nr_edges))
+        goto fail;
+
+    /* Graph accesses are mostly random, unlike parsing */
+    madvise(buf, len, MADV_NORMAL);
+
+    graph = calloc(1, sizeof(CsrGraph));
+    graph->size = size;
+    graph->nr_edges = nr_edges;
+    if (CSR_BIN_NATIVE) {
+        graph->offsets = (uint64_t *)offsets;
+        graph->edges = (Element *)(offsets + size + 1);
+        if (nr_weights)
+            graph->weights = (Weight *)(graph->edges + nr_edges);
+        graph->map = buf;
+        graph->map_size = len;
+    } else {
+        graph->offsets = csr_bin_copy(offsets, size + 1);
+        graph->edges = csr_bin_copy(offsets + size + 1, nr_edges);
+        if (nr_weights)
+            graph->weights = csr_bin_copy(offsets + size + 1 + nr_edges,
+                                          nr_edges);
+        munmap(buf, len);
     }
-    free(marked);
+
+    return graph;
+
+fail:
+    munmap(buf, len);
+    return NULL;
 }
 
-/************************
- * Breadth First Search *
- ************************/
+/*****************************
+ * Union Find Implementation *
+ *****************************/
 
 /*
- * Try to search all elements set in ctx->to_search array to see whether we
- * found ctx->target.  If found, then good and we're done!  If not, update
- * ctx->to_search to reflect the next round of search and redo.
+ * Each union is a tree in the parent array, merged by rank and
+ * compressed (by path halving) when searched, so that all operations
+ * are almost O(1).  Elements of one union are also linked into a
+ * circular list with the next array, so that uf_union_foreach() does
+ * not need to scan all the elements.
  */
-bool bfs_path_iter(PathCtx *ctx)
+
+UnionFind *uf_new(uint64_t size)
 {
-    Element i, next_count = 0;
-    bool *to_search = ctx->to_search;
-    bool *next_search = ctx->next_search;
-    bool result;
-    Link *link;
+    UnionFind *uf = calloc(1, sizeof(UnionFind));
+    uint64_t i;
 
-    for (i = 0; i < ctx->list->size; i++) {
-        if (!to_search[i])
-            continue;
-        if (i == ctx->target)
-            /* We found it! */
-            return true;
-    }
+    uf->size = size;
+    uf->unions = size;
+    uf->parent = malloc(size * sizeof(Element));
+    uf->next = malloc(size * sizeof(Element));
+    uf->rank = calloc(size, sizeof(uint8_t));
 
-    /*
-     * Not found in current to_search direct links, try to establish the
-     * next level of to_search elements.
-     */
-    for (i = 0; i < ctx->list->size; i++) {
-        if (!to_search[i])
-            continue;
-        link = ctx->list->link_array[i];
-        while (link) {
-            if (!ctx->marked[link->e]) {
-                ctx->marked[link->e] = true;
-                next_search[link->e] = true;
-                ctx->edge_to[link->e] = i;
-                next_count++;
-            }
-            link = link->next;
-        }
+    for (i = 0; i < size; i++) {
+        uf->parent[i] = i;
+        uf->next[i] = i;
     }
 
-    /*
-     * Copy over the next level search elements into the global one, so
-     * that we can reset the temp one.
-     */
-    memcpy(to_search, next_search, ctx->list->size * sizeof(bool));
-    memset(next_search, 0, sizeof(bool) * ctx->list->size);
-
+    return uf;
+}
+
+void uf_free(UnionFind *uf)
+{
+    free(uf->parent);
+    free(uf->next);
+    free(uf->rank);
+    free(uf);
+}
+
+/* Find the root of the union that owns `e' */
+Element uf_find(UnionFind *uf, Element e)
+{
+    Element *parent = uf->parent;
+
+    assert(e < uf->size);
+
+    while (parent[e] != e) {
+        /* Path halving: point to the grandparent while walking up */
+        parent[e] = parent[parent[e]];
+        e = parent[e];
+    }
+
+    return e;
+}
+
+/* Whether the two elements are connected? */
+bool uf_connected(UnionFind *uf, Element e1, Element e2)
+{
+    return uf_find(uf, e1) == uf_find(uf, e2);
+}
+
+/* Merge the unions owning e1 and e2 */
+void uf_union(UnionFind *uf, Element e1, Element e2)
+{
+    Element r1 = uf_find(uf, e1), r2 = uf_find(uf, e2), tmp;
+
+    /* If the two elements are already connected?  Nothing else to do! */
+    if (r1 == r2)
+        return;
+
+    /* Attach the lower tree under the higher one */
+    if (uf->rank[r1] < uf->rank[r2]) {
+        tmp = r1;
+        r1 = r2;
+        r2 = tmp;
+    }
+    uf->parent[r2] = r1;
+    if (uf->rank[r1] == uf->rank[r2])
+        uf->rank[r1]++;
+
+    /* Swapping the next pointers joins the two circular lists */
+    tmp = uf->next[r1];
+    uf->next[r1] = uf->next[r2];
+    uf->next[r2] = tmp;
+
+    /*
+     * Accounting for the total unions count.  Since we just merged two,
+     * total unions will decrease by 1
+     */
+    uf->unions--;
+}
+
+static void *uf_init_op(uint64_t size)
+{
+    return uf_new(size);
+}
+
+static void uf_add_op(void *data, Element e1, Element e2)
+{
+    uf_union(data, e1, e2);
+}
+
+/* Create a UF with data specified in file `path' */
+UnionFind *uf_from_input(const char *path)
+{
+    return parse_from_input(path, uf_init_op, uf_add_op);
+}
+
+/* How many unions are there? */
+uint64_t uf_count(UnionFind *uf)
+{
+    return uf->unions;
+}
+
+/* Loop over the union elements that owns `e' */
+void uf_union_foreach(UnionFind *uf, Element e, ElementOp op)
+{
+    Element cur = e;
+
+    assert(e < uf->size);
+
+    do {
+        op(cur);
+        cur = uf->next[cur];
+    } while (cur != e);
+}
+
+/****************************************
+ * Concurrent Union Find Implementation *
+ ****************************************/
+
+/*
+ * A root is always linked under a root with a larger index, by a CAS
+ * which fails if it is not a root anymore, so there can't be cycles.
+ * Path halving is done with CAS too, and it is fine to lose the race
+ * since it only moves a pointer closer to the root.  Elements carry
+ * no other data, so relaxed memory order is enough; the final result
+ * is published by pthread_join().
+ */
+
+#define auf_load(p)             __atomic_load_n(p, __ATOMIC_RELAXED)
+#define auf_cas(p, old, new)                                        \
+    __atomic_compare_exchange_n(p, old, new, false,                 \
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+
+AtomicUnionFind *auf_new(uint64_t size)
+{
+    AtomicUnionFind *auf = calloc(1, sizeof(AtomicUnionFind));
+    uint64_t i;
+
+    auf->size = size;
+    auf->unions = size;
+    auf->parent = malloc(size * sizeof(Element));
+
+    for (i = 0; i < size; i++) {
+        auf->parent[i] = i;
+    }
+
+    return auf;
+}
+
+void auf_free(AtomicUnionFind *auf)
+{
+    free(auf->parent);
+    free(auf);
+}
+
+Element auf_find(AtomicUnionFind *auf, Element e)
+{
+    Element parent, grand;
+
+    assert(e < auf->size);
+
+    while (1) {
+        parent = auf_load(&auf->parent[e]);
+        if (parent == e)
+            return e;
+        grand = auf_load(&auf->parent[parent]);
+        if (grand != parent)
+            auf_cas(&auf->parent[e], &parent, grand);
+        e = grand;
+    }
+}
+
+void auf_union(AtomicUnionFind *auf, Element e1, Element e2)
+{
+    Element r1, r2, tmp;
+
+    while (1) {
+        r1 = auf_find(auf, e1);
+        r2 = auf_find(auf, e2);
+        if (r1 == r2)
+            return;
+        if (r1 > r2) {
+            tmp = r1;
+            r1 = r2;
+            r2 = tmp;
+        }
+        /* Only succeeds if r1 is still a root */
+        tmp = r1;
+        if (auf_cas(&auf->parent[r1], &tmp, r2)) {
+            __atomic_fetch_sub(&auf->unions, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        /* Someone else linked r1 meanwhile, retry from the roots */
+        e1 = r1;
+        e2 = r2;
+    }
+}
+
+bool auf_connected(AtomicUnionFind *auf, Element e1, Element e2)
+{
+    Element r1, r2;
+
+    while (1) {
+        r1 = auf_find(auf, e1);
+        r2 = auf_find(auf, e2);
+        if (r1 == r2)
+            return true;
+        /* If r1 is still a root, they were not connected at some point */
+        if (auf_load(&auf->parent[r1]) == r1)
+            return false;
+    }
+}
+
+uint64_t auf_count(AtomicUnionFind *auf)
+{
+    return auf_load(&auf->unions);
+}
+
+typedef struct {
+    AtomicUnionFind *auf;
+    const Element *pairs;
+    uint64_t count;
+    pthread_t thread;
+} AufWorker;
+
+static void *auf_worker_fn(void *opaque)
+{
+    AufWorker *worker = opaque;
+    uint64_t i;
+
+    for (i = 0; i < worker->count; i++) {
+        auf_union(worker->auf, worker->pairs[i * 2],
+                  worker->pairs[i * 2 + 1]);
+    }
+
+    return NULL;
+}
+
+void auf_union_pairs(AtomicUnionFind *auf, const Element *pairs,
+                     uint64_t count, int threads)
+{
+    AufWorker *workers;
+    uint64_t start = 0, end;
+    int i;
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    workers = calloc(threads, sizeof(AufWorker));
+    for (i = 0; i < threads; i++) {
+        end = count * (i + 1) / threads;
+        workers[i].auf = auf;
+        workers[i].pairs = pairs + start * 2;
+        workers[i].count = end - start;
+        start = end;
+        /* The first part is done by the current thread */
+        if (i)
+            pthread_create(&workers[i].thread, NULL, auf_worker_fn,
+                           &workers[i]);
+    }
+
+    auf_worker_fn(&workers[0]);
+    for (i = 1; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    free(workers);
+}
+
+UnionFind *auf_to_uf(AtomicUnionFind *auf)
+{
+    UnionFind *uf = calloc(1, sizeof(UnionFind));
+    Element e, root;
+
+    /* Take over the parent array, flattening all the paths */
+    uf->size = auf->size;
+    uf->unions = auf->unions;
+    uf->parent = auf->parent;
+    uf->next = malloc(uf->size * sizeof(Element));
+    uf->rank = calloc(uf->size, sizeof(uint8_t));
+
+    for (e = 0; e < uf->size; e++) {
+        uf->next[e] = e;
+    }
+    for (e = 0; e < uf->size; e++) {
+        root = auf_find(auf, e);
+        if (root == e)
+            continue;
+        uf->parent[e] = root;
+        uf->rank[root] = 1;
+        uf->next[e] = uf->next[root];
+        uf->next[root] = e;
+    }
+
+    free(auf);
+
+    return uf;
+}
+
+/* All the links in the input, for splitting them to threads */
+typedef struct {
+    uint64_t size;
+    /* Link i is from pairs[2*i] to pairs[2*i+1] */
+    Element *pairs;
+    uint64_t count;
+    uint64_t max;
+} PairList;
+
+static void *pair_list_init_op(uint64_t size)
+{
+    PairList *list = calloc(1, sizeof(PairList));
+
+    list->size = size;
+
+    return list;
+}
+
+static void pair_list_add_op(void *data, Element e1, Element e2)
+{
+    PairList *list = data;
+
+    assert(e1 < list->size);
+    assert(e2 < list->size);
+
+    if (list->count == list->max) {
+        list->max = list->max ? list->max * 2 : 1024;
+        list->pairs = realloc(list->pairs, list->max * 2 * sizeof(Element));
+    }
+    list->pairs[list->count * 2] = e1;
+    list->pairs[list->count * 2 + 1] = e2;
+    list->count++;
+}
+
+UnionFind *uf_from_input_mt(const char *path, int threads)
+{
+    PairList *list = parse_from_input(path, pair_list_init_op,
+                                      pair_list_add_op);
+    AtomicUnionFind *auf;
+
+    if (!list)
+        return NULL;
+
+    auf = auf_new(list->size);
+    auf_union_pairs(auf, list->pairs, list->count, threads);
+
+    free(list->pairs);
+    free(list);
+
+    return auf_to_uf(auf);
+}
+
+/**********************
+ * Depth First Search *
+ **********************/
+
+/* One bit for each element, marking whether it has been visited */
+static inline uint64_t *bitmap_new(uint64_t size)
+{
+    return calloc((size + 63) / 64, sizeof(uint64_t));
+}
+
+static inline bool bitmap_test(const uint64_t *bitmap, Element e)
+{
+    return bitmap[e / 64] & (1ULL << (e % 64));
+}
+
+static inline void bitmap_set(uint64_t *bitmap, Element e)
+{
+    bitmap[e / 64] |= 1ULL << (e % 64);
+}
+
+void dfs_foreach(AdjList *list, Element e, ElementOp op)
+{
+    uint64_t *marked = bitmap_new(list->size);
+    Element *stack = malloc(list->size * sizeof(Element));
+    uint64_t top = 0, i;
+    Link *link;
+
+    /* Only the marked bitmap matters, so the walking order does not */
+    bitmap_set(marked, e);
+    stack[top++] = e;
+    while (top) {
+        e = stack[--top];
+        for (link = list->link_array[e]; link; link = link->next) {
+            if (!bitmap_test(marked, link->e)) {
+                bitmap_set(marked, link->e);
+                stack[top++] = link->e;
+            }
+        }
+    }
+
+    for (i = 0; i < list->size; i++) {
+        if (bitmap_test(marked, i))
+            op(i);
+    }
+
+    free(stack);
+    free(marked);
+}
+
+/*
+ * DFS keeps its own stack instead of recursing, so that deep graphs
+ * won't overflow the stack.  Each stack frame is an element and its
+ * next link to walk, so elements are walked in the same order as a
+ * recursive DFS would do.
+ */
+typedef struct {
+    Element *elements;
+    Link **next;
+    uint64_t top;
+} DfsStack;
+
+static void dfs_stack_init(DfsStack *stack, uint64_t size)
+{
+    stack->elements = malloc(size * sizeof(Element));
+    stack->next = malloc(size * sizeof(Link *));
+    stack->top = 0;
+}
+
+static void dfs_stack_free(DfsStack *stack)
+{
+    free(stack->elements);
+    free(stack->next);
+}
+
+static void dfs_stack_push(DfsStack *stack, AdjList *list, Element e)
+{
+    stack->elements[stack->top] = e;
+    stack->next[stack->top] = list->link_array[e];
+    stack->top++;
+}
+
+bool dfs_path(AdjList *list, Element from, Element to, ElementOp op)
+{
+    uint64_t *marked = bitmap_new(list->size);
+    bool result = (from == to);
+    DfsStack stack;
+    Link *link;
+
+    dfs_stack_init(&stack, list->size);
+
+    /*
+     * Start searching from "to", then the stack from top to bottom will
+     * be the path from "from" to "to".
+     */
+    bitmap_set(marked, to);
+    dfs_stack_push(&stack, list, to);
+    while (stack.top && !result) {
+        link = stack.next[stack.top - 1];
+        if (!link) {
+            stack.top--;
+            continue;
+        }
+        stack.next[stack.top - 1] = link->next;
+        if (bitmap_test(marked, link->e))
+            continue;
+        bitmap_set(marked, link->e);
+        dfs_stack_push(&stack, list, link->e);
+        result = (link->e == from);
+    }
+
+    if (result) {
+        while (stack.top)
+            op(stack.elements[--stack.top]);
+    }
+
+    dfs_stack_free(&stack);
+    free(marked);
+
+    return result;
+}
+
+void dfs_order(AdjList *list, ElementOp op)
+{
+    uint64_t *marked = bitmap_new(list->size);
+    DfsStack stack;
+    Link *link;
+    Element e;
+
+    dfs_stack_init(&stack, list->size);
+
+    for (e = 0; e < list->size; e++) {
+        if (bitmap_test(marked, e))
+            continue;
+        bitmap_set(marked, e);
+        dfs_stack_push(&stack, list, e);
+        while (stack.top) {
+            link = stack.next[stack.top - 1];
+            if (!link) {
+                /* All the links are done, so all its dependencies */
+                op(stack.elements[--stack.top]);
+                continue;
+            }
+            stack.next[stack.top - 1] = link->next;
+            if (!bitmap_test(marked, link->e)) {
+                bitmap_set(marked, link->e);
+                dfs_stack_push(&stack, list, link->e);
+            }
+        }
+    }
+
+    dfs_stack_free(&stack);
+    free(marked);
+}
+
+/* Same as DfsStack, but the next link to walk is an index of edges[] */
+typedef struct {
+    Element *elements;
+    uint64_t *next;
+    uint64_t top;
+} CsrStack;
+
+static void csr_stack_init(CsrStack *stack, uint64_t size)
+{
+    stack->elements = malloc(size * sizeof(Element));
+    stack->next = malloc(size * sizeof(uint64_t));
+    stack->top = 0;
+}
+
+static void csr_stack_free(CsrStack *stack)
+{
+    free(stack->elements);
+    free(stack->next);
+}
+
+static void csr_stack_push(CsrStack *stack, CsrGraph *graph, Element e)
+{
+    stack->elements[stack->top] = e;
+    stack->next[stack->top] = graph->offsets[e];
+    stack->top++;
+}
+
+void csr_dfs_foreach(CsrGraph *graph, Element e, ElementOp op)
+{
+    uint64_t *marked = bitmap_new(graph->size);
+    Element *stack = malloc(graph->size * sizeof(Element));
+    uint64_t top = 0, i;
+
+    /* Only the marked bitmap matters, so the walking order does not */
+    bitmap_set(marked, e);
+    stack[top++] = e;
+    while (top) {
+        e = stack[--top];
+        for (i = graph->offsets[e]; i < graph->offsets[e + 1]; i++) {
+            if (!bitmap_test(marked, graph->edges[i])) {
+                bitmap_set(marked, graph->edges[i]);
+                stack[top++] = graph->edges[i];
+            }
+        }
+    }
+
+    for (i = 0; i < graph->size; i++) {
+        if (bitmap_test(marked, i))
+            op(i);
+    }
+
+    free(stack);
+    free(marked);
+}
+
+bool csr_dfs_path(CsrGraph *graph, Element from, Element to, ElementOp op)
+{
+    uint64_t *marked = bitmap_new(graph->size);
+    bool result = (from == to);
+    CsrStack stack;
+    uint64_t top;
+    Element e;
+
+    csr_stack_init(&stack, graph->size);
+
+    /*
+     * Same as dfs_path(), start from "to", then the stack from top to
+     * bottom will be the path from "from" to "to".
+     */
+    bitmap_set(marked, to);
+    csr_stack_push(&stack, graph, to);
+    while (stack.top && !result) {
+        top = stack.top - 1;
+        if (stack.next[top] == graph->offsets[stack.elements[top] + 1]) {
+            stack.top--;
+            continue;
+        }
+        e = graph->edges[stack.next[top]++];
+        if (bitmap_test(marked, e))
+            continue;
+        bitmap_set(marked, e);
+        csr_stack_push(&stack, graph, e);
+        result = (e == from);
+    }
+
+    if (result) {
+        while (stack.top)
+            op(stack.elements[--stack.top]);
+    }
+
+    csr_stack_free(&stack);
+    free(marked);
+
+    return result;
+}
+
+void csr_dfs_order(CsrGraph *graph, ElementOp op)
+{
+    uint64_t *marked = bitmap_new(graph->size);
+    CsrStack stack;
+    uint64_t top;
+    Element e, cur;
+
+    csr_stack_init(&stack, graph->size);
+
+    for (e = 0; e < graph->size; e++) {
+        if (bitmap_test(marked, e))
+            continue;
+        bitmap_set(marked, e);
+        csr_stack_push(&stack, graph, e);
+        while (stack.top) {
+            top = stack.top - 1;
+            cur = stack.elements[top];
+            if (stack.next[top] == graph->offsets[cur + 1]) {
+                /* All the links are done, same as dfs_order_iter() */
+                op(cur);
+                stack.top--;
+                continue;
+            }
+            cur = graph->edges[stack.next[top]++];
+            if (!bitmap_test(marked, cur)) {
+                bitmap_set(marked, cur);
+                csr_stack_push(&stack, graph, cur);
+            }
+        }
+    }
+
+    csr_stack_free(&stack);
+    free(marked);
+}
+
+/************************
+ * Breadth First Search *
+ ************************/
+
+typedef struct {
+    AdjList *list;
+    bool *marked;
+    Element target;
+    bool *to_search;
+    bool *next_search;
+    Element *edge_to;
+} PathCtx;
+
+/*
+ * Try to search all elements set in ctx->to_search array to see whether we
+ * found ctx->target.  If found, then good and we're done!  If not, update
+ * ctx->to_search to reflect the next round of search and redo.
+ */
+bool bfs_path_iter(PathCtx *ctx)
+{
+    Element i, next_count = 0;
+    bool *to_search = ctx->to_search;
+    bool *next_search = ctx->next_search;
+    bool result;
+    Link *link;
+
+    for (i = 0; i < ctx->list->size; i++) {
+        if (!to_search[i])
+            continue;
+        if (i == ctx->target)
+            /* We found it! */
+            return true;
+    }
+
+    /*
+     * Not found in current to_search direct links, try to establish the
+     * next level of to_search elements.
+     */
+    for (i = 0; i < ctx->list->size; i++) {
+        if (!to_search[i])
+            continue;
+        link = ctx->list->link_array[i];
+        while (link) {
+            if (!ctx->marked[link->e]) {
+                ctx->marked[link->e] = true;
+                next_search[link->e] = true;
+                ctx->edge_to[link->e] = i;
+                next_count++;
+            }
+            link = link->next;
+        }
+    }
+
+    /*
+     * Copy over the next level search elements into the global one, so
+     * that we can reset the temp one.
+     */
+    memcpy(to_search, next_search, ctx->list->size * sizeof(bool));
+    memset(next_search, 0, sizeof(bool) * ctx->list->size);
+
     if (!next_count) {
         /* this means the two elements are NOT connected! */
         return false;
     }
 
-    return bfs_path_iter(ctx);
+    return bfs_path_iter(ctx);
+}
+
+bool bfs_path(AdjList *list, Element from, Element to, ElementOp op)
+{
+    bool *marked = calloc(list->size, sizeof(bool));
+    bool *to_search = calloc(list->size, sizeof(bool));
+    bool *next_search = calloc(list->size, sizeof(bool));
+    Element *edge_to = calloc(list->size, sizeof(Element));
+    PathCtx ctx = {
+        .list = list,
+        .marked = marked,
+        .target = from,
+        .to_search = to_search,
+        .next_search = next_search,
+        .edge_to = edge_to,
+    };
+    bool result;
+
+    /*
+     * Start with an array with only "to" set; that's the place where we
+     * start the searching.
+     */
+    to_search[to] = true;
+    result = bfs_path_iter(&ctx);
+
+    if (result) {
+        do {
+            op(from);
+            from = edge_to[from];
+        } while (to != from);
+        op(from);
+    }
+
+    free(marked);
+    free(to_search);
+    free(next_search);
+    free(edge_to);
+
+    return result;
+}
+
+/*
+ * Unlike bfs_path(), this is a plain queue based BFS, so each element
+ * and link is only visited once.
+ */
+bool csr_bfs_path(CsrGraph *graph, Element from, Element to, ElementOp op)
+{
+    bool *marked = calloc(graph->size, sizeof(bool));
+    Element *queue = malloc(graph->size * sizeof(Element));
+    Element *edge_to = malloc(graph->size * sizeof(Element));
+    uint64_t head = 0, tail = 0, i;
+    Element cur, e;
+    bool result;
+
+    /* Same as bfs_path(), search from "to" */
+    marked[to] = true;
+    queue[tail++] = to;
+    while (head < tail && !marked[from]) {
+        cur = queue[head++];
+        for (i = graph->offsets[cur]; i < graph->offsets[cur + 1]; i++) {
+            e = graph->edges[i];
+            if (!marked[e]) {
+                marked[e] = true;
+                edge_to[e] = cur;
+                queue[tail++] = e;
+            }
+        }
+    }
+
+    result = marked[from];
+    if (result) {
+        while (from != to) {
+            op(from);
+            from = edge_to[from];
+        }
+        op(to);
+    }
+
+    free(marked);
+    free(queue);
+    free(edge_to);
+
+    return result;
+}
+
+/*
+ * Direction optimizing BFS, see "Direction-Optimizing Breadth-First
+ * Search" by Beamer et al.  Each level is either expanded top-down
+ * (elements in the frontier claim their unvisited neighbours), or
+ * bottom-up (unvisited elements look for any neighbour in the frontier,
+ * and stop at the first one).  Bottom-up is much cheaper when the
+ * frontier covers a large part of the graph, which happens in a few
+ * middle levels of low diameter graphs.
+ *
+ * The frontier is a queue for top-down, and a bitmap for bottom-up.
+ * All threads work on the same level, and they wait for each other
+ * before moving to the next level.
+ */
+
+/* Switch to bottom-up when frontier has more links than unvisited/ALPHA */
+#define CSR_BFS_ALPHA  (14)
+/* Switch back to top-down when frontier has less elements than size/BETA */
+#define CSR_BFS_BETA   (24)
+/* Number of frontier elements taken by one thread at a time */
+#define CSR_BFS_CHUNK  (64)
+
+typedef struct {
+    CsrGraph *graph;
+    Element *parent;
+    int threads;
+    pthread_barrier_t barrier;
+    /* Frontier of top-down; next_len is reserved atomically */
+    Element *queue, *next_queue;
+    uint64_t len, next_len, pos;
+    /* Frontier of bottom-up, one bit for each element */
+    uint64_t *bitmap, *next_bitmap;
+    uint64_t words;
+    bool bottom_up, done;
+    /* Links from all the unvisited elements */
+    uint64_t unvisited_edges;
+    uint64_t visited;
+} CsrBfs;
+
+typedef struct {
+    CsrBfs *bfs;
+    int id;
+    /* Elements found in this level, and the links they have */
+    uint64_t found, found_edges;
+    Element batch[CSR_BFS_CHUNK];
+    int batch_len;
+    pthread_t thread;
+} CsrBfsWorker;
+
+static inline uint64_t csr_degree(CsrGraph *graph, Element e)
+{
+    return graph->offsets[e + 1] - graph->offsets[e];
+}
+
+static void csr_bfs_flush(CsrBfsWorker *worker)
+{
+    CsrBfs *bfs = worker->bfs;
+    uint64_t pos;
+
+    pos = __atomic_fetch_add(&bfs->next_len, worker->batch_len,
+                             __ATOMIC_RELAXED);
+    memcpy(&bfs->next_queue[pos], worker->batch,
+           worker->batch_len * sizeof(Element));
+    worker->batch_len = 0;
+}
+
+static void csr_bfs_top_down(CsrBfsWorker *worker)
+{
+    CsrBfs *bfs = worker->bfs;
+    CsrGraph *graph = bfs->graph;
+    Element *parent = bfs->parent, cur, e, none;
+    uint64_t start, end, i, j;
+
+    while (1) {
+        start = __atomic_fetch_add(&bfs->pos, CSR_BFS_CHUNK,
+                                   __ATOMIC_RELAXED);
+        if (start >= bfs->len)
+            break;
+        end = start + CSR_BFS_CHUNK;
+        if (end > bfs->len)
+            end = bfs->len;
+
+        for (i = start; i < end; i++) {
+            cur = bfs->queue[i];
+            for (j = graph->offsets[cur]; j < graph->offsets[cur + 1]; j++) {
+                e = graph->edges[j];
+                if (__atomic_load_n(&parent[e], __ATOMIC_RELAXED) !=
+                    CSR_BFS_NONE)
+                    continue;
+                none = CSR_BFS_NONE;
+                if (!__atomic_compare_exchange_n(&parent[e], &none, cur,
+                                                 false, __ATOMIC_RELAXED,
+                                                 __ATOMIC_RELAXED))
+                    continue;
+                worker->found++;
+                worker->found_edges += csr_degree(graph, e);
+                worker->batch[worker->batch_len++] = e;
+                if (worker->batch_len == CSR_BFS_CHUNK)
+                    csr_bfs_flush(worker);
+            }
+        }
+    }
+
+    if (worker->batch_len)
+        csr_bfs_flush(worker);
+}
+
+/*
+ * Each thread owns a range of bitmap words, so only it writes the
+ * parents and next bitmap words of these elements.
+ */
+static void csr_bfs_bottom_up(CsrBfsWorker *worker)
+{
+    CsrBfs *bfs = worker->bfs;
+    CsrGraph *graph = bfs->graph;
+    Element *parent = bfs->parent, cur, e;
+    uint64_t start, end, w, bits, j;
+    int b;
+
+    start = bfs->words * worker->id / bfs->threads;
+    end = bfs->words * (worker->id + 1) / bfs->threads;
+
+    for (w = start; w < end; w++) {
+        bits = 0;
+        for (b = 0; b < 64; b++) {
+            cur = w * 64 + b;
+            if (cur >= graph->size)
+                break;
+            if (parent[cur] != CSR_BFS_NONE)
+                continue;
+            for (j = graph->offsets[cur]; j < graph->offsets[cur + 1]; j++) {
+                e = graph->edges[j];
+                if (bfs->bitmap[e / 64] & (1ULL << (e % 64))) {
+                    parent[cur] = e;
+                    bits |= 1ULL << b;
+                    worker->found++;
+                    worker->found_edges += csr_degree(graph, cur);
+                    break;
+                }
+            }
+        }
+        bfs->next_bitmap[w] = bits;
+    }
+}
+
+/* Prepare the next level; only called from one thread */
+static void csr_bfs_next_level(CsrBfs *bfs, CsrBfsWorker *workers)
+{
+    uint64_t found = 0, found_edges = 0, *bitmap, bits, i;
+    Element *queue;
+    bool bottom_up;
+    int t;
+
+    for (t = 0; t < bfs->threads; t++) {
+        found += workers[t].found;
+        found_edges += workers[t].found_edges;
+        workers[t].found = workers[t].found_edges = 0;
+    }
+    bfs->visited += found;
+    bfs->unvisited_edges -= found_edges;
+
+    if (!found) {
+        bfs->done = true;
+        return;
+    }
+
+    if (bfs->bottom_up)
+        bottom_up = found >= bfs->graph->size / CSR_BFS_BETA ||
+            found >= bfs->len;
+    else
+        bottom_up = found_edges > bfs->unvisited_edges / CSR_BFS_ALPHA;
+
+    /* Take the new frontier, converting it if the direction changes */
+    if (bfs->bottom_up) {
+        bitmap = bfs->bitmap;
+        bfs->bitmap = bfs->next_bitmap;
+        bfs->next_bitmap = bitmap;
+        if (!bottom_up) {
+            bfs->next_len = 0;
+            for (i = 0; i < bfs->words; i++) {
+                for (bits = bfs->bitmap[i]; bits; bits &= bits - 1) {
+                    bfs->next_queue[bfs->next_len++] =
+                        i * 64 + __builtin_ctzll(bits);
+                }
+            }
+        }
+    } else if (bottom_up) {
+        memset(bfs->bitmap, 0, bfs->words * sizeof(uint64_t));
+        for (i = 0; i < bfs->next_len; i++) {
+            bfs->bitmap[bfs->next_queue[i] / 64] |=
+                1ULL << (bfs->next_queue[i] % 64);
+        }
+    }
+
+    if (!bottom_up) {
+        queue = bfs->queue;
+        bfs->queue = bfs->next_queue;
+        bfs->next_queue = queue;
+        bfs->len = bfs->next_len;
+        bfs->next_len = 0;
+        bfs->pos = 0;
+    } else {
+        bfs->len = found;
+    }
+    bfs->bottom_up = bottom_up;
 }
 
-bool bfs_path(AdjList *list, Element from, Element to, ElementOp op)
+static void *csr_bfs_worker_fn(void *opaque)
 {
-    bool *marked = calloc(list->size, sizeof(bool));
-    bool *to_search = calloc(list->size, sizeof(bool));
-    bool *next_search = calloc(list->size, sizeof(bool));
-    Element *edge_to = calloc(list->size, sizeof(Element));
-    PathCtx ctx = {
-        .list = list,
-        .marked = marked,
-        .target = from,
-        .to_search = to_search,
-        .next_search = next_search,
-        .edge_to = edge_to,
+    CsrBfsWorker *worker = opaque, *workers = worker - worker->id;
+    CsrBfs *bfs = worker->bfs;
+
+    while (!bfs->done) {
+        if (bfs->bottom_up)
+            csr_bfs_bottom_up(worker);
+        else
+            csr_bfs_top_down(worker);
+        pthread_barrier_wait(&bfs->barrier);
+        if (!worker->id)
+            csr_bfs_next_level(bfs, workers);
+        pthread_barrier_wait(&bfs->barrier);
+    }
+
+    return NULL;
+}
+
+uint64_t csr_bfs(CsrGraph *graph, Element root, Element *parent, int threads)
+{
+    CsrBfs bfs = {
+        .graph = graph,
+        .parent = parent,
+        .words = (graph->size + 63) / 64,
+        .visited = 1,
     };
+    CsrBfsWorker *workers;
+    uint64_t i;
+    int t;
+
+    assert(root < graph->size);
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (i = 0; i < graph->size; i++) {
+        parent[i] = CSR_BFS_NONE;
+    }
+    parent[root] = root;
+
+    bfs.threads = threads;
+    bfs.queue = malloc(graph->size * sizeof(Element));
+    bfs.next_queue = malloc(graph->size * sizeof(Element));
+    bfs.bitmap = malloc(bfs.words * sizeof(uint64_t));
+    bfs.next_bitmap = malloc(bfs.words * sizeof(uint64_t));
+    bfs.queue[bfs.len++] = root;
+    bfs.unvisited_edges = graph->nr_edges - csr_degree(graph, root);
+    pthread_barrier_init(&bfs.barrier, NULL, threads);
+
+    workers = calloc(threads, sizeof(CsrBfsWorker));
+    for (t = 0; t < threads; t++) {
+        workers[t].bfs = &bfs;
+        workers[t].id = t;
+        /* The first worker is the current thread */
+        if (t)
+            pthread_create(&workers[t].thread, NULL, csr_bfs_worker_fn,
+                           &workers[t]);
+    }
+    csr_bfs_worker_fn(&workers[0]);
+    for (t = 1; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+
+    pthread_barrier_destroy(&bfs.barrier);
+    free(workers);
+    free(bfs.queue);
+    free(bfs.next_queue);
+    free(bfs.bitmap);
+    free(bfs.next_bitmap);
+
+    return bfs.visited;
+}
+
+bool bfs_parent_path(const Element *parent, Element from, ElementOp op)
+{
+    if (parent[from] == CSR_BFS_NONE)
+        return false;
+
+    while (parent[from] != from) {
+        op(from);
+        from = parent[from];
+    }
+    op(from);
+
+    return true;
+}
+
+bool csr_bfs_path_mt(CsrGraph *graph, Element from, Element to,
+                     ElementOp op, int threads)
+{
+    Element *parent = malloc(graph->size * sizeof(Element));
     bool result;
 
+    /* Same as bfs_path(), search from "to" */
+    csr_bfs(graph, to, parent, threads);
+    result = bfs_parent_path(parent, from, op);
+    free(parent);
+
+    return result;
+}
+
+/********************
+ * Topological Sort *
+ ********************/
+
+/*
+ * Kahn's algorithm: each element keeps the number of its links not
+ * done yet, and becomes ready when it drops to zero.  All the ready
+ * elements form one level.  Expanding a large level is split between
+ * threads, which take chunks of the level and decrease the counters
+ * atomically.  Small levels are expanded by the calling thread only,
+ * so that a deep graph doesn't pay for creating threads per level.
+ */
+
+/* Expand a level with threads only if it has at least this many */
+#define CSR_TOPO_MT_MIN  (4096)
+#define CSR_TOPO_CHUNK   (64)
+
+struct CsrTopo {
+    CsrGraph *graph;
+    /* Elements depending on each element */
+    CsrGraph *reverse;
+    /* Number of links not done yet for each element */
+    uint64_t *count;
+    /* The current level, and the next one being filled */
+    Element *level, *next;
+    uint64_t len, next_len, pos;
+    /* Number of elements returned in all levels */
+    uint64_t done;
+    int threads;
+    bool started;
+};
+
+typedef struct {
+    CsrTopo *topo;
+    bool atomic;
+    /* Elements depending on the ones taken, to decrease the counters */
+    Element targets[CSR_PARSER_BATCH];
+    int targets_len;
+    /* Elements found ready, to put into the next level */
+    Element batch[CSR_TOPO_CHUNK];
+    int batch_len;
+    pthread_t thread;
+} CsrTopoWorker;
+
+static void csr_topo_flush(CsrTopoWorker *worker)
+{
+    CsrTopo *topo = worker->topo;
+    uint64_t pos;
+
+    if (worker->atomic)
+        pos = __atomic_fetch_add(&topo->next_len, worker->batch_len,
+                                 __ATOMIC_RELAXED);
+    else {
+        pos = topo->next_len;
+        topo->next_len += worker->batch_len;
+    }
+    memcpy(&topo->next[pos], worker->batch,
+           worker->batch_len * sizeof(Element));
+    worker->batch_len = 0;
+}
+
+/* Same as csr_parser_apply(), prefetch the counters before using them */
+static void csr_topo_apply(CsrTopoWorker *worker)
+{
+    uint64_t *count = worker->topo->count, left;
+    Element *targets = worker->targets;
+    int i, n = worker->targets_len;
+
+    for (i = 0; i < n; i++) {
+        if (i + CSR_PREFETCH < n)
+            __builtin_prefetch(&count[targets[i + CSR_PREFETCH]], 1);
+        if (worker->atomic)
+            left = __atomic_sub_fetch(&count[targets[i]], 1,
+                                      __ATOMIC_RELAXED);
+        else
+            left = --count[targets[i]];
+        if (left)
+            continue;
+        worker->batch[worker->batch_len++] = targets[i];
+        if (worker->batch_len == CSR_TOPO_CHUNK)
+            csr_topo_flush(worker);
+    }
+    worker->targets_len = 0;
+}
+
+static void *csr_topo_worker_fn(void *opaque)
+{
+    CsrTopoWorker *worker = opaque;
+    CsrTopo *topo = worker->topo;
+    CsrGraph *reverse = topo->reverse;
+    uint64_t start, end, i, j;
+    Element e;
+
+    while (1) {
+        if (worker->atomic)
+            start = __atomic_fetch_add(&topo->pos, CSR_TOPO_CHUNK,
+                                       __ATOMIC_RELAXED);
+        else {
+            start = topo->pos;
+            topo->pos += CSR_TOPO_CHUNK;
+        }
+        if (start >= topo->len)
+            break;
+        end = start + CSR_TOPO_CHUNK;
+        if (end > topo->len)
+            end = topo->len;
+
+        for (i = start; i < end; i++) {
+            e = topo->level[i];
+            for (j = reverse->offsets[e]; j < reverse->offsets[e + 1]; j++) {
+                worker->targets[worker->targets_len++] = reverse->edges[j];
+                if (worker->targets_len == CSR_PARSER_BATCH)
+                    csr_topo_apply(worker);
+            }
+        }
+    }
+
+    csr_topo_apply(worker);
+    if (worker->batch_len)
+        csr_topo_flush(worker);
+
+    return NULL;
+}
+
+CsrTopo *csr_topo_new(CsrGraph *graph, int threads)
+{
+    CsrTopo *topo = calloc(1, sizeof(CsrTopo));
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    topo->graph = graph;
+    topo->reverse = csr_reverse(graph);
+    topo->count = malloc(graph->size * sizeof(uint64_t));
+    topo->level = malloc(graph->size * sizeof(Element));
+    topo->next = malloc(graph->size * sizeof(Element));
+    topo->threads = threads;
+
+    return topo;
+}
+
+const Element *csr_topo_next(CsrTopo *topo, uint64_t *len)
+{
+    CsrGraph *graph = topo->graph;
+    CsrTopoWorker *workers;
+    Element *level, e;
+    int threads = 1, t;
+
+    if (!topo->started) {
+        /* The first level is all the elements without any link */
+        topo->started = true;
+        for (e = 0; e < graph->size; e++) {
+            topo->count[e] = graph->offsets[e + 1] - graph->offsets[e];
+            if (!topo->count[e])
+                topo->next[topo->next_len++] = e;
+        }
+    } else if (topo->len) {
+        if (topo->len >= CSR_TOPO_MT_MIN)
+            threads = topo->threads;
+        workers = calloc(threads, sizeof(CsrTopoWorker));
+        for (t = 0; t < threads; t++) {
+            workers[t].topo = topo;
+            workers[t].atomic = (threads > 1);
+            /* The first worker is the current thread */
+            if (t)
+                pthread_create(&workers[t].thread, NULL, csr_topo_worker_fn,
+                               &workers[t]);
+        }
+        csr_topo_worker_fn(&workers[0]);
+        for (t = 1; t < threads; t++) {
+            pthread_join(workers[t].thread, NULL);
+        }
+        free(workers);
+    }
+
+    level = topo->level;
+    topo->level = topo->next;
+    topo->next = level;
+    topo->len = topo->next_len;
+    topo->next_len = 0;
+    topo->pos = 0;
+    topo->done += topo->len;
+
+    *len = topo->len;
+    return topo->len ? topo->level : NULL;
+}
+
+bool csr_topo_cycle(CsrTopo *topo, ElementOp op)
+{
+    CsrGraph *graph = topo->graph;
+    uint64_t *seen, i;
+    Element e, start;
+
+    if (!topo->started || topo->len || topo->done == graph->size)
+        return false;
+
     /*
-     * Start with an array with only "to" set; that's the place where we
-     * start the searching.
+     * Every element left has at least one link to another element
+     * left, otherwise it would have been done.  So following any of
+     * these links from any element left will end up in a cycle.
      */
-    to_search[to] = true;
-    result = bfs_path_iter(&ctx);
+    for (start = 0; !topo->count[start]; start++)
+        ;
+
+    seen = calloc((graph->size + 63) / 64, sizeof(uint64_t));
+    for (e = start; !bitmap_test(seen, e); ) {
+        bitmap_set(seen, e);
+        for (i = graph->offsets[e]; topo->count[graph->edges[i]] == 0; i++)
+            ;
+        e = graph->edges[i];
+    }
+    free(seen);
+
+    /* Now `e' is on the cycle */
+    start = e;
+    do {
+        op(e);
+        for (i = graph->offsets[e]; topo->count[graph->edges[i]] == 0; i++)
+            ;
+        e = graph->edges[i];
+    } while (e != start);
+
+    return true;
+}
+
+void csr_topo_free(CsrTopo *topo)
+{
+    csr_free(topo->reverse);
+    free(topo->count);
+    free(topo->level);
+    free(topo->next);
+    free(topo);
+}
+
+/************************
+ * Connected Components *
+ ************************/
+
+uint64_t adj_components(AdjList *list, Element *labels)
+{
+    Element *stack = malloc(list->size * sizeof(Element));
+    uint64_t top = 0, count = 0;
+    Element e, cur;
+    Link *link;
+
+    for (e = 0; e < list->size; e++) {
+        labels[e] = CC_NONE;
+    }
+
+    /* The first element found of each component is the smallest one */
+    for (e = 0; e < list->size; e++) {
+        if (labels[e] != CC_NONE)
+            continue;
+        count++;
+        labels[e] = e;
+        stack[top++] = e;
+        while (top) {
+            cur = stack[--top];
+            for (link = list->link_array[cur]; link; link = link->next) {
+                if (labels[link->e] == CC_NONE) {
+                    labels[link->e] = e;
+                    stack[top++] = link->e;
+                }
+            }
+        }
+    }
+
+    free(stack);
+
+    return count;
+}
+
+/*
+ * Label propagation: every element starts with its own label, and keeps
+ * taking the smallest label of its neighbours until nothing changes.
+ * Labels are also elements of the same component, so when an element
+ * finds a smaller label, the label of its old label is lowered too
+ * (hooking the old label onto the new one), and the label of the label
+ * is taken directly.  Without these, a small label only moves one link
+ * per pass against the direction of the pass, which takes hundreds of
+ * passes on long paths.  Labels only decrease, and are only lowered
+ * with atomic operations, so reading an old label only delays the
+ * convergence.
+ */
+typedef struct {
+    AdjList *list;
+    Element *labels;
+    pthread_barrier_t barrier;
+    bool changed, done;
+    int threads;
+} CcPropagate;
+
+typedef struct {
+    CcPropagate *cc;
+    int id;
+    pthread_t thread;
+} CcWorker;
+
+static inline Element cc_load(Element *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+/* Lower *p to `val' if it is smaller; return true if lowered */
+static inline bool cc_lower(Element *p, Element val)
+{
+    Element old = cc_load(p);
+
+    while (val < old) {
+        if (__atomic_compare_exchange_n(p, &old, val, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return true;
+    }
+
+    return false;
+}
+
+static void *cc_worker_fn(void *opaque)
+{
+    CcWorker *worker = opaque;
+    CcPropagate *cc = worker->cc;
+    Element *labels = cc->labels, e, min, old, start, end, l;
+    bool changed;
+    Link *link;
+
+    start = cc->list->size * worker->id / cc->threads;
+    end = cc->list->size * (worker->id + 1) / cc->threads;
+
+    while (!cc->done) {
+        changed = false;
+        for (e = start; e < end; e++) {
+            old = min = cc_load(&labels[e]);
+            for (link = cc->list->link_array[e]; link; link = link->next) {
+                l = cc_load(&labels[link->e]);
+                if (l < min)
+                    min = l;
+            }
+            while ((l = cc_load(&labels[min])) < min)
+                min = l;
+            if (min < old) {
+                changed |= cc_lower(&labels[e], min);
+                changed |= cc_lower(&labels[old], min);
+            }
+        }
+        if (changed)
+            __atomic_store_n(&cc->changed, true, __ATOMIC_RELAXED);
+
+        pthread_barrier_wait(&cc->barrier);
+        if (!worker->id) {
+            cc->done = !cc->changed;
+            cc->changed = false;
+        }
+        pthread_barrier_wait(&cc->barrier);
+    }
+
+    return NULL;
+}
+
+uint64_t adj_components_mt(AdjList *list, Element *labels, int threads)
+{
+    CcPropagate cc = {
+        .list = list,
+        .labels = labels,
+    };
+    CcWorker *workers;
+    uint64_t count = 0;
+    Element e;
+    int t;
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    cc.threads = threads;
+
+    for (e = 0; e < list->size; e++) {
+        labels[e] = e;
+    }
+
+    pthread_barrier_init(&cc.barrier, NULL, threads);
+    workers = calloc(threads, sizeof(CcWorker));
+    for (t = 0; t < threads; t++) {
+        workers[t].cc = &cc;
+        workers[t].id = t;
+        /* The first worker is the current thread */
+        if (t)
+            pthread_create(&workers[t].thread, NULL, cc_worker_fn,
+                           &workers[t]);
+    }
+    cc_worker_fn(&workers[0]);
+    for (t = 1; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    pthread_barrier_destroy(&cc.barrier);
+    free(workers);
+
+    for (e = 0; e < list->size; e++) {
+        if (labels[e] == e)
+            count++;
+    }
+
+    return count;
+}
+
+/*
+ * Iterative Tarjan's algorithm, with the same stack frames as
+ * dfs_order().  Elements visited but not yet in any SCC are kept in
+ * `pending', and an SCC is popped out of it when its first visited
+ * element is done.
+ */
+uint64_t adj_scc(AdjList *list, Element *labels)
+{
+    uint64_t *index = malloc(list->size * sizeof(uint64_t));
+    uint64_t *low = malloc(list->size * sizeof(uint64_t));
+    uint64_t *on_pending = bitmap_new(list->size);
+    Element *pending = malloc(list->size * sizeof(Element));
+    uint64_t nr_pending = 0, counter = 0, count = 0, i, first;
+    Element e, cur, min;
+    DfsStack stack;
+    Link *link;
+
+    dfs_stack_init(&stack, list->size);
+    for (e = 0; e < list->size; e++) {
+        index[e] = CC_NONE;
+    }
+
+    for (e = 0; e < list->size; e++) {
+        if (index[e] != CC_NONE)
+            continue;
+
+        index[e] = low[e] = counter++;
+        pending[nr_pending++] = e;
+        bitmap_set(on_pending, e);
+        dfs_stack_push(&stack, list, e);
+
+        while (stack.top) {
+            cur = stack.elements[stack.top - 1];
+            link = stack.next[stack.top - 1];
+            if (link) {
+                stack.next[stack.top - 1] = link->next;
+                if (index[link->e] == CC_NONE) {
+                    index[link->e] = low[link->e] = counter++;
+                    pending[nr_pending++] = link->e;
+                    bitmap_set(on_pending, link->e);
+                    dfs_stack_push(&stack, list, link->e);
+                } else if (bitmap_test(on_pending, link->e) &&
+                           index[link->e] < low[cur]) {
+                    low[cur] = index[link->e];
+                }
+                continue;
+            }
+
+            /* All the links are done, pass `low' to the parent */
+            stack.top--;
+            if (stack.top && low[cur] < low[stack.elements[stack.top - 1]])
+                low[stack.elements[stack.top - 1]] = low[cur];
+            if (low[cur] != index[cur])
+                continue;
+
+            /* `cur' is the root of an SCC, of all pending since `cur' */
+            first = nr_pending;
+            min = cur;
+            do {
+                first--;
+                if (pending[first] < min)
+                    min = pending[first];
+            } while (pending[first] != cur);
+            for (i = first; i < nr_pending; i++) {
+                labels[pending[i]] = min;
+                on_pending[pending[i] / 64] &= ~(1ULL << (pending[i] % 64));
+            }
+            nr_pending = first;
+            count++;
+        }
+    }
+
+    dfs_stack_free(&stack);
+    free(index);
+    free(low);
+    free(on_pending);
+    free(pending);
+
+    return count;
+}
+
+/*****************
+ * Shortest Path *
+ *****************/
+
+/*
+ * Dijkstra with a 4-ary heap: the heap is half as deep as a binary one,
+ * and all the children of a node sit in one cache line.  An element is
+ * pushed again when its distance gets shorter instead of being moved in
+ * the heap, and the old entry is skipped when popped, so there is no
+ * need to track the position of each element in the heap.
+ */
+#define CSR_HEAP_ARITY  (4)
+
+typedef struct {
+    Weight dist;
+    Element e;
+} CsrHeapEntry;
+
+typedef struct {
+    CsrHeapEntry *entries;
+    uint64_t len, max;
+} CsrHeap;
+
+static void csr_heap_push(CsrHeap *heap, Weight dist, Element e)
+{
+    CsrHeapEntry *entries;
+    uint64_t i, parent;
+
+    if (heap->len == heap->max) {
+        heap->max = heap->max ? heap->max * 2 : 1024;
+        heap->entries = realloc(heap->entries,
+                                heap->max * sizeof(CsrHeapEntry));
+    }
+
+    /* Move the parents down until the place for the new entry is found */
+    entries = heap->entries;
+    for (i = heap->len++; i; i = parent) {
+        parent = (i - 1) / CSR_HEAP_ARITY;
+        if (entries[parent].dist <= dist)
+            break;
+        entries[i] = entries[parent];
+    }
+    entries[i].dist = dist;
+    entries[i].e = e;
+}
+
+static CsrHeapEntry csr_heap_pop(CsrHeap *heap)
+{
+    CsrHeapEntry *entries = heap->entries, top = entries[0], last;
+    uint64_t i = 0, child, min, end;
+
+    last = entries[--heap->len];
+    /* Move the smallest child up until the place for `last' is found */
+    while ((child = i * CSR_HEAP_ARITY + 1) < heap->len) {
+        end = child + CSR_HEAP_ARITY;
+        if (end > heap->len)
+            end = heap->len;
+        for (min = child++; child < end; child++) {
+            if (entries[child].dist < entries[min].dist)
+                min = child;
+        }
+        if (last.dist <= entries[min].dist)
+            break;
+        entries[i] = entries[min];
+        i = min;
+    }
+    entries[i] = last;
+
+    return top;
+}
+
+/* Stop as soon as the distance to `to' is known, if it is not NONE */
+static uint64_t csr_dijkstra_run(CsrGraph *graph, Element from, Element to,
+                                 Weight *dist, Element *parent)
+{
+    CsrHeap heap = { 0 };
+    CsrHeapEntry top;
+    uint64_t reached = 0, j;
+    Weight d;
+    Element e;
+
+    assert(from < graph->size);
+
+    for (e = 0; e < graph->size; e++) {
+        dist[e] = CSR_DIST_INF;
+        parent[e] = CSR_BFS_NONE;
+    }
+    dist[from] = 0;
+    parent[from] = from;
+    csr_heap_push(&heap, 0, from);
+
+    while (heap.len) {
+        top = csr_heap_pop(&heap);
+        if (top.dist != dist[top.e])
+            continue;
+        reached++;
+        if (top.e == to)
+            break;
+        for (j = graph->offsets[top.e]; j < graph->offsets[top.e + 1]; j++) {
+            e = graph->edges[j];
+            d = top.dist + (graph->weights ? graph->weights[j] : 1);
+            if (d < dist[e]) {
+                dist[e] = d;
+                parent[e] = top.e;
+                csr_heap_push(&heap, d, e);
+            }
+        }
+    }
+
+    free(heap.entries);
+
+    return reached;
+}
+
+uint64_t csr_dijkstra(CsrGraph *graph, Element from, Weight *dist,
+                      Element *parent)
+{
+    return csr_dijkstra_run(graph, from, CSR_BFS_NONE, dist, parent);
+}
+
+bool csr_dijkstra_path(CsrGraph *graph, Element from, Element to,
+                       ElementOp op, Weight *distance)
+{
+    Weight *dist = malloc(graph->size * sizeof(Weight));
+    Element *parent = malloc(graph->size * sizeof(Element));
+    Element *path = NULL;
+    uint64_t len = 0;
+    bool result;
+
+    assert(to < graph->size);
 
+    csr_dijkstra_run(graph, from, to, dist, parent);
+    result = (parent[to] != CSR_BFS_NONE);
     if (result) {
-        do {
-            op(from);
-            from = edge_to[from];
-        } while (to != from);
+        if (distance)
+            *distance = dist[to];
+        /* Parents are from `to' back to `from'; reuse dist[] for them */
+        path = (Element *)dist;
+        for (; to != from; to = parent[to])
+            path[len++] = to;
         op(from);
+        while (len)
+            op(path[--len]);
     }
 
-    free(marked);
-    free(to_search);
-    free(next_search);
-    free(edge_to);
+    free(dist);
+    free(parent);
 
     return result;
 }
@@ -6,6 +6,7 @@
 #include <stdbool.h>
 
 typedef uint64_t Element;
+typedef uint64_t Weight;
 typedef void (*ElementOp)(Element e);
 
 /******************************
@@ -26,6 +27,8 @@ typedef struct {
     uint64_t size;
 } AdjList;
 
+/* Create an adjacency list of `size' elements without links */
+AdjList *adj_list_new(uint64_t size);
 /* Create a new adjacency list with data specified in file `path' */
 AdjList *adj_list_from_input(const char *path);
 /* adjancency list with directions */
@@ -37,17 +40,83 @@ void adj_link_add(AdjList *list, Element e1, Element e2);
 /* Dump data in one adjacency list */
 void adj_list_dump(AdjList *list);
 
+/*************************************
+ * Compressed Sparse Row Definitions *
+ *************************************/
+
+/*
+ * Same links as AdjList, but kept in one contiguous array: links of
+ * element i are edges[offsets[i]] ... edges[offsets[i+1] - 1], in the
+ * same order as in AdjList.  It can't be modified after created.
+ *
+ * Links in the input can have weights, as "e1,e2,weight" lines; the
+ * weight of edges[j] is then weights[j].  Links without weights in the
+ * same input weigh 1.  AdjList and UnionFind ignore weights.
+ */
+typedef struct {
+    /* Size of the offsets array is size + 1 */
+    uint64_t *offsets;
+    Element *edges;
+    /* Number of elements */
+    uint64_t size;
+    /* Size of the edges array */
+    uint64_t nr_edges;
+    /* Same size as edges, or NULL if there is no weight in the input */
+    Weight *weights;
+    /* The mapped file if loaded with csr_load(), or NULL */
+    void *map;
+    size_t map_size;
+} CsrGraph;
+
+/* Create a CSR graph with data specified in file `path' */
+CsrGraph *csr_from_input(const char *path);
+/* CSR graph with directions */
+CsrGraph *csr_dir_from_input(const char *path);
+/*
+ * Same as above, but parse the input with `threads' threads (number of
+ * CPUs if <= 0, but no more than 8).  The result is the same.  Each
+ * thread takes one array of V counters, so memory and the serial prefix
+ * pass grow as O(threads * V) on top of the graph itself.
+ */
+CsrGraph *csr_from_input_mt(const char *path, int threads);
+CsrGraph *csr_dir_from_input_mt(const char *path, int threads);
+/*
+ * Save a CSR graph into binary file `path', which can be loaded much
+ * faster than parsing the text input.  Return 0 if succeeded, or -1.
+ */
+int csr_save(CsrGraph *graph, const char *path);
+/*
+ * Load a CSR graph saved with csr_save().  The file is mapped, and the
+ * arrays of the graph point into it, so nothing is copied.  The offsets
+ * and edges are checked once, in O(V+E).  The graph must not be
+ * modified.  Return NULL if failed, or if the file is not a valid graph.
+ */
+CsrGraph *csr_load(const char *path);
+/* Create a new CSR graph with all the links of `graph' reversed */
+CsrGraph *csr_reverse(CsrGraph *graph);
+/* Free a CSR graph */
+void csr_free(CsrGraph *graph);
+/* Dump data in one CSR graph */
+void csr_dump(CsrGraph *graph);
+
 /**************************
  * Union Find Definitions *
  **************************/
 
 typedef struct {
-    Link **link_array;
-    /* Size of the link_array */
+    /* Parent of each element; the root of a union points to itself */
+    Element *parent;
+    /* Next element in the same union, as a circular list */
+    Element *next;
+    /* Upper bound of the height of each union, only valid for roots */
+    uint8_t *rank;
+    /* Size of the arrays */
     uint64_t size;
     uint64_t unions;
 } UnionFind;
 
+/* Create UF with `size' elements, each in its own union */
+UnionFind *uf_new(uint64_t size);
 /* Create UF with data specified in file `path' */
 UnionFind *uf_from_input(const char *path);
 /* Free an union find structure */
@@ -58,6 +127,50 @@ uint64_t uf_count(UnionFind *uf);
 bool uf_connected(UnionFind *uf, Element e1, Element e2);
 /* Loop over the union elements that owns `e' */
 void uf_union_foreach(UnionFind *uf, Element e, ElementOp op);
+/* Find the root element of the union that owns `e' */
+Element uf_find(UnionFind *uf, Element e);
+/* Merge the unions that own e1 and e2 */
+void uf_union(UnionFind *uf, Element e1, Element e2);
+
+/*************************************
+ * Concurrent Union Find Definitions *
+ *************************************/
+
+/*
+ * Lock-free union find, which can be fed with links from multiple
+ * threads at the same time.  Convert it into an UnionFind with
+ * auf_to_uf() when all the links are added.
+ */
+typedef struct {
+    /* Parent of each element, only updated with atomic operations */
+    Element *parent;
+    /* Size of the parent array */
+    uint64_t size;
+    uint64_t unions;
+} AtomicUnionFind;
+
+/* Create an AtomicUnionFind with `size' elements */
+AtomicUnionFind *auf_new(uint64_t size);
+/* Free an AtomicUnionFind */
+void auf_free(AtomicUnionFind *auf);
+/* Find the root element of the union that owns `e'; thread safe */
+Element auf_find(AtomicUnionFind *auf, Element e);
+/* Merge the unions that own e1 and e2; thread safe */
+void auf_union(AtomicUnionFind *auf, Element e1, Element e2);
+/* Whether the two elements are connected?  Thread safe */
+bool auf_connected(AtomicUnionFind *auf, Element e1, Element e2);
+/* How many unions are there? */
+uint64_t auf_count(AtomicUnionFind *auf);
+/*
+ * Merge pairs[2*i] and pairs[2*i+1] for each i < count, splitting the
+ * pairs to `threads' threads (number of CPUs if <= 0)
+ */
+void auf_union_pairs(AtomicUnionFind *auf, const Element *pairs,
+                     uint64_t count, int threads);
+/* Convert into an UnionFind; `auf' will be invalid */
+UnionFind *auf_to_uf(AtomicUnionFind *auf);
+/* Same as uf_from_input(), but add the links with `threads' threads */
+UnionFind *uf_from_input_mt(const char *path, int threads);
 
 /**********************
  * Depth First Search *
@@ -77,15 +190,128 @@ bool dfs_path(AdjList *list, Element from, Element to, ElementOp op);
 
 /*
  * Generate topology order of a specific adjacancy list (e.g. makefile
- * dependencies on src files)
+ * dependencies on src files).  If there are cycles, the order is not a
+ * valid one, and nothing is reported; see csr_topo_new() for that.
  */
 void dfs_order(AdjList *list, ElementOp op);
 
+/* Same as above, but for CSR graphs */
+void csr_dfs_foreach(CsrGraph *graph, Element e, ElementOp op);
+bool csr_dfs_path(CsrGraph *graph, Element from, Element to, ElementOp op);
+void csr_dfs_order(CsrGraph *graph, ElementOp op);
+
 /************************
  * Breadth First Search *
  ************************/
 
 /* Same as dfs_path() but find shortest path */
 bool bfs_path(AdjList *list, Element from, Element to, ElementOp op);
+/* Same as above, but for CSR graphs */
+bool csr_bfs_path(CsrGraph *graph, Element from, Element to, ElementOp op);
+
+/* Parent of elements not reached by csr_bfs() */
+#define CSR_BFS_NONE  ((Element)-1)
+
+/*
+ * Parallel BFS from `root' with `threads' threads (number of CPUs if
+ * <= 0), which switches between top-down and bottom-up for each level.
+ * The graph must be without directions (from csr_from_input()).  Fill
+ * in parent[] (of graph->size entries) with the parent of each element
+ * in the BFS tree: parent[root] is root, and CSR_BFS_NONE if not
+ * reached.  Return the number of elements reached.
+ */
+uint64_t csr_bfs(CsrGraph *graph, Element root, Element *parent, int threads);
+/*
+ * Shortest path from `from' to the root of a parent[] array filled by
+ * csr_bfs().  Same as bfs_path() otherwise.
+ */
+bool bfs_parent_path(const Element *parent, Element from, ElementOp op);
+/* Same as csr_bfs_path(), but with csr_bfs() */
+bool csr_bfs_path_mt(CsrGraph *graph, Element from, Element to,
+                     ElementOp op, int threads);
+
+/********************
+ * Topological Sort *
+ ********************/
+
+/*
+ * Topological sort in levels: elements in one level only have links to
+ * elements of the levels before, so a scheduler (e.g. of makefile
+ * dependencies, where a link means depending on) can run all of a
+ * level at the same time once the levels before are done.
+ */
+typedef struct CsrTopo CsrTopo;
+
+/*
+ * Start sorting `graph' with directions, computing each level with
+ * `threads' threads (number of CPUs if <= 0).  The graph must not be
+ * changed until csr_topo_free().
+ */
+CsrTopo *csr_topo_new(CsrGraph *graph, int threads);
+/*
+ * Compute the next level, and return its elements, with the number of
+ * them in *len.  It is valid until the next call.  Return NULL when all
+ * the elements are returned, or the rest are blocked by cycles.
+ */
+const Element *csr_topo_next(CsrTopo *topo, uint64_t *len);
+/*
+ * After csr_topo_next() returned NULL, check whether it stopped because
+ * of cycles.  If so, call op() for each element of one of the cycles,
+ * in the order of the links, and return true.
+ */
+bool csr_topo_cycle(CsrTopo *topo, ElementOp op);
+/* Free the sorting state */
+void csr_topo_free(CsrTopo *topo);
+
+/************************
+ * Connected Components *
+ ************************/
+
+/* Used internally for elements not labeled yet */
+#define CC_NONE  ((Element)-1)
+
+/*
+ * Label all the elements of an AdjList without directions in one pass:
+ * labels[e] (of list->size entries) is the smallest element of the
+ * component that owns `e'.  Return the number of components.
+ */
+uint64_t adj_components(AdjList *list, Element *labels);
+/*
+ * Same as above, with label propagation in `threads' threads (number
+ * of CPUs if <= 0).  It takes a number of passes over all the links,
+ * so it only pays off with enough CPUs.
+ */
+uint64_t adj_components_mt(AdjList *list, Element *labels, int threads);
+/*
+ * Label the strongly connected components of an AdjList with
+ * directions, with Tarjan's algorithm.  Same labels as
+ * adj_components().  Return the number of SCCs.
+ */
+uint64_t adj_scc(AdjList *list, Element *labels);
+
+/*****************
+ * Shortest Path *
+ *****************/
+
+/* Distance of elements not reached */
+#define CSR_DIST_INF  ((Weight)-1)
+
+/*
+ * Dijkstra from element `from' over the weights of `graph' (each link
+ * weighs 1 if the graph has no weight).  Fill in dist[] and parent[]
+ * (each of graph->size entries) with the distance to each element, and
+ * its parent on the shortest path, in the same way as csr_bfs().  So
+ * bfs_parent_path() gives the path from any element back to `from'.
+ * Return the number of elements reached.
+ */
+uint64_t csr_dijkstra(CsrGraph *graph, Element from, Weight *dist,
+                      Element *parent);
+/*
+ * Find the shortest path from `from' to `to', calling op() for each
+ * element on it in the order from `from' to `to', and put its length
+ * into *distance if not NULL.  Return false if `to' can't be reached.
+ */
+bool csr_dijkstra_path(CsrGraph *graph, Element from, Element to,
+                       ElementOp op, Weight *distance);
 
 #endif /* __GRAPH_H__ */
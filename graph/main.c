@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "graph.h"
 
 int get_int(void)
@@ -166,6 +170,684 @@ static int cmd_bfs_path(const char *file)
     return do_xfs_path(file, bfs_path);
 }
 
+static int cmd_csr(const char *file)
+{
+    CsrGraph *graph = csr_from_input(file);
+
+    if (!graph) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+
+    csr_dump(graph);
+    csr_free(graph);
+
+    return 0;
+}
+
+/* Output path of binary graph converted from `file' */
+static char *bin_path(const char *file)
+{
+    char *path = malloc(strlen(file) + 5);
+
+    sprintf(path, "%s.bin", file);
+    return path;
+}
+
+/* Convert text input `file' into binary file "<file>.bin" */
+static int cmd_convert(const char *file)
+{
+    CsrGraph *graph;
+    char *path;
+    int dir, ret;
+
+    printf("Is the graph directed (0/1)?\n");
+    dir = get_int();
+
+    graph = dir ? csr_dir_from_input(file) : csr_from_input(file);
+    if (!graph) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+
+    path = bin_path(file);
+    ret = csr_save(graph, path);
+    if (ret)
+        printf("Failed to write output file: %s\n", path);
+    else
+        printf("Written to %s\n", path);
+
+    free(path);
+    csr_free(graph);
+
+    return ret;
+}
+
+static int cmd_csr_bin(const char *file)
+{
+    CsrGraph *graph = csr_load(file);
+
+    if (!graph) {
+        printf("Failed to load binary file: %s\n", file);
+        return -1;
+    }
+
+    csr_dump(graph);
+    csr_free(graph);
+
+    return 0;
+}
+
+/* Generate a random graph into `file' */
+static int cmd_gen(const char *file)
+{
+    FILE *out = fopen(file, "w");
+    int size, links, i;
+    Element e1, e2;
+
+    if (!out) {
+        printf("Failed to open output file: %s\n", file);
+        return -1;
+    }
+
+    printf("Please input number of elements:\n");
+    size = get_int();
+    printf("Please input number of links:\n");
+    links = get_int();
+    if (size < 2 || links < 0) {
+        printf("Invalid graph size\n");
+        fclose(out);
+        return -1;
+    }
+
+    fprintf(out, "%d\n", size);
+    for (i = 0; i < links; i++) {
+        e1 = random() % size;
+        do {
+            e2 = random() % size;
+        } while (e2 == e1);
+        fprintf(out, "%"PRIu64",%"PRIu64"\n", e1, e2);
+    }
+    fclose(out);
+
+    return 0;
+}
+
+/*
+ * Generate a weighted grid graph into `file', which looks like a road
+ * network: each element links to its right and lower neighbours with
+ * weights between 1 and 100.
+ */
+static int cmd_gen_grid(const char *file)
+{
+    FILE *out = fopen(file, "w");
+    int width, height, x, y;
+    Element e;
+
+    if (!out) {
+        printf("Failed to open output file: %s\n", file);
+        return -1;
+    }
+
+    printf("Please input width of the grid:\n");
+    width = get_int();
+    printf("Please input height of the grid:\n");
+    height = get_int();
+    if (width < 1 || height < 1 || width * height < 2) {
+        printf("Invalid graph size\n");
+        fclose(out);
+        return -1;
+    }
+
+    fprintf(out, "%d\n", width * height);
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            e = (Element)y * width + x;
+            if (x + 1 < width)
+                fprintf(out, "%"PRIu64",%"PRIu64",%ld\n", e, e + 1,
+                        random() % 100 + 1);
+            if (y + 1 < height)
+                fprintf(out, "%"PRIu64",%"PRIu64",%ld\n", e, e + width,
+                        random() % 100 + 1);
+        }
+    }
+    fclose(out);
+
+    return 0;
+}
+
+/**************
+ * Benchmarks *
+ **************/
+
+static uint64_t bench_count;
+
+static void element_count_op(Element e)
+{
+    bench_count++;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Bytes allocated from the heap */
+static double heap_mb(void)
+{
+    struct mallinfo2 info = mallinfo2();
+
+    return (info.uordblks + info.hblkhd) / 1048576.0;
+}
+
+#define BENCH(name, expr) do {                                      \
+        double start = now_sec();                                   \
+        bench_count = 0;                                            \
+        expr;                                                       \
+        printf("%-20s %10.3f s (%"PRIu64" visited)\n", name,        \
+               now_sec() - start, bench_count);                     \
+    } while (0)
+
+/* Compare traversals on AdjList and CsrGraph */
+static int cmd_bench_csr(const char *file)
+{
+    AdjList *list;
+    CsrGraph *graph;
+    double start, heap;
+    Element last;
+
+    heap = heap_mb();
+    start = now_sec();
+    list = adj_list_from_input(file);
+    if (!list) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+    printf("%-20s %10.3f s, %.1f MB\n", "adj_list load",
+           now_sec() - start, heap_mb() - heap);
+
+    heap = heap_mb();
+    start = now_sec();
+    graph = csr_from_input(file);
+    printf("%-20s %10.3f s, %.1f MB\n", "csr load",
+           now_sec() - start, heap_mb() - heap);
+
+    last = graph->size - 1;
+    BENCH("adj_list dfs", dfs_foreach(list, 0, element_count_op));
+    BENCH("csr dfs", csr_dfs_foreach(graph, 0, element_count_op));
+    BENCH("adj_list dfs_path", dfs_path(list, 0, last, element_count_op));
+    BENCH("csr dfs_path", csr_dfs_path(graph, 0, last, element_count_op));
+    BENCH("adj_list bfs_path", bfs_path(list, 0, last, element_count_op));
+    BENCH("csr bfs_path", csr_bfs_path(graph, 0, last, element_count_op));
+    BENCH("adj_list dfs_order", dfs_order(list, element_count_op));
+    BENCH("csr dfs_order", csr_dfs_order(graph, element_count_op));
+
+    adj_list_free(list);
+    csr_free(graph);
+
+    return 0;
+}
+
+/* Time union find building, with and without parsing the input */
+static int cmd_bench_uf(const char *file)
+{
+    CsrGraph *graph;
+    UnionFind *uf;
+    double start;
+    uint64_t i, j;
+
+    start = now_sec();
+    uf = uf_from_input(file);
+    if (!uf) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+    printf("%-20s %10.3f s\n", "uf_from_input", now_sec() - start);
+    uf_free(uf);
+
+    /* Load the links first, so that only the unions are measured */
+    graph = csr_dir_from_input(file);
+    start = now_sec();
+    uf = uf_new(graph->size);
+    for (i = 0; i < graph->size; i++) {
+        for (j = graph->offsets[i]; j < graph->offsets[i + 1]; j++) {
+            uf_union(uf, i, graph->edges[j]);
+        }
+    }
+    start = now_sec() - start;
+    printf("%-20s %10.3f s, %.1f ns/link, %"PRIu64" unions\n", "uf_union",
+           start, start * 1e9 / graph->nr_edges, uf_count(uf));
+
+    uf_free(uf);
+    csr_free(graph);
+
+    return 0;
+}
+
+/* Scaling of AtomicUnionFind from 1 thread to 8 threads */
+static int cmd_bench_uf_mt(const char *file)
+{
+    CsrGraph *graph = csr_dir_from_input(file);
+    AtomicUnionFind *auf;
+    UnionFind *uf;
+    Element *pairs;
+    double start, base = 0;
+    uint64_t i, j, n = 0;
+    int threads;
+
+    if (!graph) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+
+    pairs = malloc(graph->nr_edges * 2 * sizeof(Element));
+    for (i = 0; i < graph->size; i++) {
+        for (j = graph->offsets[i]; j < graph->offsets[i + 1]; j++) {
+            pairs[n * 2] = i;
+            pairs[n * 2 + 1] = graph->edges[j];
+            n++;
+        }
+    }
+
+    uf = uf_new(graph->size);
+    start = now_sec();
+    for (i = 0; i < n; i++) {
+        uf_union(uf, pairs[i * 2], pairs[i * 2 + 1]);
+    }
+    printf("%-20s %10.3f s\n", "uf_union", now_sec() - start);
+
+    for (threads = 1; threads <= 8; threads *= 2) {
+        auf = auf_new(graph->size);
+        start = now_sec();
+        auf_union_pairs(auf, pairs, n, threads);
+        start = now_sec() - start;
+        if (threads == 1)
+            base = start;
+        printf("auf_union %d threads %7.3f s, speedup %.2f\n", threads,
+               start, base / start);
+        assert(auf_count(auf) == uf_count(uf));
+        auf_free(auf);
+    }
+
+    uf_free(uf);
+    free(pairs);
+    csr_free(graph);
+
+    return 0;
+}
+
+static void bench_dfs_one(const char *name, AdjList *list)
+{
+    printf("%s:\n", name);
+    BENCH("dfs", dfs_foreach(list, 0, element_count_op));
+    BENCH("dfs_path", dfs_path(list, 0, list->size - 1, element_count_op));
+    BENCH("dfs_order", dfs_order(list, element_count_op));
+}
+
+/*
+ * DFS on the input, and on a chain and a fan-out graph of the same
+ * size.  The chain is the deepest graph possible; the fan-out is one
+ * element linked to all the others.
+ */
+static int cmd_bench_dfs(const char *file)
+{
+    AdjList *list = adj_list_from_input(file);
+    uint64_t size, i;
+
+    if (!list) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+    size = list->size;
+    bench_dfs_one("input", list);
+    adj_list_free(list);
+
+    list = adj_list_new(size);
+    for (i = 1; i < size; i++) {
+        adj_link_add(list, i - 1, i);
+    }
+    bench_dfs_one("chain", list);
+    adj_list_free(list);
+
+    list = adj_list_new(size);
+    for (i = 1; i < size; i++) {
+        adj_link_add(list, 0, i);
+    }
+    bench_dfs_one("fan-out", list);
+    adj_list_free(list);
+
+    return 0;
+}
+
+static uint64_t bench_topo_levels;
+
+/* Run the whole topological sort, and count the levels */
+static bool bench_topo(CsrGraph *graph, int threads)
+{
+    CsrTopo *topo = csr_topo_new(graph, threads);
+    const Element *level;
+    uint64_t len, i;
+    bool cycle;
+
+    bench_topo_levels = 0;
+    while ((level = csr_topo_next(topo, &len))) {
+        for (i = 0; i < len; i++) {
+            element_count_op(level[i]);
+        }
+        bench_topo_levels++;
+    }
+    cycle = csr_topo_cycle(topo, element_count_op);
+    csr_topo_free(topo);
+
+    return cycle;
+}
+
+/*
+ * Topological sort of the input with directions, after dropping links
+ * to larger elements so that it is a DAG, then on the input as is to
+ * find a cycle.
+ */
+static int cmd_bench_topo(const char *file)
+{
+    CsrGraph *graph = csr_dir_from_input(file);
+    uint64_t i, j, n = 0, start;
+    char name[32];
+    int threads;
+
+    if (!graph) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+
+    BENCH("cyclic csr_topo", bench_topo(graph, 0));
+
+    for (i = 0; i < graph->size; i++) {
+        start = graph->offsets[i];
+        graph->offsets[i] = n;
+        for (j = start; j < graph->offsets[i + 1]; j++) {
+            if (graph->edges[j] >= i)
+                continue;
+            if (graph->weights)
+                graph->weights[n] = graph->weights[j];
+            graph->edges[n++] = graph->edges[j];
+        }
+    }
+    graph->offsets[graph->size] = graph->nr_edges = n;
+    printf("DAG with %"PRIu64" links\n", n);
+
+    BENCH("csr_dfs_order", csr_dfs_order(graph, element_count_op));
+    for (threads = 1; threads <= 8; threads *= 2) {
+        snprintf(name, sizeof(name), "csr_topo %d threads", threads);
+        BENCH(name, bench_topo(graph, threads));
+    }
+    printf("%"PRIu64" levels\n", bench_topo_levels);
+
+    csr_free(graph);
+
+    return 0;
+}
+
+static Element *bench_labels;
+static Element bench_label;
+
+static void element_label_op(Element e)
+{
+    bench_labels[e] = bench_label;
+}
+
+/*
+ * Label all the components at once, against calling dfs_foreach() for
+ * each component, which is stopped after BENCH_CC_CALLS calls and
+ * estimated for the rest.  Then SCCs of the input with directions.
+ */
+#define BENCH_CC_CALLS  (1000)
+
+static int cmd_bench_cc(const char *file)
+{
+    AdjList *list = adj_list_from_input(file);
+    uint64_t count, calls = 0;
+    double start, spent;
+    char name[32];
+    Element e;
+    int threads;
+
+    if (!list) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+    bench_labels = malloc(list->size * sizeof(Element));
+
+    start = now_sec();
+    count = adj_components(list, bench_labels);
+    printf("%-20s %10.3f s, %"PRIu64" components\n", "adj_components",
+           now_sec() - start, count);
+
+    for (threads = 1; threads <= 8; threads *= 2) {
+        snprintf(name, sizeof(name), "cc_mt %d threads", threads);
+        start = now_sec();
+        adj_components_mt(list, bench_labels, threads);
+        printf("%-20s %10.3f s\n", name, now_sec() - start);
+    }
+
+    for (e = 0; e < list->size; e++) {
+        bench_labels[e] = CC_NONE;
+    }
+    start = now_sec();
+    for (e = 0; e < list->size && calls < BENCH_CC_CALLS; e++) {
+        if (bench_labels[e] != CC_NONE)
+            continue;
+        bench_label = e;
+        dfs_foreach(list, e, element_label_op);
+        calls++;
+    }
+    spent = now_sec() - start;
+    printf("%-20s %10.3f s for %"PRIu64" calls, %.3f s estimated\n",
+           "dfs_foreach", spent, calls, spent / calls * count);
+    adj_list_free(list);
+
+    list = adj_dir_list_from_input(file);
+    start = now_sec();
+    count = adj_scc(list, bench_labels);
+    printf("%-20s %10.3f s, %"PRIu64" SCCs\n", "adj_scc",
+           now_sec() - start, count);
+    adj_list_free(list);
+
+    free(bench_labels);
+
+    return 0;
+}
+
+/*
+ * Dijkstra over all the elements from a few random elements, then
+ * shortest paths between random pairs, which stop early.
+ */
+#define BENCH_SSSP_PATHS  (100)
+
+static int cmd_bench_sssp(const char *file)
+{
+    CsrGraph *graph = csr_from_input(file);
+    Element *parent, from, to;
+    Weight *dist, distance;
+    uint64_t reached;
+    double start;
+    int i;
+
+    if (!graph) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+    dist = malloc(graph->size * sizeof(Weight));
+    parent = malloc(graph->size * sizeof(Element));
+
+    for (i = 0; i < 4; i++) {
+        from = random() % graph->size;
+        start = now_sec();
+        reached = csr_dijkstra(graph, from, dist, parent);
+        printf("%-20s %10.3f s (%"PRIu64" reached)\n", "csr_dijkstra",
+               now_sec() - start, reached);
+    }
+
+    start = now_sec();
+    bench_count = 0;
+    for (i = 0; i < BENCH_SSSP_PATHS; i++) {
+        from = random() % graph->size;
+        to = random() % graph->size;
+        csr_dijkstra_path(graph, from, to, element_count_op, &distance);
+    }
+    printf("%-20s %10.3f s per path (%"PRIu64" elements on %d paths)\n",
+           "csr_dijkstra_path", (now_sec() - start) / BENCH_SSSP_PATHS,
+           bench_count, BENCH_SSSP_PATHS);
+
+    free(dist);
+    free(parent);
+    csr_free(graph);
+
+    return 0;
+}
+
+/*
+ * Startup time: loading text input into AdjList and CsrGraph, against
+ * loading the binary file, which is created if not yet.  Time for the
+ * first traversal is included, since the binary file is only read
+ * when used.
+ */
+static int cmd_bench_load(const char *file)
+{
+    char *path = bin_path(file);
+    AdjList *list;
+    CsrGraph *graph;
+    double start;
+
+    start = now_sec();
+    graph = csr_from_input(file);
+    if (!graph) {
+        printf("Failed to read input file: %s\n", file);
+        free(path);
+        return -1;
+    }
+    BENCH("csr dfs", csr_dfs_order(graph, element_count_op));
+    printf("%-20s %10.3f s\n", "csr total", now_sec() - start);
+
+    if (access(path, R_OK)) {
+        start = now_sec();
+        csr_save(graph, path);
+        printf("%-20s %10.3f s\n", "csr save", now_sec() - start);
+    }
+    csr_free(graph);
+
+    start = now_sec();
+    graph = csr_load(path);
+    if (!graph) {
+        printf("Failed to load binary file: %s\n", path);
+        free(path);
+        return -1;
+    }
+    printf("%-20s %10.3f s\n", "csr load", now_sec() - start);
+    BENCH("csr_bin dfs", csr_dfs_order(graph, element_count_op));
+    printf("%-20s %10.3f s\n", "csr_bin total", now_sec() - start);
+    csr_free(graph);
+
+    /* Last, since freeing all the links slows down later allocations */
+    start = now_sec();
+    list = adj_list_from_input(file);
+    BENCH("adj_list dfs", dfs_order(list, element_count_op));
+    printf("%-20s %10.3f s\n", "adj_list total", now_sec() - start);
+    adj_list_free(list);
+
+    free(path);
+
+    return 0;
+}
+
+/*
+ * Traversed edges per second of csr_bfs() from 1 thread to 8 threads,
+ * for a few random roots.  csr_bfs_path() for a far away element is
+ * listed for comparison.
+ */
+static int cmd_bench_bfs(const char *file)
+{
+    CsrGraph *graph = csr_from_input(file);
+    Element *parent, root, far, e;
+    uint64_t i, edges, depth, max_depth;
+    double start;
+    int threads, n;
+
+    if (!graph) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+    parent = malloc(graph->size * sizeof(Element));
+
+    for (n = 0; n < 4; n++) {
+        root = random() % graph->size;
+        for (threads = 1; threads <= 8; threads *= 2) {
+            start = now_sec();
+            csr_bfs(graph, root, parent, threads);
+            start = now_sec() - start;
+            /* Each link is kept twice in the graph */
+            edges = 0;
+            for (i = 0; i < graph->size; i++) {
+                if (parent[i] != CSR_BFS_NONE)
+                    edges += graph->offsets[i + 1] - graph->offsets[i];
+            }
+            edges /= 2;
+            printf("csr_bfs %d threads %7.3f s, %.1f MTEPS\n", threads,
+                   start, edges / start / 1e6);
+        }
+
+        /* Find the deepest element, to have csr_bfs_path() walk far */
+        far = root;
+        max_depth = 0;
+        for (i = 0; i < graph->size; i++) {
+            if (parent[i] == CSR_BFS_NONE)
+                continue;
+            for (depth = 0, e = i; parent[e] != e; depth++)
+                e = parent[e];
+            if (depth > max_depth) {
+                max_depth = depth;
+                far = i;
+            }
+        }
+        BENCH("csr_bfs_path", csr_bfs_path(graph, far, root,
+                                            element_count_op));
+        printf("\n");
+    }
+
+    free(parent);
+    csr_free(graph);
+
+    return 0;
+}
+
+/* Parsing throughput of the input file into CsrGraph */
+static int cmd_bench_parse(const char *file)
+{
+    CsrGraph *graph;
+    struct stat st;
+    double start, mb;
+    int threads;
+
+    if (stat(file, &st)) {
+        printf("Failed to read input file: %s\n", file);
+        return -1;
+    }
+    mb = st.st_size / 1048576.0;
+
+    for (threads = 1; threads <= 8; threads *= 2) {
+        start = now_sec();
+        graph = csr_dir_from_input_mt(file, threads);
+        start = now_sec() - start;
+        printf("csr parse %d threads %7.3f s, %.1f MB/s, %"PRIu64" links\n",
+               threads, start, mb / start, graph->nr_edges);
+        csr_free(graph);
+    }
+
+    return 0;
+}
+
 typedef struct {
     char *cmd_name;
     CmdFn cmd_fn;
@@ -178,6 +860,21 @@ CmdEntry cmd_list[] = {
     { "dfs_path", cmd_dfs_path },
     { "dfs_order", cmd_dfs_order },
     { "bfs_path", cmd_bfs_path },
+    { "csr", cmd_csr },
+    { "gen", cmd_gen },
+    { "gen_grid", cmd_gen_grid },
+    { "convert", cmd_convert },
+    { "csr_bin", cmd_csr_bin },
+    { "bench_csr", cmd_bench_csr },
+    { "bench_uf", cmd_bench_uf },
+    { "bench_uf_mt", cmd_bench_uf_mt },
+    { "bench_parse", cmd_bench_parse },
+    { "bench_load", cmd_bench_load },
+    { "bench_bfs", cmd_bench_bfs },
+    { "bench_dfs", cmd_bench_dfs },
+    { "bench_topo", cmd_bench_topo },
+    { "bench_cc", cmd_bench_cc },
+    { "bench_sssp", cmd_bench_sssp },
     { NULL, NULL },
 };
 
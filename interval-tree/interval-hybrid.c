@@ -0,0 +1,482 @@
+/*
+ * An interval set mixing interval tree ranges and bitmaps.
+ *
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Authors:
+ *  Peter Xu <peterx@redhat.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "interval-hybrid.h"
+
+/*
+ * Values of a chunk kept as bitmap never show up in the tree.  The
+ * bitmaps are kept in an array sorted by base, like the container keys
+ * of roaring bitmaps; there should be much less bitmaps than values.
+ */
+
+#define  IT_HYBRID_MASK   ((ITValue)IT_HYBRID_CHUNK - 1)
+#define  IT_HYBRID_WORDS  (IT_HYBRID_CHUNK / 64)
+
+typedef struct ITBitmap ITBitmap;
+
+struct ITBitmap {
+    /* First value of the chunk */
+    ITValue base;
+    uint64_t bits[IT_HYBRID_WORDS];
+};
+
+struct ITHybrid {
+    ITTree *tree;
+    ITBitmap **bitmaps;
+    size_t nr_bitmaps, max_bitmaps;
+    /* Returned by it_hybrid_find() for ranges in bitmaps */
+    ITRange found;
+};
+
+static inline ITValue it_chunk_base(ITValue value)
+{
+    return value & ~IT_HYBRID_MASK;
+}
+
+static inline ITValue it_chunk_last(ITValue base)
+{
+    return base + IT_HYBRID_MASK;
+}
+
+/***********
+ * Bitmaps *
+ ***********/
+
+/* Set or clear bits [first, last] */
+static void it_bitmap_fill(ITBitmap *bitmap, unsigned int first,
+                           unsigned int last, bool set)
+{
+    unsigned int i;
+    uint64_t mask;
+
+    for (i = first / 64; i <= last / 64; i++) {
+        mask = ~0ULL;
+        if (i == first / 64) {
+            mask &= ~0ULL << (first % 64);
+        }
+        if (i == last / 64) {
+            mask &= ~0ULL >> (63 - last % 64);
+        }
+        if (set) {
+            bitmap->bits[i] |= mask;
+        } else {
+            bitmap->bits[i] &= ~mask;
+        }
+    }
+}
+
+/*
+ * Find the first bit in [first, last] which is `set', return -1 if
+ * there is none.
+ */
+static int it_bitmap_find(ITBitmap *bitmap, unsigned int first,
+                          unsigned int last, bool set)
+{
+    unsigned int i, bit;
+    uint64_t word;
+
+    for (i = first / 64; i <= last / 64; i++) {
+        word = set ? bitmap->bits[i] : ~bitmap->bits[i];
+        if (i == first / 64) {
+            word &= ~0ULL << (first % 64);
+        }
+        if (word) {
+            bit = i * 64 + __builtin_ctzll(word);
+            return bit <= last ? (int)bit : -1;
+        }
+    }
+
+    return -1;
+}
+
+/* Find the last bit no larger than `from' which is `set', or -1 */
+static int it_bitmap_find_rev(ITBitmap *bitmap, unsigned int from, bool set)
+{
+    int i;
+    uint64_t word;
+
+    for (i = from / 64; i >= 0; i--) {
+        word = set ? bitmap->bits[i] : ~bitmap->bits[i];
+        if (i == (int)(from / 64)) {
+            word &= ~0ULL >> (63 - from % 64);
+        }
+        if (word) {
+            return i * 64 + 63 - __builtin_clzll(word);
+        }
+    }
+
+    return -1;
+}
+
+/* Find the first run of set bits at or after `from' */
+static bool it_bitmap_next_run(ITBitmap *bitmap, unsigned int from,
+                               unsigned int *first, unsigned int *last)
+{
+    int bit;
+
+    if (from > IT_HYBRID_MASK) {
+        return false;
+    }
+    bit = it_bitmap_find(bitmap, from, IT_HYBRID_MASK, true);
+    if (bit < 0) {
+        return false;
+    }
+    *first = bit;
+    bit = it_bitmap_find(bitmap, bit, IT_HYBRID_MASK, false);
+    *last = bit < 0 ? IT_HYBRID_MASK : bit - 1;
+
+    return true;
+}
+
+/* Number of runs of set bits, i.e. ranges the bitmap would take */
+static unsigned int it_bitmap_runs(ITBitmap *bitmap)
+{
+    unsigned int i, runs = 0;
+    uint64_t word, carry = 0;
+
+    for (i = 0; i < IT_HYBRID_WORDS; i++) {
+        word = bitmap->bits[i];
+        runs += __builtin_popcountll(word & ~((word << 1) | carry));
+        carry = word >> 63;
+    }
+
+    return runs;
+}
+
+/*********************
+ * Chunk conversions *
+ *********************/
+
+/* Index of the first bitmap with base no less than `base' */
+static size_t it_hybrid_index(ITHybrid *hybrid, ITValue base)
+{
+    size_t lo = 0, hi = hybrid->nr_bitmaps, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (hybrid->bitmaps[mid]->base < base) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static ITBitmap *it_hybrid_bitmap(ITHybrid *hybrid, ITValue base)
+{
+    size_t i = it_hybrid_index(hybrid, base);
+
+    if (i < hybrid->nr_bitmaps && hybrid->bitmaps[i]->base == base) {
+        return hybrid->bitmaps[i];
+    }
+    return NULL;
+}
+
+/*
+ * Move chunk `base' from the tree into a bitmap if it has too many
+ * ranges.  It is only an optimization, so just keep the ranges if we
+ * failed to allocate.
+ */
+static void it_hybrid_check_dense(ITHybrid *hybrid, ITValue base)
+{
+    ITValue last = it_chunk_last(base);
+    ITBitmap *bitmap, **bitmaps;
+    ITRange *range;
+    ITIter iter;
+    size_t i, max;
+    int n = 0;
+
+    it_tree_iter_init(hybrid->tree, &iter, base, last);
+    while (it_tree_iter_next(&iter)) {
+        if (++n > IT_HYBRID_MAX_RANGES) {
+            break;
+        }
+    }
+    if (n <= IT_HYBRID_MAX_RANGES) {
+        return;
+    }
+
+    if (hybrid->nr_bitmaps == hybrid->max_bitmaps) {
+        max = hybrid->max_bitmaps ? hybrid->max_bitmaps * 2 : 16;
+        bitmaps = realloc(hybrid->bitmaps, sizeof(*bitmaps) * max);
+        if (!bitmaps) {
+            return;
+        }
+        hybrid->bitmaps = bitmaps;
+        hybrid->max_bitmaps = max;
+    }
+    bitmap = calloc(1, sizeof(*bitmap));
+    if (!bitmap) {
+        return;
+    }
+    bitmap->base = base;
+
+    it_tree_iter_init(hybrid->tree, &iter, base, last);
+    while ((range = it_tree_iter_next(&iter))) {
+        it_bitmap_fill(bitmap,
+                       range->start < base ? 0 : range->start - base,
+                       range->end > last ? IT_HYBRID_MASK : range->end - base,
+                       true);
+    }
+    /*
+     * No range can cover the whole chunk since there are many, so
+     * this will only trim or drop ranges and never allocates.
+     */
+    it_tree_remove(hybrid->tree, base, last);
+
+    i = it_hybrid_index(hybrid, base);
+    memmove(&hybrid->bitmaps[i + 1], &hybrid->bitmaps[i],
+            sizeof(bitmap) * (hybrid->nr_bitmaps - i));
+    hybrid->bitmaps[i] = bitmap;
+    hybrid->nr_bitmaps++;
+}
+
+/*
+ * Move the i-th bitmap back to the tree if it has few enough ranges.
+ * If we failed to allocate tree nodes, keep the bitmap.
+ */
+static void it_hybrid_check_sparse(ITHybrid *hybrid, size_t i)
+{
+    ITBitmap *bitmap = hybrid->bitmaps[i];
+    unsigned int first, last, failed, from = 0;
+
+    if (it_bitmap_runs(bitmap) > IT_HYBRID_MAX_RANGES / 2) {
+        return;
+    }
+
+    while (it_bitmap_next_run(bitmap, from, &first, &last)) {
+        if (it_tree_insert(hybrid->tree, bitmap->base + first,
+                           bitmap->base + last)) {
+            /*
+             * Roll back.  With more than one run, none of them can
+             * be merged on both sides, so this never allocates.
+             */
+            failed = first;
+            from = 0;
+            while (it_bitmap_next_run(bitmap, from, &first, &last) &&
+                   first < failed) {
+                it_tree_remove(hybrid->tree, bitmap->base + first,
+                               bitmap->base + last);
+                from = last + 1;
+            }
+            return;
+        }
+        from = last + 1;
+    }
+
+    hybrid->nr_bitmaps--;
+    memmove(&hybrid->bitmaps[i], &hybrid->bitmaps[i + 1],
+            sizeof(bitmap) * (hybrid->nr_bitmaps - i));
+    free(bitmap);
+}
+
+/*********************
+ * Public interfaces *
+ *********************/
+
+ITHybrid *it_hybrid_new(void)
+{
+    ITHybrid *hybrid = calloc(1, sizeof(*hybrid));
+
+    if (!hybrid) {
+        return NULL;
+    }
+    hybrid->tree = it_tree_new();
+    if (!hybrid->tree) {
+        free(hybrid);
+        return NULL;
+    }
+
+    return hybrid;
+}
+
+/* Find in the bitmap chunk only; [start, end] must be within it */
+static ITRange *it_hybrid_find_bitmap(ITHybrid *hybrid, ITBitmap *bitmap,
+                                      ITValue start, ITValue end)
+{
+    int bit = it_bitmap_find(bitmap, start - bitmap->base,
+                             end - bitmap->base, true);
+
+    if (bit < 0) {
+        return NULL;
+    }
+    hybrid->found.start = bitmap->base +
+        it_bitmap_find_rev(bitmap, bit, false) + 1;
+    bit = it_bitmap_find(bitmap, bit, IT_HYBRID_MASK, false);
+    hybrid->found.end = bitmap->base + (bit < 0 ? IT_HYBRID_MASK : bit - 1);
+
+    return &hybrid->found;
+}
+
+ITRange *it_hybrid_find(ITHybrid *hybrid, ITValue start, ITValue end)
+{
+    ITBitmap *bitmap;
+    ITRange *range;
+    size_t i;
+
+    assert(hybrid);
+
+    /* Fast path: the whole range is either in the tree or a bitmap */
+    if (it_chunk_base(start) == it_chunk_base(end)) {
+        bitmap = it_hybrid_bitmap(hybrid, it_chunk_base(start));
+        if (bitmap) {
+            return it_hybrid_find_bitmap(hybrid, bitmap, start, end);
+        }
+        return it_tree_find(hybrid->tree, start, end);
+    }
+
+    range = it_tree_find(hybrid->tree, start, end);
+    if (range) {
+        return range;
+    }
+
+    i = it_hybrid_index(hybrid, it_chunk_base(start));
+    for (; i < hybrid->nr_bitmaps && hybrid->bitmaps[i]->base <= end; i++) {
+        bitmap = hybrid->bitmaps[i];
+        range = it_hybrid_find_bitmap(hybrid, bitmap,
+                                      start < bitmap->base ?
+                                      bitmap->base : start,
+                                      end > it_chunk_last(bitmap->base) ?
+                                      it_chunk_last(bitmap->base) : end);
+        if (range) {
+            return range;
+        }
+    }
+
+    return NULL;
+}
+
+ITRange *it_hybrid_find_value(ITHybrid *hybrid, ITValue value)
+{
+    return it_hybrid_find(hybrid, value, value);
+}
+
+/*
+ * Return the end of the segment of [start, end] that begins at `start'
+ * and is either within one bitmap chunk, or all in the tree.  Set
+ * `bitmap' to the bitmap, or NULL for the tree.
+ */
+static ITValue it_hybrid_segment(ITHybrid *hybrid, ITValue start,
+                                 ITValue end, ITBitmap **bitmap)
+{
+    size_t i = it_hybrid_index(hybrid, it_chunk_base(start));
+    ITBitmap *next = i < hybrid->nr_bitmaps ? hybrid->bitmaps[i] : NULL;
+    ITValue e;
+
+    if (next && next->base <= start) {
+        *bitmap = next;
+        e = it_chunk_last(next->base);
+        return e > end ? end : e;
+    }
+
+    *bitmap = NULL;
+    return (next && next->base <= end) ? next->base - 1 : end;
+}
+
+/*
+ * Split [start, end] into the parts in the tree and the parts in
+ * bitmaps, and insert or remove each of them.  Tree nodes are reserved
+ * first, so that nothing is changed unless all the parts can be.
+ * Chunks are converted at the end, when the set is complete again.
+ */
+static int it_hybrid_update(ITHybrid *hybrid, ITValue start, ITValue end,
+                            bool insert)
+{
+    ITBitmap *bitmap;
+    ITValue s, e;
+    unsigned int n = 0;
+    size_t i;
+    int ret;
+
+    for (s = start; ; s = e + 1) {
+        e = it_hybrid_segment(hybrid, s, end, &bitmap);
+        n += !bitmap;
+        if (e == end) {
+            break;
+        }
+    }
+    ret = it_tree_reserve(hybrid->tree, n);
+    if (ret) {
+        return ret;
+    }
+
+    for (s = start; ; s = e + 1) {
+        e = it_hybrid_segment(hybrid, s, end, &bitmap);
+        if (bitmap) {
+            it_bitmap_fill(bitmap, s - bitmap->base, e - bitmap->base,
+                           insert);
+        } else {
+            if (insert) {
+                ret = it_tree_insert(hybrid->tree, s, e);
+            } else {
+                ret = it_tree_remove(hybrid->tree, s, e);
+            }
+            assert(ret == IT_OK);
+        }
+        if (e == end) {
+            break;
+        }
+    }
+
+    for (s = start; ; s = e + 1) {
+        e = it_hybrid_segment(hybrid, s, end, &bitmap);
+        if (bitmap) {
+            i = it_hybrid_index(hybrid, bitmap->base);
+            it_hybrid_check_sparse(hybrid, i);
+        } else {
+            /* Only the chunks on both ends could have more ranges */
+            it_hybrid_check_dense(hybrid, it_chunk_base(s));
+            if (it_chunk_base(e) != it_chunk_base(s)) {
+                it_hybrid_check_dense(hybrid, it_chunk_base(e));
+            }
+        }
+        if (e == end) {
+            return IT_OK;
+        }
+    }
+}
+
+int it_hybrid_insert(ITHybrid *hybrid, ITValue start, ITValue end)
+{
+    assert(hybrid);
+    assert(start <= end);
+
+    if (it_hybrid_find(hybrid, start, end)) {
+        return IT_ERR_OVERLAP;
+    }
+
+    return it_hybrid_update(hybrid, start, end, true);
+}
+
+int it_hybrid_remove(ITHybrid *hybrid, ITValue start, ITValue end)
+{
+    assert(hybrid);
+
+    return it_hybrid_update(hybrid, start, end, false);
+}
+
+void it_hybrid_destroy(ITHybrid *hybrid)
+{
+    size_t i;
+
+    for (i = 0; i < hybrid->nr_bitmaps; i++) {
+        free(hybrid->bitmaps[i]);
+    }
+    free(hybrid->bitmaps);
+    it_tree_destroy(hybrid->tree);
+    free(hybrid);
+}
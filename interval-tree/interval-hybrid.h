@@ -0,0 +1,113 @@
+/*
+ * An interval set mixing interval tree ranges and bitmaps.
+ *
+ * Copyright 2018 Red Hat, Inc.
+ *
+ * Authors:
+ *  Peter Xu <peterx@redhat.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ */
+#ifndef INTERVAL_HYBRID_H
+#define INTERVAL_HYBRID_H
+
+/*
+ * ITTree keeps one node per range, which is good when ranges are
+ * mostly continuous, but wastes a lot of memory when they are highly
+ * fragmented (e.g. every other page is dirty).  ITHybrid splits the
+ * value space into chunks of IT_HYBRID_CHUNK values, and keeps each
+ * chunk either as ranges in an ITTree, or as a bitmap when the chunk
+ * contains too many ranges.  Chunks are switched back and forth
+ * automatically when ranges are inserted or removed.
+ *
+ * Same as ITTree, there is no thread protection.
+ */
+
+#include "interval-tree.h"
+
+/* Number of values covered by one bitmap; must be power of 2 */
+#define  IT_HYBRID_CHUNK         (4096)
+/*
+ * Switch a chunk to bitmap when it has more ranges than this, which is
+ * about when the tree nodes take more memory than the bitmap.  Switch
+ * back when it has no more than half of it.
+ */
+#define  IT_HYBRID_MAX_RANGES    (10)
+
+typedef struct ITHybrid ITHybrid;
+
+/**
+ * it_hybrid_new:
+ *
+ * Create a new hybrid interval set.
+ *
+ * Returns: the set pointer when succeeded, or NULL if error.
+ */
+ITHybrid *it_hybrid_new(void);
+
+/**
+ * it_hybrid_insert:
+ *
+ * @hybrid: the set to insert
+ * @start: the start of range, inclusive
+ * @end: the end of range, inclusive
+ *
+ * Same as it_tree_insert().
+ *
+ * Return: 0 if succeeded, or <0 if error.
+ */
+int it_hybrid_insert(ITHybrid *hybrid, ITValue start, ITValue end);
+
+/**
+ * it_hybrid_remove:
+ *
+ * @hybrid: the set to remove range from
+ * @start: the start of range, inclusive
+ * @end: the end of range, inclusive
+ *
+ * Same as it_tree_remove().
+ *
+ * Return: 0 if succeeded, or <0 if error.
+ */
+int it_hybrid_remove(ITHybrid *hybrid, ITValue start, ITValue end);
+
+/**
+ * it_hybrid_find:
+ *
+ * @hybrid: the set to search from
+ * @start: the start of range, inclusive
+ * @end: the end of range, inclusive
+ *
+ * Similar to it_tree_find().  Note that a range kept in bitmap is
+ * reported only up to the chunk boundary, so the returned range may
+ * not be the whole continuous range of the set.
+ *
+ * Return: ITRange if found, or NULL if not found.  The returned
+ * ITRange is only valid until the next call on @hybrid.
+ */
+ITRange *it_hybrid_find(ITHybrid *hybrid, ITValue start, ITValue end);
+
+/**
+ * it_hybrid_find_value:
+ *
+ * @hybrid: the set to search from
+ * @value: the value to find
+ *
+ * Similar to it_hybrid_find(), but it tries to find range (value, value).
+ *
+ * Return: same as it_hybrid_find().
+ */
+ITRange *it_hybrid_find_value(ITHybrid *hybrid, ITValue value);
+
+/**
+ * it_hybrid_destroy:
+ *
+ * @hybrid: the set to destroy
+ *
+ * Destroy an existing hybrid interval set.
+ *
+ * Return: None.
+ */
+void it_hybrid_destroy(ITHybrid *hybrid);
+
+#endif
@@ -1,5 +1,5 @@
 /*
- * An very simplified interval tree implementation based on GTree.
+ * An very simplified interval tree implementation based on AVL tree.
  *
  * Copyright 2018 Red Hat, Inc.
  *
@@ -9,200 +9,540 @@
  * This work is licensed under the terms of the GNU GPL, version 2 or later.
  */
 
-#include <glib.h>
+#include <assert.h>
+#include <stdlib.h>
 #include "interval-tree.h"
 
 /*
- * Each element of the internal tree is an ITRange.  It is shared
- * between the key and value of the element, or we can see it a tree
- * with keys only but no values.
+ * Each element of the internal tree is an ITNode, which embeds the
+ * ITRange it covers.  Ranges in the tree never overlap (adjacent ones
+ * are merged), so ordering them by start also orders them by end, and
+ * a plain binary search is enough to find overlaps.  We don't need to
+ * keep the max end of subtrees like a generic interval tree does.
+ *
+ * Nodes are allocated from chunks of IT_CHUNK_NODES nodes each, and
+ * freed nodes are kept in a free list for reuse.  Chunks are only
+ * released when the tree is destroyed.
  */
 
+#define  IT_CHUNK_NODES  (256)
+
+typedef struct ITChunk ITChunk;
+
+struct ITNode {
+    ITRange range;
+    ITNode *left, *right, *parent;
+    int height;
+};
+
+struct ITChunk {
+    ITChunk *next;
+    ITNode nodes[IT_CHUNK_NODES];
+};
+
 struct ITTree {
-    GTree *tree;
+    ITNode *root;
+    /* Freed nodes, linked with ITNode.parent */
+    ITNode *free_nodes;
+    /* All the allocated chunks; the head one could be partially used */
+    ITChunk *chunks;
+    int chunk_used;
 };
 
-static int it_tree_compare(gconstpointer a, gconstpointer b, gpointer data)
+/******************
+ * Node allocator *
+ ******************/
+
+static ITNode *it_node_alloc(ITTree *tree)
 {
-    const ITRange *r1 = a, *r2 = b;
+    ITChunk *chunk;
+    ITNode *node;
 
-    if (r1->start > r2->end) {
-        return 1;
+    if (tree->free_nodes) {
+        node = tree->free_nodes;
+        tree->free_nodes = node->parent;
+        return node;
     }
 
-    if (r1->end < r2->start) {
-        return -1;
+    if (!tree->chunks || tree->chunk_used == IT_CHUNK_NODES) {
+        chunk = malloc(sizeof(*chunk));
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = tree->chunks;
+        tree->chunks = chunk;
+        tree->chunk_used = 0;
     }
 
-    /* Overlapped */
-    return 0;
+    return &tree->chunks->nodes[tree->chunk_used++];
 }
 
-/* Find out intersection of range A and B, put into OUT */
-static inline void it_range_and(ITRange *out, ITRange *a, ITRange *b)
+static void it_node_free(ITTree *tree, ITNode *node)
 {
-    out->start = MAX(a->start, b->start);
-    out->end = MIN(a->end, b->end);
+    node->parent = tree->free_nodes;
+    tree->free_nodes = node;
 }
 
-static inline gboolean it_range_equal(ITRange *a, ITRange *b)
+/*****************
+ * AVL internals *
+ *****************/
+
+static inline int it_node_height(ITNode *node)
 {
-    return a->start == b->start && a->end == b->end;
+    return node ? node->height : 0;
 }
 
-/* Whether ITRange A is superset of B? */
-static inline gboolean it_range_cover(ITRange *a, ITRange *b)
+static inline void it_node_update(ITNode *node)
 {
-    return a->start <= b->start && a->end >= b->end;
+    int l = it_node_height(node->left), r = it_node_height(node->right);
+
+    node->height = (l > r ? l : r) + 1;
 }
 
-ITTree *it_tree_new(void)
+/* Make `new' the child of `parent' where `old' was */
+static inline void it_tree_replace_child(ITTree *tree, ITNode *parent,
+                                         ITNode *old, ITNode *new)
+{
+    if (!parent) {
+        tree->root = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+}
+
+static ITNode *it_node_rotate_left(ITTree *tree, ITNode *node)
 {
-    ITTree *ittree = g_new0(ITTree, 1);
+    ITNode *right = node->right;
+
+    node->right = right->left;
+    if (right->left) {
+        right->left->parent = node;
+    }
+    right->parent = node->parent;
+    it_tree_replace_child(tree, node->parent, node, right);
+    right->left = node;
+    node->parent = right;
 
-    /* We don't have values actually, no need to free */
-    ittree->tree = g_tree_new_full(it_tree_compare, NULL, g_free, NULL);
+    it_node_update(node);
+    it_node_update(right);
 
-    return ittree;
+    return right;
 }
 
-ITRange *it_tree_find(ITTree *tree, ITValue start, ITValue end)
+static ITNode *it_node_rotate_right(ITTree *tree, ITNode *node)
 {
-    ITRange range;
+    ITNode *left = node->left;
 
-    g_assert(tree);
+    node->left = left->right;
+    if (left->right) {
+        left->right->parent = node;
+    }
+    left->parent = node->parent;
+    it_tree_replace_child(tree, node->parent, node, left);
+    left->right = node;
+    node->parent = left;
 
-    range.start = start;
-    range.end = end;
+    it_node_update(node);
+    it_node_update(left);
 
-    return g_tree_lookup(tree->tree, &range);
+    return left;
 }
 
-ITRange *it_tree_find_value(ITTree *tree, ITValue value)
+/*
+ * Walk up from `node' to fix heights and balances after its subtree
+ * has changed.  Stop as soon as one subtree keeps its old height,
+ * since nothing above could have been changed.
+ */
+static void it_tree_rebalance(ITTree *tree, ITNode *node)
 {
-    return it_tree_find(tree, value, value);
+    int old, balance;
+
+    while (node) {
+        old = node->height;
+        it_node_update(node);
+        balance = it_node_height(node->left) - it_node_height(node->right);
+
+        if (balance > 1) {
+            if (it_node_height(node->left->left) <
+                it_node_height(node->left->right)) {
+                it_node_rotate_left(tree, node->left);
+            }
+            node = it_node_rotate_right(tree, node);
+        } else if (balance < -1) {
+            if (it_node_height(node->right->right) <
+                it_node_height(node->right->left)) {
+                it_node_rotate_right(tree, node->right);
+            }
+            node = it_node_rotate_left(tree, node);
+        }
+
+        if (node->height == old) {
+            break;
+        }
+        node = node->parent;
+    }
 }
 
-static inline void it_tree_insert_internal(GTree *gtree, ITRange *range)
+/* Link new leaf `node' as the `left' or right child of `parent' */
+static void it_tree_link(ITTree *tree, ITNode *parent, bool left,
+                         ITNode *node)
 {
-    /* Key and value are sharing the same range data */
-    g_tree_insert(gtree, range, range);
+    node->left = node->right = NULL;
+    node->parent = parent;
+    node->height = 1;
+
+    if (!parent) {
+        tree->root = node;
+        return;
+    }
+    if (left) {
+        parent->left = node;
+    } else {
+        parent->right = node;
+    }
+    it_tree_rebalance(tree, parent);
 }
 
-int it_tree_insert(ITTree *tree, ITValue start, ITValue end)
+static void it_tree_unlink(ITTree *tree, ITNode *node)
 {
-    ITRange range, *new, *overlap;
-    GTree *gtree;
+    ITNode *parent = node->parent, *child, *next, *start;
+
+    if (node->left && node->right) {
+        /*
+         * Move the successor node to where `node' is, rather than
+         * copying the range over, so that pointers to other nodes
+         * (e.g. during it_tree_remove()) are kept valid.
+         */
+        next = node->right;
+        while (next->left) {
+            next = next->left;
+        }
+        if (next->parent == node) {
+            start = next;
+        } else {
+            start = next->parent;
+            start->left = next->right;
+            if (next->right) {
+                next->right->parent = start;
+            }
+            next->right = node->right;
+            node->right->parent = next;
+        }
+        next->left = node->left;
+        node->left->parent = next;
+        next->height = node->height;
+        next->parent = parent;
+        it_tree_replace_child(tree, parent, node, next);
+        it_tree_rebalance(tree, start);
+        return;
+    }
 
-    g_assert(tree);
-    g_assert(start <= end);
+    child = node->left ? node->left : node->right;
+    if (child) {
+        child->parent = parent;
+    }
+    it_tree_replace_child(tree, parent, node, child);
+    it_tree_rebalance(tree, parent);
+}
 
-    gtree = tree->tree;
+static ITNode *it_node_next(ITNode *node)
+{
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        return node;
+    }
+    while (node->parent && node->parent->right == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
 
-    range.start = start;
-    range.end = end;
+/* Find the first range that ends at or after `value' */
+static ITNode *it_tree_lower_bound(ITTree *tree, ITValue value)
+{
+    ITNode *node = tree->root, *found = NULL;
 
-    /* We don't allow to insert range that overlaps with existings */
-    if (g_tree_lookup(gtree, &range)) {
-        return IT_ERR_OVERLAP;
+    while (node) {
+        if (node->range.end >= value) {
+            found = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
     }
 
-    /* Merge left adjacent range */
-    overlap = it_tree_find_value(tree, start - 1);
-    if (overlap) {
-        range.start = overlap->start;
-        g_tree_remove(gtree, overlap);
+    return found;
+}
+
+/*********************
+ * Public interfaces *
+ *********************/
+
+ITTree *it_tree_new(void)
+{
+    return calloc(1, sizeof(ITTree));
+}
+
+ITRange *it_tree_find(ITTree *tree, ITValue start, ITValue end)
+{
+    ITNode *node;
+
+    assert(tree);
+
+    node = tree->root;
+    while (node) {
+        if (node->range.start > end) {
+            node = node->left;
+        } else if (node->range.end < start) {
+            node = node->right;
+        } else {
+            return &node->range;
+        }
     }
 
-    /* Merge right adjacent range */
-    overlap = it_tree_find_value(tree, end + 1);
-    if (overlap) {
-        range.end = overlap->end;
-        g_tree_remove(gtree, overlap);
+    return NULL;
+}
+
+ITRange *it_tree_find_value(ITTree *tree, ITValue value)
+{
+    return it_tree_find(tree, value, value);
+}
+
+int it_tree_insert(ITTree *tree, ITValue start, ITValue end)
+{
+    ITNode *node, *parent = NULL, *prev = NULL, *next = NULL;
+    bool left = false;
+
+    assert(tree);
+    assert(start <= end);
+
+    /*
+     * Find the place to insert, remembering the closest ranges on
+     * both sides on the way down: they are the only ones we could
+     * merge with.
+     */
+    node = tree->root;
+    while (node) {
+        parent = node;
+        if (node->range.start > end) {
+            next = node;
+            left = true;
+            node = node->left;
+        } else if (node->range.end < start) {
+            prev = node;
+            left = false;
+            node = node->right;
+        } else {
+            /* We don't allow to insert range that overlaps with existings */
+            return IT_ERR_OVERLAP;
+        }
+    }
+
+    /* Both checks are written to avoid overflows of start - 1 or end + 1 */
+    if (prev && prev->range.end != start - 1) {
+        prev = NULL;
+    }
+    if (next && next->range.start - 1 != end) {
+        next = NULL;
     }
 
-    new = g_new0(ITRange, 1);
-    new->start = range.start;
-    new->end = range.end;
-    it_tree_insert_internal(gtree, new);
+    if (prev && next) {
+        /* Merge both adjacent ranges into the left one */
+        prev->range.end = next->range.end;
+        it_tree_unlink(tree, next);
+        it_node_free(tree, next);
+    } else if (prev) {
+        prev->range.end = end;
+    } else if (next) {
+        next->range.start = start;
+    } else {
+        node = it_node_alloc(tree);
+        if (!node) {
+            return IT_ERR_NOMEM;
+        }
+        node->range.start = start;
+        node->range.end = end;
+        it_tree_link(tree, parent, left, node);
+    }
 
     return IT_OK;
 }
 
-static gboolean it_tree_traverse(gpointer key, gpointer value,
-                                gpointer data)
+void it_tree_foreach(ITTree *tree, it_tree_iterator iterator)
 {
-    it_tree_iterator iterator = data;
-    ITRange *range = key;
+    ITNode *node;
 
-    g_assert(key == value);
+    assert(tree && iterator);
 
-    return iterator(range->start, range->end);
+    node = tree->root;
+    if (!node) {
+        return;
+    }
+    while (node->left) {
+        node = node->left;
+    }
+    for (; node; node = it_node_next(node)) {
+        if (iterator(node->range.start, node->range.end)) {
+            break;
+        }
+    }
 }
 
-void it_tree_foreach(ITTree *tree, it_tree_iterator iterator)
+void it_tree_iter_init(ITTree *tree, ITIter *iter, ITValue start,
+                       ITValue end)
 {
-    g_assert(tree && iterator);
-    g_tree_foreach(tree->tree, it_tree_traverse, iterator);
+    assert(tree && iter);
+
+    iter->node = it_tree_lower_bound(tree, start);
+    iter->end = end;
 }
 
-/* Remove subset `range', which is part of `overlap'. */
-static void it_tree_remove_subset(GTree *gtree, const ITRange *overlap,
-                                  const ITRange *range)
+ITRange *it_tree_iter_next(ITIter *iter)
 {
-    ITRange *range1, *range2;
+    ITNode *node = iter->node;
 
-    if (overlap->start < range->start) {
-        range1 = g_new0(ITRange, 1);
-        range1->start = overlap->start;
-        range1->end = range->start - 1;
-    } else {
-        range1 = NULL;
-    }
-    if (range->end < overlap->end) {
-        range2 = g_new0(ITRange, 1);
-        range2->start = range->end + 1;
-        range2->end = overlap->end;
-    } else {
-        range2 = NULL;
+    if (!node || node->range.start > iter->end) {
+        return NULL;
     }
+    iter->node = it_node_next(node);
+
+    return &node->range;
+}
+
+void it_tree_foreach_range(ITTree *tree, ITValue start, ITValue end,
+                           it_tree_range_iterator iterator, void *opaque)
+{
+    ITIter iter;
+    ITRange *range;
 
-    g_tree_remove(gtree, overlap);
+    assert(iterator);
 
-    if (range1) {
-        it_tree_insert_internal(gtree, range1);
+    it_tree_iter_init(tree, &iter, start, end);
+    while ((range = it_tree_iter_next(&iter))) {
+        if (iterator(range->start, range->end, opaque)) {
+            break;
+        }
     }
-    if (range2) {
-        it_tree_insert_internal(gtree, range2);
+}
+
+int it_tree_find_all(ITTree *tree, ITValue start, ITValue end,
+                     ITRange *ranges, int max)
+{
+    ITIter iter;
+    ITRange *range;
+    int n = 0;
+
+    assert(ranges || !max);
+
+    it_tree_iter_init(tree, &iter, start, end);
+    while (n < max && (range = it_tree_iter_next(&iter))) {
+        ranges[n++] = *range;
     }
+
+    return n;
 }
 
-int it_tree_remove(ITTree *tree, ITValue start, ITValue end)
+/* Insert the range [start, end] right after `node' */
+static int it_tree_insert_after(ITTree *tree, ITNode *node,
+                                ITValue start, ITValue end)
 {
-    ITRange range = { .start = start, .end = end }, *overlap, and;
-    GTree *gtree;
+    ITNode *new = it_node_alloc(tree);
+
+    if (!new) {
+        return IT_ERR_NOMEM;
+    }
+    new->range.start = start;
+    new->range.end = end;
 
-    g_assert(tree);
+    if (!node->right) {
+        it_tree_link(tree, node, false, new);
+    } else {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        it_tree_link(tree, node, true, new);
+    }
 
-    gtree = tree->tree;
-    while ((overlap = g_tree_lookup(gtree, &range))) {
-        if (it_range_cover(overlap, &range)) {
-            /* Split existing range into two if needed; done */
-            it_tree_remove_subset(gtree, overlap, &range);
+    return IT_OK;
+}
+
+int it_tree_remove(ITTree *tree, ITValue start, ITValue end)
+{
+    ITNode *node, *next;
+    ITValue last;
+    int ret;
+
+    assert(tree);
+
+    node = it_tree_lower_bound(tree, start);
+    while (node && node->range.start <= end) {
+        if (node->range.start < start) {
+            if (node->range.end > end) {
+                /* Split existing range into two; done */
+                last = node->range.end;
+                node->range.end = start - 1;
+                ret = it_tree_insert_after(tree, node, end + 1, last);
+                if (ret) {
+                    /* Keep the set unchanged on failure */
+                    node->range.end = last;
+                }
+                return ret;
+            }
+            node->range.end = start - 1;
+            node = it_node_next(node);
+        } else if (node->range.end > end) {
+            node->range.start = end + 1;
             break;
         } else {
-            /* Remove intersection and continue */
-            it_range_and(&and, overlap, &range);
-            g_assert(and.start <= and.end);
-            it_tree_remove_subset(gtree, overlap, &and);
+            /* Covered by the removed range completely */
+            next = it_node_next(node);
+            it_tree_unlink(tree, node);
+            it_node_free(tree, node);
+            node = next;
         }
     }
 
     return IT_OK;
 }
 
+int it_tree_reserve(ITTree *tree, unsigned int n)
+{
+    ITNode *node, *taken = NULL;
+    int ret = IT_OK;
+
+    assert(tree);
+
+    /* Take the nodes out, then give them all back to the free list */
+    while (n--) {
+        node = it_node_alloc(tree);
+        if (!node) {
+            ret = IT_ERR_NOMEM;
+            break;
+        }
+        node->parent = taken;
+        taken = node;
+    }
+    while ((node = taken)) {
+        taken = node->parent;
+        it_node_free(tree, node);
+    }
+
+    return ret;
+}
+
 void it_tree_destroy(ITTree *tree)
 {
-    g_tree_destroy(tree->tree);
-    g_free(tree);
+    ITChunk *chunk;
+
+    while ((chunk = tree->chunks)) {
+        tree->chunks = chunk->next;
+        free(chunk);
+    }
+    free(tree);
 }
@@ -1,5 +1,5 @@
 /*
- * An very simplified interval tree implementation based on GTree.
+ * An very simplified interval tree implementation based on AVL tree.
  *
  * Copyright 2018 Red Hat, Inc.
  *
@@ -23,14 +23,18 @@
  * for the thread safety issue.
  */
 
-#include <glib.h>
+#include <stdbool.h>
 
 #define  IT_OK           (0)
 #define  IT_ERR_OVERLAP  (-1)
+#define  IT_ERR_NOMEM    (-2)
 
 typedef unsigned long long ITValue;
 typedef struct ITTree ITTree;
-typedef gboolean (*it_tree_iterator)(ITValue start, ITValue end);
+typedef struct ITNode ITNode;
+typedef bool (*it_tree_iterator)(ITValue start, ITValue end);
+typedef bool (*it_tree_range_iterator)(ITValue start, ITValue end,
+                                       void *opaque);
 
 struct ITRange {
     ITValue start;
@@ -38,6 +42,16 @@ struct ITRange {
 };
 typedef struct ITRange ITRange;
 
+/*
+ * Cursor to walk the ranges overlapping with [start, end].  Fields are
+ * internal; it should only be used with it_tree_iter_*().
+ */
+struct ITIter {
+    ITNode *node;
+    ITValue end;
+};
+typedef struct ITIter ITIter;
+
 /**
  * it_tree_new:
  *
@@ -55,7 +69,8 @@ ITTree *it_tree_new(void);
  * @end: the end of range, inclusive
  *
  * Insert an interval range to the tree.  If there is overlapped
- * ranges, IT_ERR_OVERLAP will be returned.
+ * ranges, IT_ERR_OVERLAP will be returned.  Adjacent ranges are merged
+ * with the new one.
  *
  * Return: 0 if succeeded, or <0 if error.
  */
@@ -76,6 +91,20 @@ int it_tree_insert(ITTree *tree, ITValue start, ITValue end);
  */
 int it_tree_remove(ITTree *tree, ITValue start, ITValue end);
 
+/**
+ * it_tree_reserve:
+ *
+ * @tree: the interval tree to reserve nodes for
+ * @n: the number of nodes
+ *
+ * Make sure @n nodes are available without allocating.  Each
+ * it_tree_insert() or it_tree_remove() takes at most one node, so the
+ * next @n of them cannot fail with IT_ERR_NOMEM.
+ *
+ * Return: 0 if succeeded, or <0 if error.
+ */
+int it_tree_reserve(ITTree *tree, unsigned int n);
+
 /**
  * it_tree_find:
  *
@@ -116,6 +145,68 @@ ITRange *it_tree_find_value(ITTree *tree, ITValue value);
  */
 void it_tree_foreach(ITTree *tree, it_tree_iterator iterator);
 
+/**
+ * it_tree_iter_init:
+ *
+ * @tree: the interval tree to iterate on
+ * @iter: the cursor to initialize
+ * @start: the start of range, inclusive
+ * @end: the end of range, inclusive
+ *
+ * Setup @iter to walk all the ranges overlapping with [@start, @end]
+ * in ascending order, using it_tree_iter_next().  The tree must not be
+ * modified during the walk.
+ *
+ * Return: None.
+ */
+void it_tree_iter_init(ITTree *tree, ITIter *iter, ITValue start,
+                       ITValue end);
+
+/**
+ * it_tree_iter_next:
+ *
+ * @iter: the cursor initialized by it_tree_iter_init()
+ *
+ * Return: the next overlapping range, or NULL if no more.  Same as
+ * it_tree_find(), the returned ITRange should only be read.
+ */
+ITRange *it_tree_iter_next(ITIter *iter);
+
+/**
+ * it_tree_foreach_range:
+ *
+ * @tree: the interval tree to iterate on
+ * @start: the start of range, inclusive
+ * @end: the end of range, inclusive
+ * @iterator: the interator for the ranges, return true to stop
+ * @opaque: the pointer passed to @iterator
+ *
+ * Similar to it_tree_foreach(), but only for the ranges overlapping
+ * with [@start, @end], which costs O(log(n) + k) rather than O(n).
+ *
+ * Return: None.
+ */
+void it_tree_foreach_range(ITTree *tree, ITValue start, ITValue end,
+                           it_tree_range_iterator iterator, void *opaque);
+
+/**
+ * it_tree_find_all:
+ *
+ * @tree: the interval tree to search from
+ * @start: the start of range, inclusive
+ * @end: the end of range, inclusive
+ * @ranges: the array to fill with the overlapping ranges
+ * @max: the size of @ranges
+ *
+ * Copy up to @max ranges overlapping with [@start, @end] into @ranges
+ * in ascending order.  The ranges are copied as a whole and are not
+ * clipped by [@start, @end].
+ *
+ * Return: number of ranges copied.
+ */
+int it_tree_find_all(ITTree *tree, ITValue start, ITValue end,
+                     ITRange *ranges, int max);
+
 /**
  * it_tree_destroy:
  *
@@ -1,11 +1,16 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <malloc.h>
 #include "interval-tree.h"
+#include "interval-hybrid.h"
 
-gboolean iterator(ITValue start, ITValue end)
+bool iterator(ITValue start, ITValue end)
 {
     printf("[%llu, %llu] ", start, end);
-    return FALSE;
+    return false;
 }
 
 void it_tree_dump(ITTree *tree)
@@ -15,32 +20,424 @@ void it_tree_dump(ITTree *tree)
     printf("\n");
 }
 
-int main(void)
+/* Linked with --wrap=malloc, to make allocations fail on demand */
+void *__real_malloc(size_t size);
+static bool malloc_fail;
+
+void *__wrap_malloc(size_t size)
+{
+    return malloc_fail ? NULL : __real_malloc(size);
+}
+
+static unsigned long bench_ranges;
+
+static bool bench_count(ITValue start, ITValue end)
+{
+    bench_ranges++;
+    return false;
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void bench_report(const char *name, long long ns, unsigned long ops)
+{
+    printf("%-20s %8.1f ns/op\n", name, (double)ns / ops);
+}
+
+/* Shuffled page numbers 0, step, 2*step, ... */
+static ITValue *bench_pages(unsigned long size, int step)
+{
+    ITValue *pages = malloc(sizeof(*pages) * size), tmp;
+    unsigned long i, j;
+
+    assert(pages);
+    for (i = 0; i < size; i++) {
+        pages[i] = i * step;
+    }
+    for (i = size - 1; i > 0; i--) {
+        j = random() % (i + 1);
+        tmp = pages[i];
+        pages[i] = pages[j];
+        pages[j] = tmp;
+    }
+    return pages;
+}
+
+/*
+ * Dirty page tracking like workloads, with one page per range:
+ *
+ * - fragmented: every other page is dirty, so nothing can be merged
+ * - random: pages dirtied randomly, so ranges merge and split
+ */
+static void bench(unsigned long size)
+{
+    ITValue *pages = bench_pages(size, 2);
+    ITTree *tree = it_tree_new();
+    unsigned long i, found = 0;
+    long long start;
+
+    printf("Benchmark with %lu pages:\n", size);
+
+    start = now_ns();
+    for (i = 0; i < size; i++) {
+        assert(it_tree_insert(tree, pages[i], pages[i]) == IT_OK);
+    }
+    bench_report("fragmented insert", now_ns() - start, size);
+
+    start = now_ns();
+    for (i = 0; i < size; i++) {
+        assert(it_tree_find_value(tree, pages[i]));
+        assert(!it_tree_find_value(tree, pages[i] + 1));
+    }
+    bench_report("fragmented find", now_ns() - start, size * 2);
+
+    start = now_ns();
+    for (i = 0; i < size; i++) {
+        assert(it_tree_remove(tree, pages[i], pages[i]) == IT_OK);
+    }
+    bench_report("fragmented remove", now_ns() - start, size);
+    assert(!it_tree_find(tree, 0, size * 2));
+    it_tree_destroy(tree);
+
+    for (i = 0; i < size; i++) {
+        pages[i] = random() % (size * 2);
+    }
+
+    tree = it_tree_new();
+    start = now_ns();
+    for (i = 0; i < size; i++) {
+        it_tree_insert(tree, pages[i], pages[i]);
+    }
+    bench_report("random insert", now_ns() - start, size);
+
+    start = now_ns();
+    for (i = 0; i < size; i++) {
+        found += !!it_tree_find_value(tree, i);
+    }
+    bench_report("random find", now_ns() - start, size);
+
+    start = now_ns();
+    for (i = 0; i < size; i += 2) {
+        it_tree_remove(tree, pages[i], pages[i]);
+    }
+    bench_report("random remove", now_ns() - start, size / 2);
+
+    bench_ranges = 0;
+    it_tree_foreach(tree, bench_count);
+    printf("%lu pages found, %lu ranges left\n", found, bench_ranges);
+
+    it_tree_destroy(tree);
+    free(pages);
+}
+
+static ITValue bench_filter_start, bench_filter_end;
+
+static bool bench_filter(ITValue start, ITValue end)
+{
+    if (start > bench_filter_end) {
+        return true;
+    }
+    if (end >= bench_filter_start) {
+        bench_ranges++;
+    }
+    return false;
+}
+
+static bool bench_count_range(ITValue start, ITValue end, void *opaque)
 {
+    (*(unsigned long *)opaque)++;
+    return false;
+}
+
+/*
+ * Query every range overlapping a window of `width' pages, on a tree
+ * of `size' fragmented one-page ranges.  Walking the whole tree with
+ * it_tree_foreach() is only done for a few queries since it is O(n).
+ */
+static void bench_query(unsigned long size, ITValue width)
+{
+    ITTree *tree = it_tree_new();
+    ITRange *ranges = malloc(sizeof(*ranges) * width);
+    unsigned long i, n, total, queries = 100000, slow = 100;
+    ITValue *starts = malloc(sizeof(*starts) * queries);
+    ITRange *range;
+    ITIter iter;
+    long long start;
+
+    printf("Query windows of %llu pages with %lu ranges:\n", width, size);
+
+    for (i = 0; i < size; i++) {
+        assert(it_tree_insert(tree, i * 2, i * 2) == IT_OK);
+    }
+    for (i = 0; i < queries; i++) {
+        starts[i] = random() % (size * 2);
+    }
+
+    total = 0;
+    start = now_ns();
+    for (i = 0; i < queries; i++) {
+        it_tree_iter_init(tree, &iter, starts[i], starts[i] + width - 1);
+        while ((range = it_tree_iter_next(&iter))) {
+            total++;
+        }
+    }
+    bench_report("iterator", now_ns() - start, queries);
+    n = total;
+
+    total = 0;
+    start = now_ns();
+    for (i = 0; i < queries; i++) {
+        it_tree_foreach_range(tree, starts[i], starts[i] + width - 1,
+                              bench_count_range, &total);
+    }
+    bench_report("foreach_range", now_ns() - start, queries);
+    assert(total == n);
+
+    total = 0;
+    start = now_ns();
+    for (i = 0; i < queries; i++) {
+        total += it_tree_find_all(tree, starts[i], starts[i] + width - 1,
+                                  ranges, width);
+    }
+    bench_report("find_all", now_ns() - start, queries);
+    assert(total == n);
+
+    total = 0;
+    for (i = 0; i < slow; i++) {
+        it_tree_iter_init(tree, &iter, starts[i], starts[i] + width - 1);
+        while ((range = it_tree_iter_next(&iter))) {
+            total++;
+        }
+    }
+    bench_ranges = 0;
+    start = now_ns();
+    for (i = 0; i < slow; i++) {
+        bench_filter_start = starts[i];
+        bench_filter_end = starts[i] + width - 1;
+        it_tree_foreach(tree, bench_filter);
+    }
+    bench_report("foreach and filter", now_ns() - start, slow);
+    assert(bench_ranges == total);
+
+    it_tree_destroy(tree);
+    free(starts);
+    free(ranges);
+}
+
+/* Bytes allocated from the heap */
+static size_t heap_used(void)
+{
+    struct mallinfo2 info = mallinfo2();
+
+    return info.uordblks + info.hblkhd;
+}
+
+/*
+ * Compare ITTree and ITHybrid on one-page ranges, either with every
+ * other page (fragmented), or all pages inserted in random order
+ * (contiguous; merged into one range at last).
+ */
+static void bench_hybrid(unsigned long size)
+{
+    const char *names[] = { "fragmented", "contiguous" };
+    ITValue *pages;
     ITTree *tree;
+    ITHybrid *hybrid;
+    unsigned long i;
+    long long start;
+    size_t heap;
+    int step;
+
+    for (step = 2; step >= 1; step--) {
+        printf("ITTree vs ITHybrid, %s, %lu pages:\n", names[2 - step], size);
+        pages = bench_pages(size, step);
+
+        heap = heap_used();
+        tree = it_tree_new();
+        start = now_ns();
+        for (i = 0; i < size; i++) {
+            assert(it_tree_insert(tree, pages[i], pages[i]) == IT_OK);
+        }
+        bench_report("tree insert", now_ns() - start, size);
+        printf("%-20s %8.1f bytes/page\n", "tree memory",
+               (double)(heap_used() - heap) / size);
+        start = now_ns();
+        for (i = 0; i < size * step; i++) {
+            assert(!!it_tree_find_value(tree, i) == !(i % step));
+        }
+        bench_report("tree find", now_ns() - start, size * step);
+        it_tree_destroy(tree);
+
+        heap = heap_used();
+        hybrid = it_hybrid_new();
+        start = now_ns();
+        for (i = 0; i < size; i++) {
+            assert(it_hybrid_insert(hybrid, pages[i], pages[i]) == IT_OK);
+        }
+        bench_report("hybrid insert", now_ns() - start, size);
+        printf("%-20s %8.1f bytes/page\n", "hybrid memory",
+               (double)(heap_used() - heap) / size);
+        start = now_ns();
+        for (i = 0; i < size * step; i++) {
+            assert(!!it_hybrid_find_value(hybrid, i) == !(i % step));
+        }
+        bench_report("hybrid find", now_ns() - start, size * step);
+        start = now_ns();
+        for (i = 0; i < size; i++) {
+            assert(it_hybrid_remove(hybrid, pages[i], pages[i]) == IT_OK);
+        }
+        bench_report("hybrid remove", now_ns() - start, size);
+        assert(!it_hybrid_find(hybrid, 0, size * step));
+        it_hybrid_destroy(hybrid);
+
+        free(pages);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    ITTree *tree;
+
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        bench(argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000);
+        bench_query(argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000, 64);
+        bench_hybrid(argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000);
+        return 0;
+    }
 
     printf("Test inserting isolated ranges, and merge of ranges:\n");
     tree = it_tree_new();
-    g_assert(it_tree_insert(tree, 10, 19) == 0);
-    g_assert(it_tree_insert(tree, 40, 59) == 0);
-    g_assert(it_tree_insert(tree, 80, 99) == 0);
-    g_assert(it_tree_insert(tree, 20, 39) == 0);
-    g_assert(it_tree_insert(tree, 25, 29) < 0);
-    g_assert(it_tree_find(tree, 85, 89) != NULL);
-    g_assert(it_tree_find(tree, 120, 129) == NULL);
+    assert(it_tree_insert(tree, 10, 19) == 0);
+    assert(it_tree_insert(tree, 40, 59) == 0);
+    assert(it_tree_insert(tree, 80, 99) == 0);
+    assert(it_tree_insert(tree, 20, 39) == 0);
+    assert(it_tree_insert(tree, 25, 29) < 0);
+    assert(it_tree_find(tree, 85, 89) != NULL);
+    assert(it_tree_find(tree, 120, 129) == NULL);
+    assert(it_tree_find(tree, 10, 10)->end == 59);
     it_tree_dump(tree);
     it_tree_destroy(tree);
 
+    printf("Test querying ranges:\n");
+    tree = it_tree_new();
+    assert(it_tree_insert(tree, 10, 19) == 0);
+    assert(it_tree_insert(tree, 40, 59) == 0);
+    assert(it_tree_insert(tree, 80, 99) == 0);
+    {
+        ITRange ranges[3];
+        ITIter iter;
+
+        assert(it_tree_find_all(tree, 15, 80, ranges, 3) == 3);
+        assert(ranges[0].start == 10 && ranges[2].end == 99);
+        assert(it_tree_find_all(tree, 15, 80, ranges, 1) == 1);
+        assert(it_tree_find_all(tree, 20, 39, ranges, 3) == 0);
+        it_tree_iter_init(tree, &iter, 59, 1000);
+        assert(it_tree_iter_next(&iter)->start == 40);
+        assert(it_tree_iter_next(&iter)->start == 80);
+        assert(it_tree_iter_next(&iter) == NULL);
+    }
+    it_tree_destroy(tree);
+
     printf("Test removing ranges:\n");
     tree = it_tree_new();
-    g_assert(it_tree_insert(tree, 10, 19) == 0);
-    g_assert(it_tree_insert(tree, 40, 59) == 0);
-    g_assert(it_tree_insert(tree, 80, 99) == 0);
-    g_assert(it_tree_remove(tree, 0, 69) == 0);
-    g_assert(it_tree_remove(tree, 85, 89) == 0);
+    assert(it_tree_insert(tree, 10, 19) == 0);
+    assert(it_tree_insert(tree, 40, 59) == 0);
+    assert(it_tree_insert(tree, 80, 99) == 0);
+    assert(it_tree_remove(tree, 0, 69) == 0);
+    assert(it_tree_remove(tree, 85, 89) == 0);
+    assert(it_tree_find(tree, 0, 79) == NULL);
+    assert(it_tree_find(tree, 85, 89) == NULL);
+    assert(it_tree_find_value(tree, 84)->start == 80);
+    assert(it_tree_find_value(tree, 90)->end == 99);
     it_tree_dump(tree);
     it_tree_destroy(tree);
 
+    printf("Test removing ranges without memory:\n");
+    tree = it_tree_new();
+    {
+        ITValue i;
+
+        for (i = 0; i < 1000; i++) {
+            assert(it_tree_insert(tree, i * 10, i * 10 + 8) == 0);
+        }
+        /* Splits succeed as long as the last chunk has free nodes */
+        malloc_fail = true;
+        for (i = 0; i < 1000; i++) {
+            if (it_tree_remove(tree, i * 10 + 4, i * 10 + 4)) {
+                break;
+            }
+        }
+        malloc_fail = false;
+        assert(i < 1000);
+        assert(it_tree_find_value(tree, i * 10)->end == i * 10 + 8);
+        assert(i == 0 ||
+               it_tree_find_value(tree, i * 10 - 10)->end == i * 10 - 7);
+    }
+    it_tree_destroy(tree);
+
+    printf("Test hybrid of ranges and bitmaps:\n");
+    {
+        ITHybrid *hybrid = it_hybrid_new();
+        ITValue i;
+
+        /* Fragmented enough to be kept in bitmap */
+        for (i = 0; i < 100; i += 2) {
+            assert(it_hybrid_insert(hybrid, i, i) == 0);
+        }
+        assert(it_hybrid_insert(hybrid, 10, 10) < 0);
+        assert(it_hybrid_insert(hybrid, 4095, 4200) == 0);
+        assert(it_hybrid_find_value(hybrid, 4096)->start == 4096);
+        assert(it_hybrid_find_value(hybrid, 4095)->end == 4095);
+        assert(it_hybrid_find(hybrid, 99, 4095)->start == 4095);
+        assert(it_hybrid_find(hybrid, 99, 4094) == NULL);
+        assert(it_hybrid_find_value(hybrid, 1) == NULL);
+        assert(it_hybrid_remove(hybrid, 0, 5000) == 0);
+        assert(it_hybrid_find(hybrid, 0, 5000) == NULL);
+        it_hybrid_destroy(hybrid);
+    }
+
+    printf("Test hybrid updates without memory:\n");
+    {
+        ITHybrid *hybrid = it_hybrid_new();
+        ITValue i;
+
+        /* Chunk 0 in bitmap, one range in each of the chunks after */
+        for (i = 0; i < 100; i += 2) {
+            assert(it_hybrid_insert(hybrid, i, i) == 0);
+        }
+        for (i = 2; i < 1000; i++) {
+            assert(it_hybrid_insert(hybrid, i * IT_HYBRID_CHUNK + 100,
+                                    i * IT_HYBRID_CHUNK + 200) == 0);
+        }
+        /* Use up the free tree nodes by splitting ranges */
+        malloc_fail = true;
+        for (i = 2; i < 1000; i++) {
+            if (it_hybrid_remove(hybrid, i * IT_HYBRID_CHUNK + 150,
+                                 i * IT_HYBRID_CHUNK + 150)) {
+                break;
+            }
+        }
+        assert(i < 1000);
+        /* The bitmap part must not be set when the tree part fails */
+        assert(it_hybrid_insert(hybrid, IT_HYBRID_CHUNK - 1,
+                                IT_HYBRID_CHUNK + 10) == IT_ERR_NOMEM);
+        malloc_fail = false;
+        assert(!it_hybrid_find(hybrid, IT_HYBRID_CHUNK - 1,
+                               IT_HYBRID_CHUNK + 10));
+        assert(it_hybrid_find_value(hybrid, 98)->end == 98);
+        assert(it_hybrid_insert(hybrid, IT_HYBRID_CHUNK - 1,
+                                IT_HYBRID_CHUNK + 10) == 0);
+        assert(it_hybrid_find_value(hybrid, IT_HYBRID_CHUNK)->start ==
+               IT_HYBRID_CHUNK);
+        it_hybrid_destroy(hybrid);
+    }
+
     /*
     printf("Test removing ranges:\n");
     tree = it_tree_new();